@@ -0,0 +1,91 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdint.h>   // for INT64_MAX
+#include <algorithm>  // for std::max
+
+#include "./AdmissionController.h"
+
+namespace hw4 {
+
+AdmissionController::AdmissionController(uint32_t target_ms,
+                                         uint32_t interval_ms,
+                                         uint32_t max_depth)
+  : target_ns_(static_cast<int64_t>(target_ms) * 1000000),
+    interval_ns_(static_cast<int64_t>(interval_ms) * 1000000),
+    max_depth_(max_depth), depth_(0), progress_ns_(0), interval_end_ns_(0),
+    min_sojourn_ns_(INT64_MAX), overloaded_(false), admitted_(0),
+    shed_(0), dequeued_(0), total_delay_ns_(0), max_delay_ns_(0) { }
+
+bool AdmissionController::Admit(int64_t now_ns) {
+  int64_t depth = depth_.load(std::memory_order_relaxed);
+  bool full = (max_depth_ > 0 && depth >= max_depth_);
+  if (full || (depth > 0 && Standing(now_ns))) {
+    shed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  if (depth_.fetch_add(1, std::memory_order_relaxed) == 0)
+    progress_ns_.store(now_ns, std::memory_order_relaxed);
+  admitted_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+void AdmissionController::Dequeued(int64_t sojourn_ns, int64_t now_ns) {
+  depth_.fetch_sub(1, std::memory_order_relaxed);
+  uint64_t delay = std::max<int64_t>(sojourn_ns, 0);
+  dequeued_.fetch_add(1, std::memory_order_relaxed);
+  total_delay_ns_.fetch_add(delay, std::memory_order_relaxed);
+  uint64_t max = max_delay_ns_.load(std::memory_order_relaxed);
+  while (delay > max &&
+         !max_delay_ns_.compare_exchange_weak(max, delay,
+                                              std::memory_order_relaxed)) {
+  }
+  if (target_ns_ == 0)
+    return;
+  progress_ns_.store(now_ns, std::memory_order_relaxed);
+
+  int64_t min = min_sojourn_ns_.load(std::memory_order_relaxed);
+  while (sojourn_ns < min &&
+         !min_sojourn_ns_.compare_exchange_weak(min, sojourn_ns,
+                                                std::memory_order_relaxed)) {
+  }
+
+  // If the interval is over, one of us judges it and starts the next.
+  int64_t end = interval_end_ns_.load(std::memory_order_relaxed);
+  if (now_ns < end ||
+      !interval_end_ns_.compare_exchange_strong(end, now_ns + interval_ns_,
+                                                std::memory_order_relaxed))
+    return;
+  min = min_sojourn_ns_.exchange(INT64_MAX, std::memory_order_relaxed);
+  overloaded_.store(end > 0 && min > target_ns_, std::memory_order_relaxed);
+}
+
+bool AdmissionController::Standing(int64_t now_ns) const {
+  if (target_ns_ == 0)
+    return false;
+  if (now_ns - progress_ns_.load(std::memory_order_relaxed) > interval_ns_)
+    return true;
+  return overloaded_.load(std::memory_order_relaxed) &&
+      now_ns < interval_end_ns_.load(std::memory_order_relaxed);
+}
+
+AdmissionController::Stats AdmissionController::GetStats() const {
+  Stats stats;
+  stats.admitted = admitted_.load(std::memory_order_relaxed);
+  stats.shed = shed_.load(std::memory_order_relaxed);
+  stats.queued = std::max<int64_t>(depth_.load(std::memory_order_relaxed), 0);
+  stats.dequeued = dequeued_.load(std::memory_order_relaxed);
+  stats.total_delay_ns = total_delay_ns_.load(std::memory_order_relaxed);
+  stats.max_delay_ns = max_delay_ns_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}  // namespace hw4
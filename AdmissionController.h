@@ -0,0 +1,107 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_ADMISSIONCONTROLLER_H_
+#define HW4_ADMISSIONCONTROLLER_H_
+
+#include <stdint.h>  // for uint32_t, etc.
+#include <atomic>    // for std::atomic
+
+namespace hw4 {
+
+// An AdmissionController decides whether a request may join the queue
+// of requests waiting for a worker, so that an overloaded server
+// turns some requests away quickly rather than making every one of
+// them wait longer and longer.
+//
+// It follows CoDel ("Controlling Queue Delay", Nichols and Jacobson):
+// a queue that is merely absorbing a burst drains now and then, so
+// some request gets through quickly; a standing queue never does.  So
+// we track the shortest time any request spent queued during each
+// interval, and if even that exceeds the target delay, the queue is
+// standing and the server is overloaded.  A queue that nobody has
+// taken a request from for a whole interval (every worker is stuck,
+// say) is standing too.  While it is overloaded, and also whenever the
+// queue holds "max_depth" requests, new requests are refused.  An
+// empty queue always admits.
+//
+// An AdmissionController is thread-safe.
+class AdmissionController {
+ public:
+  // Counters describing what the controller has done.
+  struct Stats {
+    uint64_t admitted;        // requests let into the queue
+    uint64_t shed;            // requests refused
+    uint64_t queued;          // requests in the queue right now
+    uint64_t dequeued;        // requests taken off the queue
+    uint64_t total_delay_ns;  // the time they spent queued, in all
+    uint64_t max_delay_ns;    // the longest any of them spent queued
+  };
+
+  // Creates a controller that considers the queue standing once no
+  // request got through it in under "target_ms" milliseconds for
+  // "interval_ms" milliseconds.  A "target_ms" of zero turns that off.
+  // A "max_depth" of zero means no limit on the queue's length.
+  AdmissionController(uint32_t target_ms, uint32_t interval_ms,
+                      uint32_t max_depth);
+  virtual ~AdmissionController() { }
+
+  // Decides whether a request may join the queue at "now_ns", the time
+  // on the monotonic clock.  If so, counts it as queued and returns
+  // true; the caller must then call Dequeued(), or Withdraw() if it
+  // couldn't queue the request after all.
+  bool Admit(int64_t now_ns);
+
+  // Records that a worker took an admitted request off the queue
+  // after it waited "sojourn_ns" nanoseconds.  "now_ns" is the time on
+  // the monotonic clock.
+  void Dequeued(int64_t sojourn_ns, int64_t now_ns);
+
+  // Takes back an admitted request that never made it into the queue.
+  void Withdraw() { depth_.fetch_sub(1, std::memory_order_relaxed); }
+
+  // Returns a snapshot of the counters.
+  Stats GetStats() const;
+
+ private:
+  // Returns true if, at "now_ns", the queue is standing: either it was
+  // during the interval just judged, or it has been stuck for a whole
+  // interval.
+  bool Standing(int64_t now_ns) const;
+
+  int64_t target_ns_;
+  int64_t interval_ns_;
+  int64_t max_depth_;
+
+  // The number of admitted requests not yet dequeued, and the last time
+  // the queue made progress: when a request was dequeued, or when one
+  // joined the empty queue.
+  std::atomic<int64_t> depth_;
+  std::atomic<int64_t> progress_ns_;
+
+  // The end of the current interval, and the shortest sojourn seen
+  // during it.  Whoever dequeues the first request after the interval
+  // ends judges it and starts the next one; the verdict, overloaded_,
+  // holds until the new interval ends.
+  std::atomic<int64_t> interval_end_ns_;
+  std::atomic<int64_t> min_sojourn_ns_;
+  std::atomic<bool> overloaded_;
+
+  std::atomic<uint64_t> admitted_;
+  std::atomic<uint64_t> shed_;
+  std::atomic<uint64_t> dequeued_;
+  std::atomic<uint64_t> total_delay_ns_;
+  std::atomic<uint64_t> max_delay_ns_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_ADMISSIONCONTROLLER_H_
@@ -0,0 +1,74 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <time.h>     // for clock_gettime()
+#include <algorithm>  // for std::sort
+#include <string>
+#include <vector>
+
+#include "./DeadlineQueryProcessor.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+// Returns the time on the monotonic clock, in nanoseconds.
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+QueryDeadline QueryDeadline::After(uint32_t timeout_ms) {
+  QueryDeadline deadline;
+  if (timeout_ms > 0)
+    deadline.expires_ns_ = NowNs() + static_cast<int64_t>(timeout_ms) * 1000000;
+  return deadline;
+}
+
+bool QueryDeadline::Expired() const {
+  return expires_ns_ != INT64_MAX && NowNs() >= expires_ns_;
+}
+
+vector<hw3::QueryProcessor::QueryResult>
+QueryEngine::ProcessQuery(const vector<string>& query,
+                          const QueryDeadline& deadline,
+                          bool* const partial) const {
+  Verify333(query.size() > 0);
+
+  vector<hw3::QueryProcessor::QueryResult> results;
+  *partial = false;
+  for (int i = 0; i < num_indices(); i++) {
+    if (!ProcessIndex(i, query, deadline, &results)) {
+      *partial = true;
+      break;
+    }
+  }
+
+  std::sort(results.begin(), results.end());
+  return results;
+}
+
+bool DeadlineQueryProcessor::ProcessIndex(int index,
+                                          const vector<string>& query,
+                                          const QueryDeadline& deadline,
+                                          vector<QueryResult>* const results)
+    const {
+  return EvaluateIndex(*itr_array_[index], *dtr_array_[index], query,
+                       deadline, results);
+}
+
+}  // namespace hw4
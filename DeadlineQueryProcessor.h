@@ -0,0 +1,165 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_DEADLINEQUERYPROCESSOR_H_
+#define HW4_DEADLINEQUERYPROCESSOR_H_
+
+#include <stdint.h>     // for int64_t, etc.
+#include <list>         // for std::list
+#include <memory>       // for std::unique_ptr
+#include <string>       // for std::string
+#include <type_traits>  // for std::remove_pointer
+#include <vector>       // for std::vector
+
+#include "./libhw3/QueryProcessor.h"
+
+namespace hw4 {
+
+// A QueryDeadline tells a query when to give up.
+class QueryDeadline {
+ public:
+  // A deadline that never expires.
+  QueryDeadline() : expires_ns_(INT64_MAX) { }
+
+  // Returns a deadline "timeout_ms" milliseconds from now, or one that
+  // never expires if "timeout_ms" is zero.
+  static QueryDeadline After(uint32_t timeout_ms);
+
+  // Returns true once the deadline has passed.
+  bool Expired() const;
+
+ private:
+  // When the deadline passes, on the monotonic clock.
+  int64_t expires_ns_;
+};
+
+// A QueryEngine answers queries against a set of index files, giving
+// up once a deadline expires.  Subclasses supply the evaluation of the
+// query against one index file, however they read it.
+class QueryEngine {
+ public:
+  virtual ~QueryEngine() { }
+
+  // Like hw3::QueryProcessor::ProcessQuery(), but stops once "deadline"
+  // expires.  Then the results come from only the index files that were
+  // fully evaluated (still ranked and sorted), and "*partial" is set to
+  // true; otherwise it is set to false.
+  std::vector<hw3::QueryProcessor::QueryResult>
+  ProcessQuery(const std::vector<std::string>& query,
+               const QueryDeadline& deadline, bool* const partial) const;
+
+ protected:
+  // Returns the number of index files we answer queries against.
+  virtual int num_indices() const = 0;
+
+  // Evaluates "query" against index file "index", adding the matches
+  // to "results".  Returns false, adding nothing, if "deadline" expired
+  // first.
+  virtual bool ProcessIndex(
+      int index, const std::vector<std::string>& query,
+      const QueryDeadline& deadline,
+      std::vector<hw3::QueryProcessor::QueryResult>* const results) const = 0;
+};
+
+// Evaluates "query" against one index file, through its word index
+// "itr" and its document table "dtr", adding the matches to "results".
+// Returns false, adding nothing, if "deadline" expired first.
+//
+// Works with any readers shaped like hw3's: itr.LookupWord() returns
+// a new'ed docID table reader (or nullptr), which offers GetDocIDList()
+// and LookupDocID(), and dtr.LookupDocID() finds a document's name.
+template <typename IndexTable, typename DocTable>
+bool EvaluateIndex(const IndexTable& itr, const DocTable& dtr,
+                   const std::vector<std::string>& query,
+                   const QueryDeadline& deadline,
+                   std::vector<hw3::QueryProcessor::QueryResult>* const
+                     results);
+
+// A DeadlineQueryProcessor is the QueryEngine that reads index files
+// through the hw3 readers that hw3::QueryProcessor opens.  Those share
+// one stdio stream per index file, so a DeadlineQueryProcessor can
+// only answer one query at a time.
+class DeadlineQueryProcessor : public hw3::QueryProcessor,
+                               public QueryEngine {
+ public:
+  // Arguments are as for hw3::QueryProcessor.
+  explicit DeadlineQueryProcessor(const std::list<std::string>& index_list,
+                                  bool validate = true)
+    : hw3::QueryProcessor(index_list, validate) { }
+
+  using QueryEngine::ProcessQuery;
+
+ protected:
+  int num_indices() const override { return array_len_; }
+  bool ProcessIndex(int index, const std::vector<std::string>& query,
+                    const QueryDeadline& deadline,
+                    std::vector<QueryResult>* const results) const override;
+};
+
+// How many documents of a posting list EvaluateIndex() looks at between
+// checks of the deadline.
+static const int kDocsPerDeadlineCheck = 64;
+
+template <typename IndexTable, typename DocTable>
+bool EvaluateIndex(const IndexTable& itr, const DocTable& dtr,
+                   const std::vector<std::string>& query,
+                   const QueryDeadline& deadline,
+                   std::vector<hw3::QueryProcessor::QueryResult>* const
+                     results) {
+  typedef typename std::remove_pointer<
+    decltype(itr.LookupWord(query[0]))>::type DocIDTable;
+
+  if (deadline.Expired())
+    return false;
+
+  // Start with every document containing the first word, ranked by how
+  // often the word appears in it.
+  std::unique_ptr<DocIDTable> ditr(itr.LookupWord(query[0]));
+  if (ditr == nullptr)
+    return true;
+  std::list<hw3::DocIDElementHeader> matches = ditr->GetDocIDList();
+
+  // Then keep only the documents that also contain each further word,
+  // adding up the occurrences.
+  for (size_t w = 1; w < query.size() && !matches.empty(); w++) {
+    if (deadline.Expired())
+      return false;
+    ditr.reset(itr.LookupWord(query[w]));
+    if (ditr == nullptr)
+      return true;
+
+    int checked = 0;
+    for (auto it = matches.begin(); it != matches.end(); ) {
+      if (++checked % kDocsPerDeadlineCheck == 0 && deadline.Expired())
+        return false;
+      std::list<DocPositionOffset_t> positions;
+      if (ditr->LookupDocID(it->doc_id, &positions)) {
+        it->num_positions += positions.size();
+        ++it;
+      } else {
+        it = matches.erase(it);
+      }
+    }
+  }
+
+  for (const hw3::DocIDElementHeader& match : matches) {
+    hw3::QueryProcessor::QueryResult result;
+    if (!dtr.LookupDocID(match.doc_id, &result.document_name))
+      continue;
+    result.rank = match.num_positions;
+    results->push_back(result);
+  }
+  return true;
+}
+
+}  // namespace hw4
+
+#endif  // HW4_DEADLINEQUERYPROCESSOR_H_
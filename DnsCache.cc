@@ -0,0 +1,142 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>   // for inet_pton()
+#include <netdb.h>       // for getnameinfo()
+#include <string.h>      // for memset()
+#include <sys/socket.h>  // for struct sockaddr_storage
+#include <time.h>        // for time()
+#include <string>
+
+#include "./DnsCache.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::map;
+using std::string;
+
+namespace hw4 {
+
+DnsCache::DnsCache(uint32_t ttl_secs, uint32_t max_entries)
+  : ttl_secs_(ttl_secs), max_entries_(max_entries), terminate_(false) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+  Verify333(pthread_cond_init(&cond_, nullptr) == 0);
+  Verify333(pthread_create(&thread_, nullptr, &ResolverThreadFn,
+                           static_cast<void*>(this)) == 0);
+}
+
+DnsCache::~DnsCache() {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  terminate_ = true;
+  Verify333(pthread_cond_signal(&cond_) == 0);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  Verify333(pthread_join(thread_, nullptr) == 0);
+  Verify333(pthread_cond_destroy(&cond_) == 0);
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+bool DnsCache::Lookup(const string& addr, string* const name) {
+  time_t now = time(nullptr);
+  bool found = false;
+  *name = addr;
+
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  map<string, Entry>::iterator it = cache_.find(addr);
+  if (it != cache_.end() && it->second.expires > now) {
+    *name = it->second.name;
+    found = true;
+  } else if (queued_.find(addr) == queued_.end() &&
+             pending_.size() < max_entries_) {
+    // Not cached (or stale), and nobody has asked for it yet.
+    queued_.insert(addr);
+    pending_.push_back(addr);
+    Verify333(pthread_cond_signal(&cond_) == 0);
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return found;
+}
+
+void* DnsCache::ResolverThreadFn(void* arg) {
+  DnsCache* dns = static_cast<DnsCache*>(arg);
+
+  Verify333(pthread_mutex_lock(&dns->lock_) == 0);
+  while (!dns->terminate_) {
+    if (dns->pending_.empty()) {
+      Verify333(pthread_cond_wait(&dns->cond_, &dns->lock_) == 0);
+      continue;
+    }
+    string addr = dns->pending_.front();
+    dns->pending_.pop_front();
+
+    // Do the slow part with the lock released.
+    Verify333(pthread_mutex_unlock(&dns->lock_) == 0);
+    string name = Resolve(addr);
+    Verify333(pthread_mutex_lock(&dns->lock_) == 0);
+
+    time_t now = time(nullptr);
+    if (dns->cache_.find(addr) == dns->cache_.end())
+      dns->MakeRoom(now);
+    Entry& entry = dns->cache_[addr];
+    entry.name = name;
+    entry.expires = now + dns->ttl_secs_;
+    dns->queued_.erase(addr);
+  }
+  Verify333(pthread_mutex_unlock(&dns->lock_) == 0);
+  return nullptr;
+}
+
+string DnsCache::Resolve(const string& addr) {
+  struct sockaddr_storage ss;
+  socklen_t ss_len;
+  memset(&ss, 0, sizeof(ss));
+
+  struct sockaddr_in* in4 = reinterpret_cast<struct sockaddr_in*>(&ss);
+  struct sockaddr_in6* in6 = reinterpret_cast<struct sockaddr_in6*>(&ss);
+  if (inet_pton(AF_INET, addr.c_str(), &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    ss_len = sizeof(*in4);
+  } else if (inet_pton(AF_INET6, addr.c_str(), &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    ss_len = sizeof(*in6);
+  } else {
+    return addr;
+  }
+
+  char host_name[1024];
+  if (getnameinfo(reinterpret_cast<struct sockaddr*>(&ss), ss_len,
+                  host_name, sizeof(host_name), nullptr, 0, 0) != 0) {
+    return addr;
+  }
+  return string(host_name);
+}
+
+void DnsCache::MakeRoom(time_t now) {
+  if (cache_.size() < max_entries_)
+    return;
+
+  // Throw out everything that has expired.
+  map<string, Entry>::iterator it = cache_.begin();
+  while (it != cache_.end()) {
+    if (it->second.expires <= now) {
+      it = cache_.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  // If everything is still fresh, throw out an arbitrary entry.
+  if (cache_.size() >= max_entries_)
+    cache_.erase(cache_.begin());
+}
+
+}  // namespace hw4
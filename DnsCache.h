@@ -0,0 +1,85 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_DNSCACHE_H_
+#define HW4_DNSCACHE_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread threading/mutex functions
+}
+
+#include <stdint.h>   // for uint32_t, etc.
+#include <time.h>     // for time_t
+#include <list>       // for std::list
+#include <map>        // for std::map
+#include <set>        // for std::set
+#include <string>     // for std::string
+
+namespace hw4 {
+
+// A DnsCache maps numeric IP addresses to DNS names without ever making
+// its customers wait for a DNS server.  Lookup() only consults the
+// cache; on a miss, it queues the address for a background thread that
+// does the (blocking) reverse lookup and caches the answer for a while.
+// Until then, customers just use the numeric address.
+//
+// A DnsCache is thread-safe.
+class DnsCache {
+ public:
+  // Starts the resolver thread.  Answers (including failed lookups)
+  // are cached for "ttl_secs" seconds, and at most "max_entries"
+  // addresses are cached at once.
+  DnsCache(uint32_t ttl_secs, uint32_t max_entries);
+
+  // Stops the resolver thread.  Waits for a lookup in progress, if any.
+  virtual ~DnsCache();
+
+  // Looks up the DNS name of the numeric IPv4 or IPv6 address "addr".
+  // If a fresh answer is cached, stores it in "name" and returns true.
+  // Otherwise, queues "addr" to be resolved in the background, stores
+  // "addr" itself in "name", and returns false.  Never blocks on DNS.
+  bool Lookup(const std::string& addr, std::string* const name);
+
+ private:
+  // A cached answer.
+  struct Entry {
+    std::string name;
+    time_t expires;
+  };
+
+  // The resolver thread's start routine.
+  static void* ResolverThreadFn(void* arg);
+
+  // Does the reverse lookup of "addr"; returns "addr" on failure.
+  static std::string Resolve(const std::string& addr);
+
+  // Makes room for a new entry, evicting expired entries first; the
+  // caller must hold lock_.
+  void MakeRoom(time_t now);
+
+  uint32_t ttl_secs_;
+  uint32_t max_entries_;
+
+  // Guards everything below.  cond_ is signaled when an address is
+  // queued or when it is time to shut down.
+  pthread_mutex_t lock_;
+  pthread_cond_t cond_;
+  std::map<std::string, Entry> cache_;
+  std::list<std::string> pending_;
+  std::set<std::string> queued_;
+  bool terminate_;
+
+  pthread_t thread_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_DNSCACHE_H_
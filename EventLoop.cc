@@ -0,0 +1,64 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <unistd.h>      // for close()
+#include <string.h>      // for memset()
+#include <sys/epoll.h>   // for epoll_create1(), epoll_ctl(), etc.
+
+#include "./EventLoop.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+namespace hw4 {
+
+// The events we ask epoll to report for every registered fd.  EPOLLRDHUP
+// lets us notice a client that half-closed its end of the connection.
+static const uint32_t kReadEvents = EPOLLIN | EPOLLRDHUP | EPOLLET;
+
+EventLoop::EventLoop() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  Verify333(epoll_fd_ != -1);
+}
+
+EventLoop::~EventLoop() {
+  if (epoll_fd_ != -1)
+    close(epoll_fd_);
+  epoll_fd_ = -1;
+}
+
+bool EventLoop::Add(int fd, void* data, bool oneshot) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = kReadEvents | (oneshot ? EPOLLONESHOT : 0);
+  ev.data.ptr = data;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool EventLoop::Rearm(int fd, void* data) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = kReadEvents | EPOLLONESHOT;
+  ev.data.ptr = data;
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+bool EventLoop::Remove(int fd) {
+  return epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == 0;
+}
+
+int EventLoop::Wait(struct epoll_event* events, int max_events,
+                    int timeout_ms) {
+  return epoll_wait(epoll_fd_, events, max_events, timeout_ms);
+}
+
+}  // namespace hw4
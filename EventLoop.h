@@ -0,0 +1,67 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_EVENTLOOP_H_
+#define HW4_EVENTLOOP_H_
+
+#include <sys/epoll.h>  // for epoll_event, EPOLLIN, etc.
+
+namespace hw4 {
+
+// An EventLoop is a thin wrapper around a Linux epoll instance.  The
+// server registers its listening socket and every client socket with
+// the loop, and a single thread calls Wait() to learn which of them
+// have become readable.  All registrations are edge-triggered, so the
+// customer must drain a file descriptor (read or accept until EAGAIN)
+// each time it is reported.
+//
+// Client sockets are registered "one-shot": once an event is reported
+// for a client, the loop stops watching it until Rearm() is called.
+// That lets the loop hand a connection to a worker thread without the
+// loop and the worker ever touching it at the same time.
+class EventLoop {
+ public:
+  // Creates the underlying epoll instance.
+  EventLoop();
+
+  // Closes the epoll instance.  Registered file descriptors are not
+  // closed.
+  virtual ~EventLoop();
+
+  // Starts watching "fd" for readability.  "data" is handed back by
+  // Wait() when the fd becomes readable.  If "oneshot" is true, the fd
+  // is disarmed after its first event and must be re-armed with
+  // Rearm().  Returns true on success.
+  bool Add(int fd, void* data, bool oneshot);
+
+  // Re-arms a one-shot fd so that the next readable event is
+  // reported.  If data is already waiting on the fd, the event is
+  // reported right away.  Safe to call from any thread.  Returns true
+  // on success.
+  bool Rearm(int fd, void* data);
+
+  // Stops watching "fd".  Returns true on success.
+  bool Remove(int fd);
+
+  // Blocks for up to "timeout_ms" milliseconds (-1 means forever)
+  // waiting for events, and stores at most "max_events" of them in
+  // "events".  Returns the number of events stored, or -1 on error
+  // (including EINTR).
+  int Wait(struct epoll_event* events, int max_events, int timeout_ms);
+
+ private:
+  // The file descriptor of the epoll instance.
+  int epoll_fd_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_EVENTLOOP_H_
@@ -9,7 +9,10 @@
  * author.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string>
 #include <cstdlib>
 #include <iostream>
@@ -67,4 +70,27 @@ bool FileReader::ReadFile(string* const contents) {
   return true;
 }
 
+bool FileReader::OpenFile(int* const fd, struct stat* const st) {
+  string full_file = basedir_ + "/" + fname_;
+
+  // check if the file exists above basedir_
+  if (!IsPathSafe(basedir_, full_file)) {
+    return false;
+  }
+
+  int file_fd = open(full_file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_fd == -1) {
+    return false;
+  }
+
+  // only regular files can be served (and sent with sendfile())
+  if (fstat(file_fd, st) == -1 || !S_ISREG(st->st_mode)) {
+    close(file_fd);
+    return false;
+  }
+
+  *fd = file_fd;
+  return true;
+}
+
 }  // namespace hw4
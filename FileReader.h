@@ -12,6 +12,8 @@
 #ifndef HW4_FILEREADER_H_
 #define HW4_FILEREADER_H_
 
+#include <sys/stat.h>
+
 #include <string>
 
 namespace hw4 {
@@ -42,6 +44,13 @@ class FileReader {
   // contents of the file.
   bool ReadFile(std::string* const contents);
 
+  // Like ReadFile(), but rather than reading the file, opens it for
+  // reading and returns the file descriptor through "fd" and the
+  // file's stat() information (size, modification time, etc.) through
+  // "st".  The caller must close "fd".  Also returns false if the file
+  // isn't a regular file.
+  bool OpenFile(int* const fd, struct stat* const st);
+
  private:
   std::string basedir_;
   std::string fname_;
@@ -9,25 +9,132 @@
  * author.
  */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdint.h>
-#include <boost/algorithm/string.hpp>
-#include <boost/lexical_cast.hpp>
-#include <map>
+#include <sys/socket.h>
+#include <unistd.h>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "./HttpRequest.h"
+#include "./HttpRequestParser.h"
 #include "./HttpUtils.h"
 #include "./HttpConnection.h"
+#include "./IoUring.h"
 
-using std::map;
 using std::string;
 using std::vector;
 
 namespace hw4 {
 
-static const char* kHeaderEnd = "\r\n\r\n";
-static const int kHeaderEndLen = 4;
+// How much we try to read from a client at once.  Big enough that a
+// whole burst of pipelined requests usually arrives in one read.
+static const size_t kReadSize = 16384;
+
+// How many responses, or bytes of responses, QueueResponse() holds
+// before flushing them.
+static const size_t kMaxPendingResponses = 64;
+static const size_t kMaxPendingBytes = 256 * 1024;
+
+// The most ChunkedSink gathers into one chunk.
+static const size_t kChunkSize = 16384;
+
+// Streams the body of a response to the client as chunks (RFC
+// 7230:4.1).  Small writes are gathered into chunks of up to kChunkSize
+// bytes; bigger ones go out as chunks of their own, straight from the
+// producer's memory.  The response header goes out with the first chunk.
+class HttpConnection::ChunkedSink : public HttpBodySink {
+ public:
+  ChunkedSink(const HttpConnection* conn,
+              const HttpResponse::HeaderBlock* header)
+    : conn_(conn), header_(header), header_sent_(false), ok_(true) { }
+
+  bool Write(std::string_view data) override {
+    if (buffer_.size() + data.size() > kChunkSize) {
+      if (!buffer_.empty() && !Flush())
+        return false;
+      if (data.size() >= kChunkSize)
+        return Send(data, false);
+    }
+    buffer_.append(data.data(), data.size());
+    return ok_;
+  }
+
+  bool Flush() override {
+    if (!Send(buffer_, false))
+      return false;
+    buffer_.clear();
+    return true;
+  }
+
+  // Sends whatever is left, followed by the last chunk.  Returns true if
+  // the whole body was delivered.
+  bool Finish() {
+    return Send(buffer_, true);
+  }
+
+ private:
+  // Sends "data" as a chunk (unless it's empty), preceded by the
+  // response header if that hasn't gone out yet, and followed by the
+  // last chunk if "last" is true, all in a single write.
+  bool Send(std::string_view data, bool last) {
+    if (!ok_)
+      return false;
+    if (data.empty() && header_sent_ && !last)
+      return true;
+
+    static const char kCrlf[] = "\r\n";
+    static const char kLastChunk[] = "0\r\n\r\n";
+    char size_line[24];
+    struct iovec v;
+    int64_t total = 0;
+    iov_.clear();
+    if (!header_sent_) {
+      v.iov_base = const_cast<char*>(header_->data());
+      v.iov_len = header_->length;
+      iov_.push_back(v);
+      total += v.iov_len;
+      header_sent_ = true;
+    }
+    if (!data.empty()) {
+      v.iov_base = size_line;
+      v.iov_len = snprintf(size_line, sizeof(size_line), "%zx\r\n",
+                           data.size());
+      iov_.push_back(v);
+      v.iov_base = const_cast<char*>(data.data());
+      v.iov_len = data.size();
+      iov_.push_back(v);
+      v.iov_base = const_cast<char*>(kCrlf);
+      v.iov_len = 2;
+      iov_.push_back(v);
+      total += iov_[iov_.size() - 3].iov_len + data.size() + 2;
+    }
+    if (last) {
+      v.iov_base = const_cast<char*>(kLastChunk);
+      v.iov_len = 5;
+      iov_.push_back(v);
+      total += 5;
+    }
+    ok_ = conn_->WriteIovecs(iov_, total);
+    return ok_;
+  }
+
+  const HttpConnection* conn_;
+  const HttpResponse::HeaderBlock* header_;
+  bool header_sent_;
+
+  // False once a write has failed.
+  bool ok_;
+
+  // Small writes, waiting to be sent as one chunk.
+  string buffer_;
+
+  // The buffers of the chunk being sent, kept to reuse their storage.
+  vector<struct iovec> iov_;
+};
 
 bool HttpConnection::GetNextRequest(HttpRequest* const request) {
   // Use WrappedRead from HttpUtils.cc to read bytes from the files into
@@ -38,8 +145,8 @@ bool HttpConnection::GetNextRequest(HttpRequest* const request) {
   // Hint: Try and read in a large amount of bytes each time you call
   // WrappedRead.
   //
-  // After reading complete request header, use ParseRequest() to parse into
-  // an HttpRequest and save to the output parameter request.
+  // After reading complete request header, use parser_ to fill in the
+  // output parameter request.
   //
   // Important note: Clients may send back-to-back requests on the same socket.
   // This means WrappedRead may also end up reading more than one request.
@@ -48,150 +155,146 @@ bool HttpConnection::GetNextRequest(HttpRequest* const request) {
 
   // STEP 1:
 
-  __SIZE_TYPE__ pos = buffer_.find(kHeaderEnd);
-
-  // If buffer_ already contains everything for the next request, parse the request 
-  // without reading addtional bytes. Otherwise, read until the connection dropped or 
-  // until we see "\r\n\r\n"
-  if (pos == string::npos) {
-    int read_bytes;
-    unsigned char buf[1024];
-    while (1) {
-      read_bytes = WrappedRead(fd_, buf, 1024);
-      if (read_bytes == 0) {  // EOF or connection dropped
-        break;
-      } else if (read_bytes == -1) {  // read failed
-        return false;
-      } else {
-        buffer_ += string(reinterpret_cast<char*>(buf), read_bytes);
-
-        // stop reading if reached"\r\n\r\n"
-        pos = buffer_.find(kHeaderEnd);
-        if (pos != string::npos) {
-          break;
-        }
-      }
+  // If buffer_ already contains everything for the next request, parse
+  // the request without reading additional bytes.  Otherwise, read until
+  // the connection drops or the parser has seen the whole header; each
+  // call to Parse() only looks at the bytes that are new.
+  HttpRequestParser::Status status = parser_.Parse(buffer_.data());
+  while (status == HttpRequestParser::kIncomplete) {
+    size_t avail;
+    unsigned char* buf = reinterpret_cast<unsigned char*>(
+        buffer_.PrepareWrite(kReadSize, &avail));
+    int read_bytes = WrappedRead(fd_, buf, avail);
+    if (read_bytes <= 0) {  // EOF, connection dropped or read failed
+      return false;
     }
+    buffer_.Commit(read_bytes);
+    status = parser_.Parse(buffer_.data());
   }
 
-  // check if the request header ends with "\r\n\r\n"
-  if (pos == string::npos) {
-    return false;
-  }
-
-  // parse the header and store it
-  string header = buffer_.substr(0, pos + kHeaderEndLen);
-  *request = ParseRequest(header);
-
-  // return false if the request is not well-formatted
-  if (request->uri() == "BAD_") {
+  // return false if the request is not well-formatted, noting whether
+  // that's because it is too large
+  if (status != HttpRequestParser::kComplete) {
+    header_too_large_ = (status == HttpRequestParser::kTooLarge);
     return false;
   }
 
-  // perserve everything (if any) after "\r\n\r\n" in buffer_
-  buffer_ = buffer_.substr(pos + kHeaderEndLen);
+  // STEP 2:
+  parser_.Fill(buffer_.data(), request);
 
-  return true;  // You may want to change this.
-}
+  // perserve everything (if any) after the header in buffer_; that's
+  // just a matter of moving its read index past the header.
+  buffer_.Consume(parser_.length());
+  parser_.Reset();
 
-bool HttpConnection::WriteResponse(const HttpResponse& response) const {
-  string str = response.GenerateResponseString();
-  int res = WrappedWrite(fd_,
-                         reinterpret_cast<const unsigned char*>(str.c_str()),
-                         str.length());
-  if (res != static_cast<int>(str.length()))
-    return false;
   return true;
 }
 
-HttpRequest HttpConnection::ParseRequest(const string& request) const {
-  HttpRequest req("/");  // by default, get "/".
-
-  // Plan for STEP 2:
-  // 1. Split the request into different lines (split on "\r\n").
-  // 2. Extract the URI from the first line and store it in req.URI.
-  // 3. For the rest of the lines in the request, track the header name and
-  //    value and store them in req.headers_ (e.g. HttpRequest::AddHeader).
-  //
-  // Hint: Take a look at HttpRequest.h for details about the HTTP header
-  // format that you need to parse.
-  //
-  // You'll probably want to look up boost functions for:
-  // - Splitting a string into lines on a "\r\n" delimiter
-  // - Trimming whitespace from the end of a string
-  // - Converting a string to lowercase.
-  //
-  // Note: If a header is malformed, skip that line.
+bool HttpConnection::FillBuffer() {
+  while (1) {
+    size_t avail;
+    char* buf = buffer_.PrepareWrite(kReadSize, &avail);
+    ssize_t read_bytes = read(fd_, buf, avail);
+    if (read_bytes > 0) {
+      buffer_.Commit(read_bytes);
+      // A short read means we've drained the socket, so don't spend a
+      // system call to hear EAGAIN; re-arming the file descriptor will
+      // report anything that arrives later.
+      if (static_cast<size_t>(read_bytes) < avail)
+        return true;
+      // Past the header limit, either a request is complete or the
+      // header is too large; leave the rest in the socket for now.
+      if (buffer_.size() >= max_header_bytes_)
+        return true;
+      continue;
+    }
+    if (read_bytes == 0)  // the client closed the connection
+      return false;
+    if (errno == EINTR)
+      continue;
+    // EAGAIN means we've drained the socket; anything else is fatal.
+    return (errno == EAGAIN || errno == EWOULDBLOCK);
+  }
+}
 
-  // STEP 2:
+bool HttpConnection::HasBufferedRequest() {
+  return parser_.Parse(buffer_.data()) != HttpRequestParser::kIncomplete;
+}
 
-// split the request into different lines (split on "\r\n")
-  vector<string> lines;
-  boost::split(lines, request, boost::is_any_of("\r\n"),
-               boost::token_compress_on);
+bool HttpConnection::WriteResponse(const HttpResponse& response) const {
+  // Gather the header, formatted on our stack, and the body segments,
+  // referenced where they are, so that nothing is copied on the way.
+  HttpResponse::HeaderBlock header;
+  vector<struct iovec> iov;
+  int64_t total = response.AppendIovecs(&header, &iov);
 
-  if (lines.size() < 2) {
-      req.set_uri("BAD_");
-    return req;
+  if (response.has_body_file()) {
+    // Send the header with MSG_MORE, so that the kernel holds it back
+    // and sends it in the same packets as the start of the file, and
+    // then hand the file to sendfile().
+    int header_len = header.length;
+    if (WrappedSend(fd_, reinterpret_cast<const unsigned char*>(header.data()),
+                    header_len, MSG_MORE, write_timeout_ms_) != header_len)
+      return false;
+    int64_t len = response.body_length();
+    return WrappedSendfile(fd_, response.body_fd(), response.body_offset(),
+                           len, write_timeout_ms_) == len;
   }
 
-  // trim whitespaces from the end
-  for (__SIZE_TYPE__ i = 0; i < lines.size(); i++)
-    boost::trim(lines[i]);
-
-  // split first line on " "
-  vector<string> fst_line;
-  boost::split(fst_line, lines[0], boost::is_any_of(" "),
-               boost::token_compress_on);
+  if (response.is_streaming()) {
+    // Send the body as chunks as the producer writes it.  If the
+    // producer gives up, we leave out the last chunk and close the
+    // connection, so the client can tell the body is incomplete.
+    ChunkedSink sink(this, &header);
+    if (!response.producer()(&sink))
+      return false;
+    return sink.Finish();
+  }
 
-  // check the format the first line in request
-  if (fst_line.size() == 1) {
-    if (fst_line[0] != "GET") {
-      req.set_uri("BAD_");
-      return req;
-    }
-  } else if (fst_line.size() == 2) {
-    if (fst_line[0] != "GET" ||
-        (fst_line[1][0] != '/' &&
-         fst_line[1].find("HTTP/") == string::npos)) {
-      req.set_uri("BAD_");
-      return req;
-    }
-  } else if (fst_line.size() == 3) {
-    if (fst_line[0] != "GET" ||
-        fst_line[1][0] != '/' ||
-        fst_line[2].find("HTTP/") == string::npos) {
-      req.set_uri("BAD_");
-      return req;
-    }
+  return WriteIovecs(iov, total);
+}
 
-    // Extract the URI from the first line and store it in req.URI
-    req.set_uri(fst_line[1]);
-  } else {
-    // If # of tokens in the first line is not two or three, the request is not well-formatted
-      req.set_uri("BAD_");
-    return req;
+bool HttpConnection::QueueResponse(HttpResponse&& response) {
+  if (response.has_body_file() || response.is_streaming()) {
+    // Keep the responses in order: everything queued goes out first.
+    return FlushResponses() && WriteResponse(response);
   }
 
-  // split the rest of the lines into headername and headervalue on ": "
-  vector<string> header;
-  for (__SIZE_TYPE__ j = 1; j < lines.size() - 1; j++) {
-    __SIZE_TYPE__ fst_col = lines[j].find(": ");
+  pending_bytes_ += response.prepared() != nullptr ?
+      response.prepared()->length() : response.body_length();
+  pending_.push_back(std::move(response));
+  if (pending_.size() >= kMaxPendingResponses ||
+      pending_bytes_ >= kMaxPendingBytes)
+    return FlushResponses();
+  return true;
+}
 
-    // check if the line is in correct format
-    if (fst_col == string::npos) {
-      req.set_uri("BAD_");
-      return req;
-    }
+bool HttpConnection::FlushResponses() {
+  if (pending_.empty())
+    return true;
 
-    // map header_name to header_val in headers
-    string header_name = lines[j].substr(0, fst_col);
-    boost::to_lower(header_name);
-    string header_val = lines[j].substr(fst_col + 2);
-    req.AddHeader(header_name, header_val);
-  }
+  // Gather every response into one list of buffers.  The headers are
+  // formatted on our stack; the bodies are sent from where they are.
+  HttpResponse::HeaderBlock headers[kMaxPendingResponses];
+  iov_.clear();
+  int64_t total = 0;
+  for (size_t i = 0; i < pending_.size(); i++)
+    total += pending_[i].AppendIovecs(&headers[i], &iov_);
+
+  bool ok = WriteIovecs(iov_, total);
+  pending_.clear();
+  pending_bytes_ = 0;
+  return ok;
+}
 
-  return req;
+bool HttpConnection::WriteIovecs(const vector<struct iovec>& iov,
+                                 int64_t total) const {
+  int written;
+  if (use_uring_ && UringLinkedWrite(fd_, iov.data(), iov.size(), &written,
+                                     write_timeout_ms_))
+    return written == total;
+  return WrappedWritev(fd_, iov.data(), iov.size(), write_timeout_ms_) ==
+      total;
 }
 
 }  // namespace hw4
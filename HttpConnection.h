@@ -13,19 +13,25 @@
 #define HW4_HTTPCONNECTION_H_
 
 #include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
 #include <unistd.h>
-#include <map>
 #include <string>
+#include <vector>
 
 #include "./HttpRequest.h"
+#include "./HttpRequestParser.h"
 #include "./HttpResponse.h"
+#include "./ReadBuffer.h"
 
 namespace hw4 {
 
 // The HttpConnection class represents a connection to a single client
 class HttpConnection {
  public:
-  explicit HttpConnection(int fd) : fd_(fd) { }
+  explicit HttpConnection(int fd)
+    : fd_(fd), max_header_bytes_(SIZE_MAX), header_too_large_(false),
+      pending_bytes_(0), write_timeout_ms_(-1), use_uring_(false) { }
   virtual ~HttpConnection() {
     close(fd_);
     fd_ = -1;
@@ -40,7 +46,55 @@ class HttpConnection {
   // returns false
   bool GetNextRequest(HttpRequest* const request);
 
-  // Write the response to the file descriptor fd_.
+  // Reads everything the client has already sent on the non-blocking
+  // file descriptor fd_ into buffer_, stopping as soon as the socket is
+  // drained.  Used by the event loop, which only hands a connection to a
+  // worker once HasBufferedRequest() is true.
+  //
+  // Returns false if the client closed the connection or the read
+  // failed, true otherwise.  Bytes read before the close are kept.
+  bool FillBuffer();
+
+  // Returns true if buffer_ holds a complete request header (or enough
+  // of one to know it is malformed or too large), so that the next
+  // GetNextRequest() will not need to read from fd_.  Only parses the
+  // bytes that arrived since the last call.
+  bool HasBufferedRequest();
+
+  // Returns true if buffer_ holds any part of a request.
+  bool HasBufferedInput() const { return !buffer_.empty(); }
+
+  // Limits request headers to "max_bytes" bytes.  GetNextRequest()
+  // fails on a longer header, after which header_too_large() returns
+  // true, and FillBuffer() stops reading once that much is buffered, so
+  // a client can't make buffer_ grow without bound.
+  void set_max_header_bytes(size_t max_bytes) {
+    max_header_bytes_ = max_bytes;
+    parser_.set_max_length(max_bytes);
+  }
+
+  // Returns true if GetNextRequest() failed because the request header
+  // was longer than the limit; the client should get a 431.
+  bool header_too_large() const { return header_too_large_; }
+
+  // Appends "len" bytes that were read from fd_ by somebody else (e.g.,
+  // an io_uring read) to buffer_.
+  void AppendInput(const unsigned char* buf, int len) {
+    buffer_.Append(reinterpret_cast<const char*>(buf), len);
+  }
+
+  // Makes the writes of responses give up once the client hasn't taken
+  // any data for "timeout_ms" milliseconds (-1, the default, means wait
+  // forever), so a client that stops reading can't hold a worker.
+  void set_write_timeout_ms(int timeout_ms) { write_timeout_ms_ = timeout_ms; }
+
+  // If "use_uring" is true, WriteResponse() sends the header and body of
+  // each response as linked io_uring writes instead of calling write().
+  void set_use_uring(bool use_uring) { use_uring_ = use_uring; }
+
+  // Write the response to the file descriptor fd_.  A streaming
+  // response's producer is run here, and its body is sent with
+  // "Transfer-Encoding: chunked" as it is produced.
   //
   // Returns true if the response was successfully written, false if the
   // connection experiences an error and should be closed.
@@ -49,16 +103,56 @@ class HttpConnection {
   // returns false
   bool WriteResponse(const HttpResponse& response) const;
 
+  // Queues "response" to be written by FlushResponses(), so that the
+  // responses to a burst of pipelined requests go out together in a
+  // single writev().  Flushes the queue first if it is full.  A response
+  // with a file body or a streamed body is written right away, after
+  // the queued ones, since it can't join a writev().
+  //
+  // Returns false if a write failed and the connection should be closed.
+  bool QueueResponse(HttpResponse&& response);
+
+  // Writes every queued response, in order.  Returns false if the
+  // connection experiences an error and should be closed.
+  bool FlushResponses();
+
  private:
-  // A helper function to parse the contents of data read from
-  // the HTTP connection.
-  HttpRequest ParseRequest(const std::string& request) const;
+  // The HttpBodySink that WriteResponse() hands to a producer.
+  class ChunkedSink;
+
+  // Writes the "total" bytes in "iov" to fd_ with a single writev() (or
+  // one chain of io_uring writes), looping on partial writes.  Returns
+  // true if everything was written.
+  bool WriteIovecs(const std::vector<struct iovec>& iov,
+                   int64_t total) const;
 
   // The file descriptor associated with the client.
   int fd_;
 
   // A buffer storing data read from the client.
-  std::string buffer_;
+  ReadBuffer buffer_;
+
+  // Parses the request at the front of buffer_, a bit at a time as it
+  // arrives.
+  HttpRequestParser parser_;
+
+  // The longest request header we accept, and whether we've seen a
+  // longer one.
+  size_t max_header_bytes_;
+  bool header_too_large_;
+
+  // Responses waiting for FlushResponses(), and their total size.
+  std::vector<HttpResponse> pending_;
+  size_t pending_bytes_;
+
+  // The buffers FlushResponses() gathers, kept to reuse their storage.
+  std::vector<struct iovec> iov_;
+
+  // How long a write may wait for the client, or -1 for forever.
+  int write_timeout_ms_;
+
+  // Whether to write responses through io_uring.
+  bool use_uring_;
 };
 
 }  // namespace hw4
@@ -13,12 +13,15 @@
 #define HW4_HTTPREQUEST_H_
 
 #include <stdint.h>
+#include <strings.h>
 
-#include <map>
 #include <string>
+#include <string_view>
 
 namespace hw4 {
 
+class HttpRequestParser;
+
 // This class represents an HTTP Request. For our website search engine, we
 // will only handle "GET"-style requests, meaning the request will have the
 // following format:
@@ -35,49 +38,124 @@ namespace hw4 {
 // GET /foo/bar?baz=bam HTTP/1.1\r\n
 // Host: www.news.com\r\n
 //
+// Rather than a string per URI, header name and header value, an
+// HttpRequest keeps a single copy of the request header (raw_) and
+// records where each piece lives in it.  Reusing one HttpRequest for
+// every request on a connection therefore costs no allocations once
+// raw_ has grown to fit.
 class HttpRequest {
  public:
-  HttpRequest() { }
-  explicit HttpRequest(const std::string& uri) : uri_(uri) { }
+  // The most headers a request may carry.
+  static const int kMaxHeaders = 64;
+
+  HttpRequest()
+    : uri_pos_(0), uri_len_(0), version_pos_(0), version_len_(0),
+      num_headers_(0) { }
+  explicit HttpRequest(const std::string& uri)
+    : version_pos_(0), version_len_(0), num_headers_(0) {
+    set_uri(uri);
+  }
+  HttpRequest(const HttpRequest& other) = default;
+  HttpRequest(HttpRequest&& other) = default;
+  HttpRequest& operator=(const HttpRequest& other) = default;
+  HttpRequest& operator=(HttpRequest&& other) = default;
   virtual ~HttpRequest() { }
 
-  const std::string& uri() const { return uri_; }
-  void set_uri(const std::string& uri) { uri_ = uri; }
+  // The returned view is only valid until the request is next modified.
+  std::string_view uri() const { return Slice(uri_pos_, uri_len_); }
+  void set_uri(std::string_view uri) {
+    uri_pos_ = Append(uri);
+    uri_len_ = uri.length();
+  }
+
+  // The protocol version the client sent (e.g., "HTTP/1.1"), or an
+  // empty view if it didn't send one.  Only valid until the request is
+  // next modified.
+  std::string_view version() const {
+    return Slice(version_pos_, version_len_);
+  }
 
   // Returns the value associated with the passed-in header name, or empty
   // string if it does not exist in the header map.  The passed-in name must
   // be entirely lowercase to comply with our implementation of RFC 2616:4.2.
   std::string GetHeaderValue(const std::string& name) const {
-    std::map<std::string, std::string>::const_iterator it = headers_.find(name);
-    if (it == headers_.end()) {
-      return "";
-    } else {
-      return it->second;
+    return std::string(HeaderValue(name));
+  }
+
+  // Like GetHeaderValue(), but returns a view into the request instead
+  // of a copy; the view is only valid until the request is next modified.
+  // Header names are compared case-insensitively, and if a header was
+  // sent more than once, the last value wins.
+  std::string_view HeaderValue(std::string_view name) const {
+    for (int i = num_headers_ - 1; i >= 0; i--) {
+      const Header& h = headers_[i];
+      if (h.name_len == name.length() &&
+          strncasecmp(raw_.data() + h.name_pos, name.data(),
+                      name.length()) == 0) {
+        return Slice(h.value_pos, h.value_len);
+      }
     }
+    return std::string_view();
   }
 
   // Adds a name -> value mapping to the header map, over-writing any existing
-  // previous mapping for name.
-  void AddHeader(const std::string& name, const std::string& value) {
-    headers_[name] = value;
+  // previous mapping for name.  Returns false if the request already has
+  // kMaxHeaders headers.
+  bool AddHeader(std::string_view name, std::string_view value) {
+    if (num_headers_ == kMaxHeaders)
+      return false;
+    Header* h = &headers_[num_headers_++];
+    h->name_pos = Append(name);
+    h->name_len = name.length();
+    h->value_pos = Append(value);
+    h->value_len = value.length();
+    return true;
   }
 
   // Returns the number of headers this HttpRequest contains
-  int GetHeaderCount() {
-    return headers_.size();
+  int GetHeaderCount() const {
+    return num_headers_;
   }
 
  private:
+  friend class HttpRequestParser;
+
+  // Where a header's name and value live in raw_.
+  struct Header {
+    uint32_t name_pos;
+    uint32_t name_len;
+    uint32_t value_pos;
+    uint32_t value_len;
+  };
+
+  std::string_view Slice(uint32_t pos, uint32_t len) const {
+    return std::string_view(raw_.data() + pos, len);
+  }
+
+  // Appends "str" to raw_ and returns where it starts.
+  uint32_t Append(std::string_view str) {
+    uint32_t pos = raw_.length();
+    raw_.append(str.data(), str.length());
+    return pos;
+  }
+
+  // The request header as the client sent it, plus anything added
+  // through set_uri() or AddHeader().
+  std::string raw_;
+
   // Which URI did the client request?
-  std::string uri_;
-
-  // A map from mapping a header name to a header value, which represents the
-  // headers a client would supply to us. Due to RFC 2616:4.2 stating that
-  // header names are case-insensitive, convert all header names to be
-  // lowercase.
-  //
-  // But note that the header values can remain the same.
-  std::map<std::string, std::string> headers_;
+  uint32_t uri_pos_;
+  uint32_t uri_len_;
+
+  // Which protocol version did the client speak?
+  uint32_t version_pos_;
+  uint32_t version_len_;
+
+  // The headers a client supplied to us, in the order they were sent.
+  // Due to RFC 2616:4.2 stating that header names are case-insensitive,
+  // they're looked up without regard to case.
+  Header headers_[kMaxHeaders];
+  int num_headers_;
 };
 
 }  // namespace hw4
@@ -0,0 +1,273 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <ctype.h>   // for isalnum()
+#include <string.h>  // for memchr(), strchr()
+
+#include <algorithm>  // for std::copy
+#include <string_view>
+
+#include "./HttpRequestParser.h"
+
+using std::string_view;
+
+namespace hw4 {
+
+// Returns true if "c" is a control character, which may only appear
+// in a request header as part of a line ending (or as a tab in a
+// header value).
+static bool IsCtl(unsigned char c) {
+  return c < 0x20 || c == 0x7f;
+}
+
+// Returns true if "c" may appear in a header name (RFC 7230:3.2.6).
+static bool IsTokenChar(unsigned char c) {
+  return isalnum(c) || (c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != nullptr);
+}
+
+void HttpRequestParser::Reset() {
+  state_ = kStart;
+  pos_ = 0;
+  start_ = 0;
+  mark_ = 0;
+  value_end_ = 0;
+  after_lf_ = kHeaderStart;
+  uri_pos_ = 0;
+  uri_len_ = 0;
+  version_pos_ = 0;
+  version_len_ = 0;
+  num_headers_ = 0;
+}
+
+HttpRequestParser::Status HttpRequestParser::Parse(string_view input) {
+  // Never look past the limit; if the header hasn't ended by then, it
+  // is too large.
+  if (input.length() > max_length_)
+    input = input.substr(0, max_length_);
+
+  while (pos_ < input.length()) {
+    unsigned char c = input[pos_];
+    switch (state_) {
+      case kStart:
+        // Be lenient about blank lines before the request line
+        // (RFC 7230:3.5).
+        if (c == '\r' || c == '\n') {
+          start_ = pos_ + 1;
+          break;
+        }
+        mark_ = pos_;
+        state_ = kMethod;
+        continue;  // look at "c" again in the new state
+
+      case kMethod:
+        if (c == ' ' || c == '\r' || c == '\n') {
+          if (input.substr(mark_, pos_ - mark_) != "GET") {
+            state_ = kError;
+            return kInvalid;
+          }
+          if (c == ' ') {
+            state_ = kBeforeToken;
+          } else {
+            EndLine(c, kHeaderStart);
+          }
+        } else if (IsCtl(c)) {
+          state_ = kError;
+          return kInvalid;
+        }
+        break;
+
+      case kBeforeToken:
+        if (c == ' ')
+          break;
+        if (c == '\r' || c == '\n') {
+          EndLine(c, kHeaderStart);
+          break;
+        }
+        // The URI comes first and starts with '/'; anything else must
+        // be the version, which is the last thing on the line.
+        if (version_len_ > 0) {
+          state_ = kError;
+          return kInvalid;
+        }
+        mark_ = pos_;
+        state_ = (c == '/' && uri_len_ == 0) ? kUri : kVersion;
+        break;
+
+      case kUri:
+      case kVersion:
+        if (c == ' ' || c == '\r' || c == '\n') {
+          if (!EndRequestToken(input, state_)) {
+            state_ = kError;
+            return kInvalid;
+          }
+          if (c == ' ') {
+            state_ = kBeforeToken;
+          } else {
+            EndLine(c, kHeaderStart);
+          }
+        } else if (IsCtl(c)) {
+          state_ = kError;
+          return kInvalid;
+        }
+        break;
+
+      case kLineLf:
+        if (c != '\n') {
+          state_ = kError;
+          return kInvalid;
+        }
+        state_ = after_lf_;
+        break;
+
+      case kHeaderStart:
+        if (c == '\r') {
+          state_ = kEndLf;
+          break;
+        }
+        if (c == '\n') {
+          pos_++;
+          state_ = kDone;
+          return kComplete;
+        }
+        if (!IsTokenChar(c)) {
+          state_ = kError;
+          return kInvalid;
+        }
+        if (num_headers_ == HttpRequest::kMaxHeaders) {
+          state_ = kOverflow;
+          return kTooLarge;
+        }
+        mark_ = pos_;
+        state_ = kHeaderName;
+        break;
+
+      case kHeaderName:
+        if (c == ':') {
+          headers_[num_headers_].name_pos = mark_ - start_;
+          headers_[num_headers_].name_len = pos_ - mark_;
+          state_ = kBeforeValue;
+        } else if (!IsTokenChar(c)) {
+          state_ = kError;
+          return kInvalid;
+        }
+        break;
+
+      case kBeforeValue:
+        if (c == ' ' || c == '\t')
+          break;
+        mark_ = pos_;
+        value_end_ = pos_;
+        state_ = kValue;
+        continue;  // look at "c" again in the new state
+
+      case kValue: {
+        // Values make up most of a header, so rather than going around
+        // the state machine for every byte, find the '\r' that ends the
+        // line with memchr() and check the bytes before it in one tight
+        // loop.
+        const char* data = input.data();
+        const void* cr = memchr(data + pos_, '\r', input.length() - pos_);
+        size_t stop = (cr != nullptr) ?
+            static_cast<const char*>(cr) - data : input.length();
+        for (; pos_ < stop; pos_++) {
+          unsigned char v = data[pos_];
+          if (v == '\n')  // a bare "\n" line ending
+            break;
+          if (v == ' ' || v == '\t')
+            continue;
+          if (IsCtl(v)) {
+            state_ = kError;
+            return kInvalid;
+          }
+          value_end_ = pos_ + 1;
+        }
+        if (pos_ == input.length())
+          continue;  // wait for the rest of the line
+
+        // Trailing whitespace isn't part of the value.
+        headers_[num_headers_].value_pos = mark_ - start_;
+        headers_[num_headers_].value_len = value_end_ - mark_;
+        num_headers_++;
+        EndLine(data[pos_], kHeaderStart);
+        break;
+      }
+
+      case kEndLf:
+        if (c != '\n') {
+          state_ = kError;
+          return kInvalid;
+        }
+        pos_++;
+        state_ = kDone;
+        return kComplete;
+
+      case kDone:
+        return kComplete;
+
+      case kError:
+        return kInvalid;
+
+      case kOverflow:
+        return kTooLarge;
+    }
+    pos_++;
+  }
+
+  if (state_ == kDone)
+    return kComplete;
+  if (state_ == kError)
+    return kInvalid;
+  if (state_ == kOverflow || pos_ >= max_length_) {
+    state_ = kOverflow;
+    return kTooLarge;
+  }
+  return kIncomplete;
+}
+
+void HttpRequestParser::Fill(string_view input,
+                             HttpRequest* const request) const {
+  request->raw_.assign(input.data() + start_, pos_ - start_);
+  request->uri_pos_ = uri_pos_;
+  request->uri_len_ = uri_len_;
+  request->version_pos_ = version_pos_;
+  request->version_len_ = version_len_;
+  if (uri_len_ == 0) {
+    // By default, get "/".
+    request->set_uri("/");
+  }
+  std::copy(headers_, headers_ + num_headers_, request->headers_);
+  request->num_headers_ = num_headers_;
+}
+
+bool HttpRequestParser::EndRequestToken(string_view input, State state) {
+  string_view token = input.substr(mark_, pos_ - mark_);
+  if (state == kUri) {
+    uri_pos_ = mark_ - start_;
+    uri_len_ = token.length();
+    return true;
+  }
+  if (token.substr(0, 5) != "HTTP/")
+    return false;
+  version_pos_ = mark_ - start_;
+  version_len_ = token.length();
+  return true;
+}
+
+void HttpRequestParser::EndLine(char c, State next) {
+  if (c == '\r') {
+    after_lf_ = next;
+    state_ = kLineLf;
+  } else {
+    state_ = next;
+  }
+}
+
+}  // namespace hw4
@@ -0,0 +1,123 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_HTTPREQUESTPARSER_H_
+#define HW4_HTTPREQUESTPARSER_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, SIZE_MAX, etc.
+
+#include <string_view>
+
+#include "./HttpRequest.h"
+
+namespace hw4 {
+
+// An HttpRequestParser validates the header of an HTTP request and
+// finds the URI and headers in it, without copying anything until the
+// header is known to be complete and well-formed.
+//
+// The parser is a resumable state machine: as bytes trickle in from the
+// client, Parse() may be called again and again on the growing input,
+// and each call picks up where the previous one stopped, so no byte is
+// looked at twice.  It only remembers offsets into the input, so the
+// input may move (e.g., when a std::string grows) between calls.
+//
+// We accept what HttpRequest.h describes: "GET", optionally followed by
+// a URI starting with '/' and an "HTTP/" version, then "name: value"
+// header lines, each line ending with "\r\n" (or a bare "\n"), and an
+// empty line.  Anything else is rejected.
+class HttpRequestParser {
+ public:
+  enum Status {
+    kIncomplete,  // the header isn't complete yet; call Parse() again
+    kComplete,    // the header is complete and well-formed
+    kInvalid,     // the header is malformed; give up on the client
+    kTooLarge     // the header is longer than the limit, or has more
+                  // than HttpRequest::kMaxHeaders headers
+  };
+
+  HttpRequestParser() : max_length_(SIZE_MAX) { Reset(); }
+  virtual ~HttpRequestParser() { }
+
+  // Forgets everything, getting ready for a new request.
+  void Reset();
+
+  // Makes Parse() return kTooLarge for a header longer than "length"
+  // bytes.  There is no limit by default.
+  void set_max_length(size_t length) { max_length_ = length; }
+
+  // Parses as much of "input" as is new since the last call.  "input"
+  // must start at the first byte of the request, and must begin with
+  // the bytes passed to previous calls since the last Reset().  Once
+  // anything but kIncomplete is returned, later calls return the same.
+  Status Parse(std::string_view input);
+
+  // After Parse() returns kComplete, the number of bytes of "input"
+  // that the request header occupied; the next request starts there.
+  size_t length() const { return pos_; }
+
+  // After Parse() returns kComplete, stores the request in "request",
+  // copying the header out of "input" (which must be what was parsed).
+  // Reuses the storage "request" already has.
+  void Fill(std::string_view input, HttpRequest* const request) const;
+
+ private:
+  enum State {
+    kStart,          // skipping blank lines before the request line
+    kMethod,         // in the method
+    kBeforeToken,    // in the spaces before the URI or version
+    kUri,            // in the URI
+    kVersion,        // in the version
+    kLineLf,         // saw '\r', expecting '\n'
+    kHeaderStart,    // at the start of a header line
+    kHeaderName,     // in a header name
+    kBeforeValue,    // in the spaces after a header's ':'
+    kValue,          // in a header value
+    kEndLf,          // saw '\r' on the empty line, expecting '\n'
+    kDone,           // the header is complete
+    kError,          // the header is malformed
+    kOverflow        // the header is too large
+  };
+
+  // Handles the end of the request line's method, URI or version (the
+  // token from mark_ to pos_).  Returns false if the token is invalid.
+  bool EndRequestToken(std::string_view input, State state);
+
+  // Handles '\r' or '\n' at the end of a line, continuing in "next".
+  void EndLine(char c, State next);
+
+  size_t max_length_;
+
+  State state_;
+  size_t pos_;    // the next byte to look at
+  size_t start_;  // the first byte of the request line
+  size_t mark_;   // the first byte of the current token
+
+  // Where the end of the current header value is, not counting any
+  // trailing whitespace.
+  size_t value_end_;
+
+  // Where the state machine continues after a '\r' and '\n'.
+  State after_lf_;
+
+  // What we've found so far.  Offsets are relative to start_.
+  uint32_t uri_pos_;
+  uint32_t uri_len_;
+  uint32_t version_pos_;
+  uint32_t version_len_;
+  HttpRequest::Header headers_[HttpRequest::kMaxHeaders];
+  int num_headers_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_HTTPREQUESTPARSER_H_
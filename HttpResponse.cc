@@ -0,0 +1,193 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdio.h>   // for snprintf()
+#include <string.h>  // for memcpy()
+#include <sys/uio.h>
+#include <unistd.h>  // for pread()
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./HttpResponse.h"
+
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+// The header we splice into a prepared response that has to close the
+// connection.
+static const char kConnectionClose[] = "Connection: close\r\n";
+
+// Returns the offset in "prepared" at which to splice in an extra
+// header: just past the last header line, in front of the blank line
+// that ends the header block.
+static size_t PreparedSplicePoint(const string& prepared) {
+  size_t end = prepared.find("\r\n\r\n");
+  return end == string::npos ? 0 : end + 2;
+}
+
+// An HttpBodySink that appends what it's given to a response's body.
+class BufferingSink : public HttpBodySink {
+ public:
+  explicit BufferingSink(HttpResponse* response) : response_(response) { }
+
+  bool Write(std::string_view data) override {
+    response_->AppendToBody(data);
+    return true;
+  }
+  bool Flush() override { return true; }
+
+ private:
+  HttpResponse* response_;
+};
+
+void HttpResponse::AppendToBody(std::string_view body_fragment) {
+  if (body_fragment.empty())
+    return;
+  if (!segments_.empty() && segments_.back().data == nullptr) {
+    // The last segment is ours too; just make it longer.
+    segments_.back().length += body_fragment.size();
+  } else {
+    segments_.push_back({nullptr, body_.size(), body_fragment.size()});
+  }
+  body_.append(body_fragment.data(), body_fragment.size());
+  body_length_ += body_fragment.size();
+}
+
+bool HttpResponse::BufferStreamedBody() {
+  if (!is_streaming())
+    return true;
+  HttpBodyProducer producer = producer_;
+  producer_ = nullptr;
+  BufferingSink sink(this);
+  return producer(&sink);
+}
+
+void HttpResponse::AppendReferenceToBody(const char* data, size_t length) {
+  if (length == 0)
+    return;
+  segments_.push_back({data, 0, length});
+  body_length_ += length;
+}
+
+string HttpResponse::GenerateResponseString() const {
+  if (prepared_ != nullptr) {
+    if (!connection_close_)
+      return *prepared_;
+    string resp(*prepared_);
+    resp.insert(PreparedSplicePoint(resp), kConnectionClose);
+    return resp;
+  }
+  if (is_streaming()) {
+    HttpResponse copy(*this);
+    copy.BufferStreamedBody();
+    return copy.GenerateResponseString();
+  }
+
+  string resp = GenerateHeaderString();
+  size_t header_len = resp.size();
+  resp.resize(header_len + body_length());
+  if (has_body_file()) {
+    ssize_t len = pread(body_file_->fd, &resp[header_len],
+                        body_file_->length, body_file_->offset);
+    resp.resize(header_len + (len > 0 ? len : 0));
+  } else {
+    char* dest = &resp[header_len];
+    for (const Segment& segment : segments_) {
+      memcpy(dest, SegmentData(segment), segment.length);
+      dest += segment.length;
+    }
+  }
+  return resp;
+}
+
+string HttpResponse::GenerateHeaderString() const {
+  HeaderBlock header;
+  FormatHeader(&header);
+  return string(header.data(), header.length);
+}
+
+void HttpResponse::FormatHeader(HeaderBlock* const header) const {
+  const char* format = is_streaming() ?
+      "%s %u %s\r\n%s%s%s%sTransfer-Encoding: chunked\r\n\r\n" :
+      "%s %u %s\r\n%s%s%s%sContent-length: %zu\r\n\r\n";
+  const char* type_name = content_type_.empty() ? "" : "Content-type: ";
+  const char* type_end = content_type_.empty() ? "" : "\r\n";
+  const char* close = connection_close_ ? "Connection: close\r\n" : "";
+  unsigned code = response_code_;
+
+  int len = snprintf(header->buf, sizeof(header->buf), format,
+                     protocol_.c_str(), code, message_.c_str(), type_name,
+                     content_type_.c_str(), type_end, close, body_length());
+  header->overflow.clear();
+  if (len >= static_cast<int>(sizeof(header->buf))) {
+    // Too big for the stack buffer; format it again on the heap.
+    header->overflow.resize(len + 1);
+    snprintf(&header->overflow[0], len + 1, format,
+             protocol_.c_str(), code, message_.c_str(), type_name,
+             content_type_.c_str(), type_end, close, body_length());
+    header->overflow.resize(len);
+  }
+  header->length = len;
+}
+
+size_t HttpResponse::AppendIovecs(HeaderBlock* const header,
+                                  vector<struct iovec>* const iov) const {
+  struct iovec v;
+  if (prepared_ != nullptr) {
+    if (!connection_close_) {
+      v.iov_base = const_cast<char*>(prepared_->data());
+      v.iov_len = prepared_->length();
+      iov->push_back(v);
+      return v.iov_len;
+    }
+    // Splice the "Connection: close" header in between the prepared
+    // headers and the blank line, still without copying the response.
+    size_t split = PreparedSplicePoint(*prepared_);
+    v.iov_base = const_cast<char*>(prepared_->data());
+    v.iov_len = split;
+    iov->push_back(v);
+    v.iov_base = const_cast<char*>(kConnectionClose);
+    v.iov_len = sizeof(kConnectionClose) - 1;
+    iov->push_back(v);
+    v.iov_base = const_cast<char*>(prepared_->data()) + split;
+    v.iov_len = prepared_->length() - split;
+    iov->push_back(v);
+    return prepared_->length() + sizeof(kConnectionClose) - 1;
+  }
+
+  FormatHeader(header);
+  v.iov_base = const_cast<char*>(header->data());
+  v.iov_len = header->length;
+  iov->push_back(v);
+  if (has_body_file() || is_streaming())
+    return header->length;
+
+  for (const Segment& segment : segments_) {
+    v.iov_base = const_cast<char*>(SegmentData(segment));
+    v.iov_len = segment.length;
+    iov->push_back(v);
+  }
+  return header->length + body_length_;
+}
+
+string HttpResponse::body() const {
+  string body;
+  body.reserve(body_length_);
+  for (const Segment& segment : segments_)
+    body.append(SegmentData(segment), segment.length);
+  return body;
+}
+
+}  // namespace hw4
@@ -13,10 +13,15 @@
 #define HW4_HTTPRESPONSE_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
-#include <map>
+#include <functional>
+#include <memory>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <vector>
 
 namespace hw4 {
 
@@ -40,10 +45,63 @@ namespace hw4 {
 // Content-length: 10\r\n
 // \r\n
 // Hi there!!
+//
+// The body is kept as a list of segments, each either bytes the response
+// owns or a reference to bytes that outlive it (e.g., a string literal),
+// so HttpConnection can send a response with writev() straight from
+// where its pieces are (see AppendIovecs()) without ever copying the
+// whole response into one string.
+//
+// Alternatively, a response can stream its body: rather than holding
+// the body, it holds a producer (see SetBodyProducer()) that writes the
+// body through an HttpBodySink when the response is sent.  The body is
+// then sent with "Transfer-Encoding: chunked", a chunk at a time, so
+// the client sees the start of the body before the end is ready.
+
+// An HttpBodySink accepts the body of a streaming response, a piece at
+// a time.
+class HttpBodySink {
+ public:
+  virtual ~HttpBodySink() { }
+
+  // Adds "data" to the body.  Returns false if the body can't be
+  // delivered (e.g., the client went away), in which case the producer
+  // should give up.
+  virtual bool Write(std::string_view data) = 0;
+
+  // Sends everything written so far on its way now, rather than waiting
+  // for more to accumulate.  Returns false like Write().
+  virtual bool Flush() = 0;
+};
+
+// Writes the body of a streaming response to "sink".  Returns false if
+// it gave up part way through.
+typedef std::function<bool(HttpBodySink* sink)> HttpBodyProducer;
 
 class HttpResponse {
  public:
-  HttpResponse() { }
+  // The status line and headers of a response, formatted by
+  // FormatHeader() into a buffer small enough to live on the stack.
+  struct HeaderBlock {
+    static const size_t kSize = 256;
+
+    const char* data() const {
+      return overflow.empty() ? buf : overflow.data();
+    }
+
+    char buf[kSize];
+    size_t length;
+
+    // Holds the header instead of buf in the unlikely case that it
+    // doesn't fit there.
+    std::string overflow;
+  };
+
+  HttpResponse() : connection_close_(false), body_length_(0) { }
+  HttpResponse(const HttpResponse& other) = default;
+  HttpResponse(HttpResponse&& other) = default;
+  HttpResponse& operator=(const HttpResponse& other) = default;
+  HttpResponse& operator=(HttpResponse&& other) = default;
   virtual ~HttpResponse() { }
 
   void set_protocol(const std::string& protocol) { protocol_ = protocol; }
@@ -51,30 +109,112 @@ class HttpResponse {
   void set_message(const std::string& msg) { message_ = msg; }
   void set_content_type(const std::string& type) { content_type_ = type; }
 
-  void AppendToBody(const std::string& body_fragment) {
-    body_ += body_fragment;
+  // If "close" is true, the header tells the client that we'll close
+  // the connection after this response ("Connection: close").  For a
+  // prepared response, the header is spliced in as it goes out.
+  void set_connection_close(bool close) { connection_close_ = close; }
+
+  void AppendToBody(std::string_view body_fragment);
+
+  // Appends the "length" bytes at "data" to the body without copying
+  // them.  The bytes must stay put for as long as the response (or any
+  // copy of it) exists, as a string literal does.
+  void AppendReferenceToBody(const char* data, size_t length);
+
+  // Makes this a streaming response, whose body is whatever "producer"
+  // writes when the response is sent; see HttpBodySink.  "producer" must
+  // be safe to call on any thread, and may be called more than once.
+  void SetBodyProducer(HttpBodyProducer producer) {
+    producer_ = producer;
+  }
+
+  // Returns true if the body will be streamed by a producer.
+  bool is_streaming() const { return producer_ != nullptr; }
+  const HttpBodyProducer& producer() const { return producer_; }
+
+  // Runs the producer of a streaming response and keeps the body it
+  // writes, making this an ordinary response with a Content-length, for
+  // clients that can't handle a chunked body.  Returns what the producer
+  // did.  Does nothing and returns true if the response isn't streaming.
+  bool BufferStreamedBody();
+
+  // Makes the body "length" bytes of the open file "fd", starting at
+  // "offset", in place of the string body.  The response takes over
+  // "fd", which is closed once the last copy of the response goes away.
+  // HttpConnection::WriteResponse() sends such a body with sendfile(),
+  // so its bytes never pass through our address space.
+  void SetBodyFile(int fd, off_t offset, size_t length) {
+    body_file_ = std::make_shared<BodyFile>(fd, offset, length);
+  }
+
+  // Makes this a prepared response: "prepared" holds a complete
+  // response (status line, headers and body) serialized earlier, e.g.,
+  // one kept in a StaticFileCache, which is written out as-is.  The
+  // other fields of the response are ignored, except for
+  // set_connection_close().
+  void SetPrepared(std::shared_ptr<const std::string> prepared) {
+    prepared_ = prepared;
+  }
+  const std::shared_ptr<const std::string>& prepared() const {
+    return prepared_;
+  }
+
+  // Returns true if the body is a file set with SetBodyFile().
+  bool has_body_file() const { return body_file_ != nullptr; }
+  int body_fd() const { return body_file_->fd; }
+  off_t body_offset() const { return body_file_->offset; }
+
+  // Returns the size of the body in bytes, whichever kind it is.
+  size_t body_length() const {
+    return has_body_file() ? body_file_->length : body_length_;
   }
 
   // A method to generate a std::string of the HTTP response, suitable for
-  // writing back to the client.
+  // writing back to the client.  A file body is read into the string.
   //
   // The "Content-length:" header is automatically generated, which will be the
   // last header in the block. The value of that Content-length header is the
-  // size of the response body (in bytes).
-  std::string GenerateResponseString() const {
-    std::stringstream resp;
+  // size of the response body (in bytes).  A streaming response's producer
+  // is run to get the body.
+  std::string GenerateResponseString() const;
 
-    resp << protocol_ << " " << response_code_ << " " << message_ << "\r\n";
-    if (!content_type_.empty()) {
-      resp << "Content-type: " << content_type_ << "\r\n";
-    }
-    resp << "Content-length: " << body_.size() << "\r\n";
-    resp << "\r\n";
-    resp << body_;
-    return resp.str();
-  }
+  // Generates just the status line and headers (including the blank line
+  // that ends them), for customers that send the body separately.  A
+  // streaming response gets a "Transfer-Encoding: chunked" header in
+  // place of the "Content-length:" header.
+  std::string GenerateHeaderString() const;
+
+  // Like GenerateHeaderString(), but formats the header into "header".
+  void FormatHeader(HeaderBlock* const header) const;
+
+  // Appends the buffers that make up the response to "iov", ready for
+  // writev(): the header, formatted into "header", followed by the body
+  // segments, referenced where they are.  A prepared response is a
+  // single buffer, or three when a "Connection: close" header has to be
+  // spliced in.  A file body or streamed body isn't included; the
+  // caller must send it after the header.  Returns the total number of
+  // bytes.
+  size_t AppendIovecs(HeaderBlock* const header,
+                      std::vector<struct iovec>* const iov) const;
+
+  // Returns a copy of the string body of the response.
+  std::string body() const;
 
  private:
+  // A piece of the body: either "length" bytes at "data", or, if "data"
+  // is null, "length" bytes of body_ starting at "pos".  (We store an
+  // offset because body_ moves as it grows.)
+  struct Segment {
+    const char* data;
+    size_t pos;
+    size_t length;
+  };
+
+  // Returns where the bytes of "segment" are.
+  const char* SegmentData(const Segment& segment) const {
+    return segment.data != nullptr ? segment.data : body_.data() + segment.pos;
+  }
+
   // The HTTP protocol string to pass back in the header.
   std::string protocol_;
 
@@ -87,8 +227,31 @@ class HttpResponse {
   // The HTTP content type string to pass back in the header.  Optional.
   std::string content_type_;
 
-  // The body of the response.
+  // Whether to send "Connection: close".
+  bool connection_close_;
+
+  // The body of the response: the bytes it owns, the segments making up
+  // the body in order, and the total length of the segments.
   std::string body_;
+  std::vector<Segment> segments_;
+  size_t body_length_;
+
+  // An open file to send as the body instead, shared by the copies of
+  // the response.
+  struct BodyFile {
+    BodyFile(int f, off_t o, size_t l) : fd(f), offset(o), length(l) { }
+    ~BodyFile() { close(fd); }
+    int fd;
+    off_t offset;
+    size_t length;
+  };
+  std::shared_ptr<BodyFile> body_file_;
+
+  // The producer of the body, if the response is streaming.
+  HttpBodyProducer producer_;
+
+  // The complete, already serialized response, if it is prepared.
+  std::shared_ptr<const std::string> prepared_;
 };
 
 }  // namespace hw4
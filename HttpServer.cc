@@ -9,20 +9,31 @@
  * author.
  */
 
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
 #include <boost/algorithm/string.hpp>
+#include <algorithm>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <sstream>
+#include <utility>
 
+#include "./AdmissionController.h"
+#include "./DeadlineQueryProcessor.h"
 #include "./FileReader.h"
 #include "./HttpConnection.h"
 #include "./HttpRequest.h"
 #include "./HttpUtils.h"
 #include "./HttpServer.h"
-#include "./libhw3/QueryProcessor.h"
+#include "./QueryProcessorPool.h"
 
 using std::cerr;
 using std::cout;
@@ -32,6 +43,7 @@ using std::map;
 using std::string;
 using std::stringstream;
 using std::unique_ptr;
+using std::vector;
 
 namespace hw4 {
 ///////////////////////////////////////////////////////////////////////////////
@@ -57,123 +69,897 @@ static const char* kThreegleStr =
   "</form>\n"
   "</center><p>\n";
 
-// static
-const int HttpServer::kNumThreads = 100;
+// How long, in seconds, to cache reverse DNS answers, and how many.
+static const uint32_t kDnsTtlSecs = 300;
+static const uint32_t kDnsMaxEntries = 4096;
+
+// The static file cache's shards, how often (in milliseconds) it
+// checks that a cached file hasn't changed, and the biggest file it
+// holds; bigger files are sent with sendfile() instead.
+static const uint32_t kFileCacheShards = 16;
+static const uint32_t kFileCacheRevalidateMs = 1000;
+static const off_t kMaxCachedFileBytes = 256 * 1024;
+
+// The most events we pull out of the event loop per Wait() call.
+static const int kMaxEvents = 256;
+
+// The length of a tick of the shards' connection timers, in
+// milliseconds; a connection's timeout goes off within a tick of when
+// it is due.
+static const uint32_t kTimerTickMs = 100;
+
+// How long, in milliseconds, to wait before accepting again after
+// running out of descriptors (or some other resource) mid-backlog.
+static const int kAcceptRetryMs = 100;
+
+// What we tell a client whose request header is too long, before
+// closing the connection.
+static const char kHeaderTooLargeStr[] =
+  "HTTP/1.1 431 Request Header Fields Too Large\r\n"
+  "Content-length: 0\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+// What we tell a client whose request we shed because the server is
+// overloaded, before closing the connection.
+static const char kServiceUnavailableStr[] =
+  "HTTP/1.1 503 Service Unavailable\r\n"
+  "Retry-After: 1\r\n"
+  "Content-length: 0\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+// The most we read and throw away after sending one of those, so that
+// closing the connection doesn't reset it.
+static const size_t kMaxRefusalDrainBytes = 256 * 1024;
+
+// The threadpool's scheduling classes.
+static const uint32_t kStaticClass = 0;
+static const uint32_t kQueryClass = 1;
+static const uint32_t kNumClasses = 2;
 
 // This is the function that threads are dispatched into
-// in order to process new client connections.
+// in order to process the requests buffered on a client connection.
 static void HttpServer_ThrFn(ThreadPool::Task* t);
 
-// Given a request, produce a response.
+// Accepts every pending connection on the (non-blocking) listening
+// socket and registers each new client with the event loop.  Returns
+// false if it had to stop before the backlog was drained (we're out of
+// descriptors, say); since the listening socket is edge-triggered, the
+// caller must then call it again soon rather than wait for a new edge.
+static bool AcceptConnections(const ServerSocket& socket,
+                              EventLoop* loop,
+                              const string& base_dir,
+                              QueryProcessorPool* queries,
+                              DnsCache* dns,
+                              StaticFileCache* file_cache,
+                              const HttpServerOptions* options,
+                              TimerWheel* timers);
+
+// Fills in the server-wide fields of a new client's task, starts its
+// header timeout on "timers", and logs the new connection.  If "dns"
+// isn't null, the client and server names are looked up in it;
+// otherwise they stay numeric.
+static void InitServerTask(HttpServerTask* hst,
+                           const string& base_dir,
+                           QueryProcessorPool* queries,
+                           DnsCache* dns,
+                           StaticFileCache* file_cache,
+                           const HttpServerOptions* options,
+                           TimerWheel* timers);
+
+// (Re)starts the connection's timer: the header timeout if "header" is
+// true, and the idle timeout otherwise.
+static void StartTimer(HttpServerTask* hst, bool header);
+
+// Returns how long a shard's loop may sleep waiting for events: a tick
+// of "timers" if any connection timeouts are enabled, or forever.
+// Workers schedule timers while the loop sleeps, so it can't sleep
+// until the next one is due; it has to check every tick.
+static int TimerWaitMs(const HttpServerOptions& options,
+                       const TimerWheel& timers);
+
+// The TimerWheel callback for a connection that ran out of time.
+static void ExpireConnection(void* data);
+
+// Sends the "len" bytes of the pre-serialized "response" to the client
+// on "fd" without blocking, ahead of closing the connection.
+static void SendRefusal(int fd, const char* response, size_t len);
+
+// Returns the time on the monotonic clock, in nanoseconds.
+static int64_t NowNs();
+
+// Reads whatever a client has sent.  Adds the connection to "ready"
+// once a complete request is buffered, re-arms it if more bytes are
+// needed, and closes it if the client went away.
+static void HandleReadable(HttpServerTask* hst,
+                           vector<ThreadPool::Task*>* ready);
+
+// The io_uring counterpart of HandleReadable(): consumes the result of
+// a completed read on the client's connection.
+static void HandleUringRead(HttpServerTask* hst,
+                            const UringLoop::Event& ev,
+                            vector<ThreadPool::Task*>* ready);
+
+// Parses the first buffered request on the connection, and files the
+// task under the scheduling class of that request.  Returns false if
+// the request is malformed, or too large (in which case the client has
+// been sent a 431).
+static bool ClassifyTask(HttpServerTask* hst);
+
+// Returns true if "uri" names a static file rather than a query.
+static bool IsStaticRequest(std::string_view uri);
+
+// Dispatches the connections in "ready" into the threadpool in one
+// batch, then empties "ready".  Each request must first be admitted by
+// the controller in "admission" for its scheduling class; requests it
+// refuses, and those the pool has no room for, are answered with a
+// 503 and their connections closed.
+static void DispatchReady(ThreadPool* tp,
+                          const vector<unique_ptr<AdmissionController>>&
+                            admission,
+                          vector<ThreadPool::Task*>* ready);
+
+// Hands an idle connection back to whichever loop it came from.
+// Returns false if that failed, in which case the caller should close
+// the connection.
+static bool ReturnToLoop(HttpServerTask* hst);
+
+// Given a request, produce a response, answering queries with a
+// processor from "queries".  "file_cache" may be null.  Queries give
+// up after "query_deadline_ms" milliseconds (zero means
+// never).
 static HttpResponse ProcessRequest(const HttpRequest& req,
                             const string& base_dir,
-                            const list<string>& indices);
+                            QueryProcessorPool* queries,
+                            StaticFileCache* file_cache,
+                            uint32_t query_deadline_ms);
+
+// Normalizes "file_name", a path relative to the static files
+// directory, without touching the file system: drops empty and "."
+// components, so "a//./b.txt" becomes "a/b.txt".  Returns false if the
+// path has a ".." component, which only realpath() can judge, or a
+// trailing slash, which only a directory can take.
+static bool NormalizeFilePath(const string& file_name,
+                              string* const normalized);
 
-// Process a file request.
+// Process a file request, answering from "file_cache" if we can (and
+// it isn't null).
 static HttpResponse ProcessFileRequest(const string& uri,
-                                const string& base_dir);
+                                const string& base_dir,
+                                StaticFileCache* file_cache);
 
-// Process a query request.
+// Process a query request.  The response streams its body, the page
+// that WriteQueryPage() writes, and the query runs until "deadline_ms"
+// milliseconds from now (zero means no limit).
 static HttpResponse ProcessQueryRequest(const string& uri,
-                                 const list<string>& indices);
+                                 QueryProcessorPool* queries,
+                                 uint32_t deadline_ms);
+
+// Writes the page answering the query in "uri" to "sink", with a
+// processor borrowed from "queries".  If "deadline" expires, the page
+// shows the results found so far.  Returns false if the page couldn't
+// be delivered.
+static bool WriteQueryPage(const string& uri,
+                           QueryProcessorPool* queries,
+                           const QueryDeadline& deadline,
+                           HttpBodySink* sink);
 
 
 ///////////////////////////////////////////////////////////////////////////////
 // HttpServer
 ///////////////////////////////////////////////////////////////////////////////
-bool HttpServer::Run(void) {
-  // Create the server listening socket.
+struct HttpServer::Shard {
+  Shard() : timers(kTimerTickMs) { }
+
+  HttpServer* server;
+
+  // The shard's listening socket.  The first shard uses the server's
+  // socket_; the others own theirs.
+  ServerSocket* socket;
+  unique_ptr<ServerSocket> owned_socket;
   int listen_fd;
+
+  // The shard's io_uring, if it is serving through one.
+  UringLoop uring;
+  bool use_uring;
+
+  // The CPU the shard is pinned to, or -1, and the bounds on its
+  // number of workers.
+  int cpu;
+  uint32_t min_threads;
+  uint32_t max_threads;
+
+  // The server-wide DNS cache, or null if we're not resolving names.
+  DnsCache* dns;
+
+  // The server-wide static file cache, or null if it's disabled.
+  StaticFileCache* file_cache;
+
+  // The server-wide pool of open query processors.
+  QueryProcessorPool* queries;
+
+  // The timeouts of the connections the shard's loop owns.
+  TimerWheel timers;
+
+  // Decides which requests may queue for the shard's workers, one
+  // controller per scheduling class.
+  vector<unique_ptr<AdmissionController>> admission;
+};
+
+struct HttpServer::StatsReporter {
+  uint32_t interval_secs;
+
+  // The server-wide static file cache, or null if it's disabled.
+  StaticFileCache* file_cache;
+
+  // The shards, for their admission controllers.
+  const vector<unique_ptr<Shard>>* shards;
+
+  // Guards "stop", which Run() sets, signalling "wake", once the
+  // shards have finished.
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool stop;
+};
+
+bool HttpServer::Run(void) {
+  // Figure out how many shards to run, and which CPUs they can use.
+  vector<int> cpus;
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &allowed))
+        cpus.push_back(cpu);
+    }
+  }
+  int num_shards = options_.num_shards;
+  if (num_shards <= 0)
+    num_shards = cpus.empty() ? 1 : cpus.size();
+  uint32_t max_threads = std::max<uint32_t>(
+      options_.max_threads / num_shards, 1);
+  uint32_t min_threads = std::min(std::max<uint32_t>(
+      options_.min_threads / num_shards, 1), max_threads);
+
+  // Set up every shard before starting any of them, so that a failure
+  // stops the whole server.  If we've been asked to use io_uring, set
+  // it up before binding: that decides whether the listening socket
+  // needs to be non-blocking for epoll.
+  if (num_shards > 1)
+    cout << "  setting up " << num_shards << " shards..." << endl;
+  if (options_.use_io_uring)
+    cout << "  setting up io_uring..." << endl;
   cout << "  creating and binding the listening socket..." << endl;
-  if (!socket_.BindAndListen(AF_INET6, &listen_fd)) {
-    cerr << endl << "Couldn't bind to the listening socket." << endl;
-    return false;
+  unique_ptr<DnsCache> dns;
+  if (options_.resolve_dns)
+    dns.reset(new DnsCache(kDnsTtlSecs, kDnsMaxEntries));
+  unique_ptr<StaticFileCache> file_cache;
+  if (options_.static_cache_bytes > 0) {
+    file_cache.reset(new StaticFileCache(options_.static_cache_bytes,
+                                         kFileCacheShards,
+                                         kFileCacheRevalidateMs));
   }
+  cout << "  opening and validating the indices..." << endl;
+  QueryProcessorPool queries(indices_, options_.min_threads,
+                             options_.index_mode);
+  queries.PrintFootprint(cout);
+  vector<unique_ptr<Shard>> shards;
+  for (int i = 0; i < num_shards; i++) {
+    unique_ptr<Shard> shard(new Shard);
+    shard->server = this;
+    if (i == 0) {
+      shard->socket = &socket_;
+    } else {
+      shard->owned_socket.reset(new ServerSocket(port_));
+      shard->socket = shard->owned_socket.get();
+    }
+    shard->socket->set_reuse_port(num_shards > 1);
+    shard->cpu = -1;
+    if (num_shards > 1 && !cpus.empty())
+      shard->cpu = cpus[i % cpus.size()];
+    shard->min_threads = min_threads;
+    shard->max_threads = max_threads;
+    shard->dns = dns.get();
+    shard->file_cache = file_cache.get();
+    shard->queries = &queries;
+    for (uint32_t c = 0; c < kNumClasses; c++) {
+      shard->admission.emplace_back(new AdmissionController(
+          options_.admission_target_ms, options_.admission_interval_ms,
+          options_.max_queued_requests));
+    }
 
-  // Spin, accepting connections and dispatching them.  Use a
-  // threadpool to dispatch connections into their own thread.
+    shard->use_uring = options_.use_io_uring && shard->uring.Initialize();
+    if (options_.use_io_uring && !shard->use_uring && i == 0) {
+      cout << "  io_uring is not available; falling back to epoll." << endl;
+    }
+
+    // Create the shard's listening socket.
+    if (!shard->socket->BindAndListen(AF_INET6, &shard->listen_fd,
+                                      !shard->use_uring)) {
+      cerr << endl << "Couldn't bind to the listening socket." << endl;
+      return false;
+    }
+    shards.push_back(std::move(shard));
+  }
+
+  // Report how the server is doing every now and then.
+  StatsReporter stats;
+  stats.interval_secs = options_.stats_interval_secs;
+  stats.file_cache = file_cache.get();
+  stats.shards = &shards;
+  stats.stop = false;
+  Verify333(pthread_mutex_init(&stats.lock, nullptr) == 0);
+  Verify333(pthread_cond_init(&stats.wake, nullptr) == 0);
+  pthread_t stats_thread;
+  if (stats.interval_secs > 0) {
+    Verify333(pthread_create(&stats_thread, nullptr, &StatsThreadFn,
+                             &stats) == 0);
+  }
+
+  // Spin, accepting connections and dispatching them.  Every shard but
+  // the first gets a thread of its own; the first runs on ours.
   cout << "  accepting connections..." << endl << endl;
-  ThreadPool tp(kNumThreads);
+  vector<pthread_t> threads(num_shards);
+  for (int i = 1; i < num_shards; i++) {
+    Verify333(pthread_create(&threads[i], nullptr, &ShardThreadFn,
+                             shards[i].get()) == 0);
+  }
+  bool ok = RunShard(shards[0].get());
+  for (int i = 1; i < num_shards; i++) {
+    Verify333(pthread_join(threads[i], nullptr) == 0);
+  }
+
+  if (stats.interval_secs > 0) {
+    Verify333(pthread_mutex_lock(&stats.lock) == 0);
+    stats.stop = true;
+    Verify333(pthread_cond_signal(&stats.wake) == 0);
+    Verify333(pthread_mutex_unlock(&stats.lock) == 0);
+    Verify333(pthread_join(stats_thread, nullptr) == 0);
+  }
+  Verify333(pthread_cond_destroy(&stats.wake) == 0);
+  Verify333(pthread_mutex_destroy(&stats.lock) == 0);
+  return ok;
+}
+
+void* HttpServer::StatsThreadFn(void* arg) {
+  StatsReporter* stats = static_cast<StatsReporter*>(arg);
+  Verify333(pthread_mutex_lock(&stats->lock) == 0);
+  while (!stats->stop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += stats->interval_secs;
+    while (!stats->stop &&
+           pthread_cond_timedwait(&stats->wake, &stats->lock,
+                                  &deadline) != ETIMEDOUT) {
+    }
+    if (stats->stop)
+      break;
+
+    // Format the whole report first, so that it comes out in one piece
+    // between the lines other threads log.
+    stringstream report;
+    if (stats->file_cache != nullptr) {
+      StaticFileCache::Stats cache = stats->file_cache->GetStats();
+      report << "  static file cache: " << cache.hits << " hits, "
+             << cache.misses << " misses, " << cache.evictions
+             << " evictions, " << cache.invalidations
+             << " invalidations, " << cache.entries << " files in "
+             << cache.bytes << " bytes" << endl;
+    }
+    static const char* kClassNames[kNumClasses] = { "static", "query" };
+    for (size_t i = 0; i < stats->shards->size(); i++) {
+      const Shard* shard = (*stats->shards)[i].get();
+      for (uint32_t c = 0; c < kNumClasses; c++) {
+        AdmissionController::Stats adm = shard->admission[c]->GetStats();
+        uint64_t mean_us = adm.dequeued == 0 ? 0 :
+            adm.total_delay_ns / adm.dequeued / 1000;
+        report << "  shard " << i << " " << kClassNames[c] << " requests: "
+               << adm.admitted << " admitted, " << adm.shed << " shed, "
+               << adm.queued << " queued, waited " << mean_us
+               << " us on average and " << adm.max_delay_ns / 1000
+               << " us at most" << endl;
+      }
+    }
+    cout << report.str() << std::flush;
+  }
+  Verify333(pthread_mutex_unlock(&stats->lock) == 0);
+  return nullptr;
+}
+
+void* HttpServer::ShardThreadFn(void* arg) {
+  Shard* shard = static_cast<Shard*>(arg);
+  shard->server->RunShard(shard);
+  return nullptr;
+}
+
+bool HttpServer::RunShard(Shard* shard) {
+  if (shard->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(shard->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+
+  // Use a threadpool to process requests once they have arrived.
+  vector<uint32_t> class_weights(kNumClasses);
+  class_weights[kStaticClass] = options_.static_weight;
+  class_weights[kQueryClass] = options_.query_weight;
+  ThreadPool tp(shard->max_threads, shard->cpu, options_.scheduler,
+                options_.queue_capacity, shard->min_threads, class_weights);
+  if (shard->use_uring)
+    return ServeUring(shard, &tp);
+  return ServeEpoll(shard, &tp);
+}
+
+bool HttpServer::ServeEpoll(Shard* shard, ThreadPool* tp) {
+  // Wait for events on the listening socket and on idle client
+  // connections.  New connections are registered with the event loop;
+  // connections with a complete request are dispatched into the
+  // threadpool.  The listening socket is registered with a null data
+  // pointer so we can tell it apart from the clients.
+  EventLoop loop;
+  if (!loop.Add(shard->listen_fd, nullptr, false)) {
+    cerr << "Couldn't register the listening socket." << endl;
+    return false;
+  }
+
+  struct epoll_event events[kMaxEvents];
+  vector<ThreadPool::Task*> ready;
+  ready.reserve(kMaxEvents);
+  int wait_ms = TimerWaitMs(options_, shard->timers);
+
+  // Set when AcceptConnections() left connections in the backlog.  We
+  // then wake up every kAcceptRetryMs to try again, since no new edge
+  // may ever come.
+  bool accept_pending = false;
   while (1) {
-    HttpServerTask* hst = new HttpServerTask(HttpServer_ThrFn);
-    hst->base_dir = static_file_dir_path_;
-    hst->indices = &indices_;
-    if (!socket_.Accept(&hst->client_fd,
-                    &hst->c_addr,
-                    &hst->c_port,
-                    &hst->c_dns,
-                    &hst->s_addr,
-                    &hst->s_dns)) {
-      // The accept failed for some reason, so quit out of the server.
-      // (Will happen when kill command is used to shut down the server.)
+    int loop_wait_ms = wait_ms;
+    if (accept_pending && (wait_ms < 0 || wait_ms > kAcceptRetryMs))
+      loop_wait_ms = kAcceptRetryMs;
+    int num_events = loop.Wait(events, kMaxEvents, loop_wait_ms);
+    if (num_events == -1) {
+      if (errno == EINTR)
+        continue;
+      // The event loop failed for some reason, so quit out of the server.
       break;
     }
-    // The accept succeeded; dispatch it.
-    tp.Dispatch(hst);
+    bool accept_now = accept_pending;
+    for (int i = 0; i < num_events; i++) {
+      if (events[i].data.ptr == nullptr) {
+        accept_now = true;
+      } else {
+        HandleReadable(static_cast<HttpServerTask*>(events[i].data.ptr),
+                       &ready);
+      }
+    }
+    if (accept_now) {
+      accept_pending = !AcceptConnections(
+          *shard->socket, &loop, static_file_dir_path_, shard->queries,
+          shard->dns, shard->file_cache, &options_, &shard->timers);
+    }
+    DispatchReady(tp, shard->admission, &ready);
+    shard->timers.Advance(ExpireConnection);
   }
   return true;
 }
 
-static void HttpServer_ThrFn(ThreadPool::Task* t) {
-  // Cast back our HttpServerTask structure with all of our new
-  // client's information in it.
-  unique_ptr<HttpServerTask> hst(static_cast<HttpServerTask*>(t));
+bool HttpServer::ServeUring(Shard* shard, ThreadPool* tp) {
+  UringLoop* uring = &shard->uring;
+  // The ring keeps an accept outstanding on the listening socket and a
+  // read outstanding on every idle client, and tells us when they
+  // complete.  Accepts are reported with a null data pointer.
+  if (!uring->StartAccept(shard->listen_fd)) {
+    cerr << "Couldn't start accepting through io_uring." << endl;
+    return false;
+  }
+
+  UringLoop::Event events[kMaxEvents];
+  vector<ThreadPool::Task*> ready;
+  ready.reserve(kMaxEvents);
+  int wait_ms = TimerWaitMs(options_, shard->timers);
+  while (1) {
+    int num_events = uring->Wait(events, kMaxEvents, wait_ms);
+    if (num_events == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (int i = 0; i < num_events; i++) {
+      if (events[i].data != nullptr) {
+        HandleUringRead(static_cast<HttpServerTask*>(events[i].data),
+                        events[i], &ready);
+        continue;
+      }
+
+      int client_fd = events[i].res;
+      HttpServerTask* hst = new HttpServerTask(HttpServer_ThrFn, client_fd);
+      if (!shard->socket->GetConnectionInfo(client_fd, &hst->c_addr,
+                                            &hst->c_port, &hst->c_dns,
+                                            &hst->s_addr, &hst->s_dns)) {
+        delete hst;
+        continue;
+      }
+      // The ring wants blocking sockets, which poll() can't time out for
+      // us, so have the kernel time out writes that block too long.
+      if (options_.write_timeout_ms > 0) {
+        struct timeval tv;
+        tv.tv_sec = options_.write_timeout_ms / 1000;
+        tv.tv_usec = (options_.write_timeout_ms % 1000) * 1000;
+        setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      }
+      InitServerTask(hst, static_file_dir_path_, shard->queries, shard->dns,
+                     shard->file_cache, &options_, &shard->timers);
+      hst->uring = uring;
+      hst->conn.set_use_uring(true);
+      if (!uring->Read(client_fd, hst)) {
+        delete hst;
+      }
+    }
+    DispatchReady(tp, shard->admission, &ready);
+    shard->timers.Advance(ExpireConnection);
+  }
+  return true;
+}
+
+static bool AcceptConnections(const ServerSocket& socket,
+                              EventLoop* loop,
+                              const string& base_dir,
+                              QueryProcessorPool* queries,
+                              DnsCache* dns,
+                              StaticFileCache* file_cache,
+                              const HttpServerOptions* options,
+                              TimerWheel* timers) {
+  while (1) {
+    int client_fd;
+    uint16_t c_port;
+    string c_addr, c_dns, s_addr, s_dns;
+    if (!socket.Accept(&client_fd, &c_addr, &c_port, &c_dns,
+                       &s_addr, &s_dns)) {
+      // EAGAIN means we've accepted everything that was pending.  A
+      // client that reset before we got to it only costs us that one
+      // connection, so carry on with the ones queued behind it.  Any
+      // other failure (EMFILE, ENFILE, ENOBUFS, ...) leaves the rest of
+      // the backlog waiting, and epoll won't tell us about it again.
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return true;
+      if (errno == ECONNABORTED || errno == EPROTO || errno == EINTR)
+        continue;
+      return false;
+    }
+
+    HttpServerTask* hst = new HttpServerTask(HttpServer_ThrFn, client_fd);
+    hst->c_port = c_port;
+    hst->c_addr = c_addr;
+    hst->c_dns = c_dns;
+    hst->s_addr = s_addr;
+    hst->s_dns = s_dns;
+    InitServerTask(hst, base_dir, queries, dns, file_cache, options, timers);
+    hst->loop = loop;
+
+    // The client may well have sent its request already, in which case
+    // the edge-triggered registration reports it straight away.
+    if (!loop->Add(client_fd, hst, true)) {
+      delete hst;
+    }
+  }
+}
+
+static void InitServerTask(HttpServerTask* hst,
+                           const string& base_dir,
+                           QueryProcessorPool* queries,
+                           DnsCache* dns,
+                           StaticFileCache* file_cache,
+                           const HttpServerOptions* options,
+                           TimerWheel* timers) {
+  hst->base_dir = base_dir;
+  hst->queries = queries;
+  hst->file_cache = file_cache;
+  hst->options = options;
+  if (options->max_header_bytes > 0)
+    hst->conn.set_max_header_bytes(options->max_header_bytes);
+  if (options->write_timeout_ms > 0)
+    hst->conn.set_write_timeout_ms(options->write_timeout_ms);
+
+  // The client has until the header timeout to send its first request.
+  hst->timers = timers;
+  StartTimer(hst, true);
+  if (dns != nullptr) {
+    dns->Lookup(hst->c_addr, &hst->c_dns);
+    dns->Lookup(hst->s_addr, &hst->s_dns);
+  }
   cout << "  client " << hst->c_dns << ":" << hst->c_port << " "
        << "(IP address " << hst->c_addr << ")" << " connected." << endl;
+}
 
-  // Read in the next request, process it, and write the response.
+static void HandleReadable(HttpServerTask* hst,
+                           vector<ThreadPool::Task*>* ready) {
+  if (!hst->conn.FillBuffer()) {
+    hst->peer_closed = true;
+  }
 
-  // Use the HttpConnection class to read and process the next
-  // request from our current client, then write out our response.  If
-  // the client sends a "Connection: close\r\n" header, then shut down
-  // the connection -- we're done.
-  //
-  // Hint: the client can make multiple requests on our single connection,
-  // so we should keep the connection open between requests rather than
-  // creating/destroying the same connection repeatedly.
+  if (hst->conn.HasBufferedRequest()) {
+    // The worker owns the connection now; it will re-arm or close it.
+    hst->timers->Cancel(&hst->timer);
+    if (ClassifyTask(hst)) {
+      ready->push_back(hst);
+    } else {
+      delete hst;
+    }
+    return;
+  }
+
+  // The first bytes of a request start the header timeout.
+  if (!hst->awaiting_header && hst->conn.HasBufferedInput())
+    StartTimer(hst, true);
+  if (hst->peer_closed || !hst->loop->Rearm(hst->client_fd, hst)) {
+    // Deleting the task closes the socket, which also removes it
+    // from the event loop.
+    delete hst;
+  }
+}
+
+static void HandleUringRead(HttpServerTask* hst,
+                            const UringLoop::Event& ev,
+                            vector<ThreadPool::Task*>* ready) {
+  if (ev.res > 0) {
+    hst->conn.AppendInput(ev.buf, ev.res);
+  } else {
+    // Zero means the client closed the connection.
+    hst->peer_closed = true;
+  }
+  hst->uring->ReleaseBuffer(ev.slot);
+
+  if (hst->conn.HasBufferedRequest()) {
+    hst->timers->Cancel(&hst->timer);
+    if (ClassifyTask(hst)) {
+      ready->push_back(hst);
+    } else {
+      delete hst;
+    }
+    return;
+  }
+
+  if (!hst->awaiting_header && hst->conn.HasBufferedInput())
+    StartTimer(hst, true);
+  if (hst->peer_closed || !hst->uring->Read(hst->client_fd, hst)) {
+    delete hst;
+  }
+}
+
+static bool ClassifyTask(HttpServerTask* hst) {
+  // The request is already buffered, so this won't block.
+  if (!hst->conn.GetNextRequest(&hst->request)) {
+    if (hst->conn.header_too_large()) {
+      SendRefusal(hst->client_fd, kHeaderTooLargeStr,
+                  sizeof(kHeaderTooLargeStr) - 1);
+    }
+    return false;
+  }
+  hst->has_request = true;
+  hst->class_ = IsStaticRequest(hst->request.uri()) ? kStaticClass
+                                                    : kQueryClass;
+  return true;
+}
+
+static bool IsStaticRequest(std::string_view uri) {
+  return uri.substr(0, 8) == "/static/";
+}
+
+static void DispatchReady(ThreadPool* tp,
+                          const vector<unique_ptr<AdmissionController>>&
+                            admission,
+                          vector<ThreadPool::Task*>* ready) {
+  if (ready->empty())
+    return;
+
+  // Turn away the requests we can't serve in reasonable time right
+  // here, before they cost us anything more, and stamp the rest so the
+  // workers can tell how long they waited.
+  int64_t now = NowNs();
+  size_t num_admitted = 0;
+  for (ThreadPool::Task* t : *ready) {
+    HttpServerTask* hst = static_cast<HttpServerTask*>(t);
+    AdmissionController* controller = admission[hst->class_].get();
+    if (!controller->Admit(now)) {
+      SendRefusal(hst->client_fd, kServiceUnavailableStr,
+                  sizeof(kServiceUnavailableStr) - 1);
+      delete hst;
+      continue;
+    }
+    hst->admission = controller;
+    hst->queued_ns = now;
+    (*ready)[num_admitted++] = hst;
+  }
+
+  size_t n = tp->DispatchBatch(ready->data(), num_admitted);
+  for (size_t i = n; i < num_admitted; i++) {
+    // The pool is saturated; shed the request rather than let the
+    // backlog grow without bound.
+    HttpServerTask* hst = static_cast<HttpServerTask*>((*ready)[i]);
+    hst->admission->Withdraw();
+    SendRefusal(hst->client_fd, kServiceUnavailableStr,
+                sizeof(kServiceUnavailableStr) - 1);
+    delete hst;
+  }
+  ready->clear();
+}
+
+static bool ReturnToLoop(HttpServerTask* hst) {
+  // Start the clock before the loop can see the connection again.  If
+  // the client has started on its next request, it has until the
+  // header timeout to finish it.
+  StartTimer(hst, hst->conn.HasBufferedInput());
+  if (hst->uring != nullptr)
+    return hst->uring->Read(hst->client_fd, hst);
+  return hst->loop->Rearm(hst->client_fd, hst);
+}
+
+static void StartTimer(HttpServerTask* hst, bool header) {
+  uint32_t timeout_ms = header ? hst->options->header_timeout_ms
+                               : hst->options->idle_timeout_ms;
+  hst->awaiting_header = header;
+  if (timeout_ms > 0) {
+    hst->timers->Schedule(&hst->timer, timeout_ms);
+  } else {
+    hst->timers->Cancel(&hst->timer);
+  }
+}
+
+static int TimerWaitMs(const HttpServerOptions& options,
+                       const TimerWheel& timers) {
+  if (options.idle_timeout_ms == 0 && options.header_timeout_ms == 0)
+    return -1;
+  return timers.tick_ms();
+}
+
+static void ExpireConnection(void* data) {
+  // The loop owns the connection, so rather than deleting the task out
+  // from under it, shut the socket down: the loop then sees the client
+  // go away and closes the connection as usual.
+  HttpServerTask* hst = static_cast<HttpServerTask*>(data);
+  shutdown(hst->client_fd, SHUT_RDWR);
+}
+
+static void SendRefusal(int fd, const char* response, size_t len) {
+  // Don't block: a client that can't take a few bytes right away isn't
+  // listening anyway.
+  send(fd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+  // Closing a socket with unread input resets the connection, which can
+  // destroy the response before the client reads it, so throw away
+  // (a bounded amount of) whatever the client has already sent.
+  shutdown(fd, SHUT_WR);
+  char discard[4096];
+  for (size_t drained = 0; drained < kMaxRefusalDrainBytes; ) {
+    ssize_t res = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+    if (res <= 0)
+      break;
+    drained += res;
+  }
+}
+
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static void HttpServer_ThrFn(ThreadPool::Task* t) {
+  // Cast back our HttpServerTask structure with all of our
+  // client's information in it.  We only get here once the event
+  // loop has buffered and parsed at least one complete request.
+  HttpServerTask* hst = static_cast<HttpServerTask*>(t);
+
+  // Tell the admission controller how long we waited in the queue.
+  if (hst->admission != nullptr) {
+    int64_t now = NowNs();
+    hst->admission->Dequeued(now - hst->queued_ns, now);
+    hst->admission = nullptr;
+  }
 
-  // STEP 1:
+  // Answer every request the client has already sent us, in order.
+  // If the client sends a "Connection: close\r\n" header, or something
+  // goes wrong, then shut down the connection -- we're done.
   bool done = false;
-  HttpConnection hc(hst->client_fd);
-  while (!done) {
-    // get the next request
-    HttpRequest req;
-    if (!hc.GetNextRequest(&req)) {
-      close(hst->client_fd);
+  while (!done && (hst->has_request || hst->conn.HasBufferedRequest())) {
+    // get the next request; it's already buffered, so this won't block.
+    // Every request on the connection reuses hst->request's storage.
+    if (hst->has_request) {
+      hst->has_request = false;
+    } else if (!hst->conn.GetNextRequest(&hst->request)) {
       done = true;
+      break;
     }
+    const HttpRequest& req = hst->request;
 
     // process the request
-    HttpResponse rep = ProcessRequest(req, hst->base_dir, *hst->indices);
+    HttpResponse rep = ProcessRequest(req, hst->base_dir, hst->queries,
+                                      hst->file_cache,
+                                      hst->options->query_deadline_ms);
+
+    // close the connection once it has had its share of requests
+    hst->num_requests++;
+    uint32_t max_requests = hst->options->max_requests_per_connection;
+    if (max_requests > 0 && hst->num_requests >= max_requests) {
+      rep.set_connection_close(true);
+      done = true;
+    }
 
-    // write the response
-    if (!hc.WriteResponse(rep)) {
-      close(hst->client_fd);
+    // queue the response; the responses to the whole burst of
+    // requests go out together below
+    if (!hst->conn.QueueResponse(std::move(rep))) {
       done = true;
     }
 
     // close the connection if the client sent "Connection: close\r\n"
-    if (req.GetHeaderValue("connection") == "close") {
-      close(hst->client_fd);
+    if (req.HeaderValue("connection") == "close") {
       done = true;
     }
   }
+
+  // write the responses, and tell the client if we gave up on a
+  // request because its header was too long
+  if (!hst->conn.FlushResponses()) {
+    done = true;
+  }
+  if (hst->conn.header_too_large()) {
+    SendRefusal(hst->client_fd, kHeaderTooLargeStr,
+                sizeof(kHeaderTooLargeStr) - 1);
+  }
+
+  // Hand the connection back to the event loop to wait for the next
+  // request.  Once that succeeds the loop may pick the task up on
+  // another thread, so we mustn't touch it afterwards.
+  if (done || hst->peer_closed || !ReturnToLoop(hst)) {
+    delete hst;
+  }
 }
 
 static HttpResponse ProcessRequest(const HttpRequest& req,
                             const string& base_dir,
-                            const list<string>& indices) {
+                            QueryProcessorPool* queries,
+                            StaticFileCache* file_cache,
+                            uint32_t query_deadline_ms) {
   // Is the user asking for a static file?
-  if (req.uri().substr(0, 8) == "/static/") {
-    return ProcessFileRequest(req.uri(), base_dir);
+  if (IsStaticRequest(req.uri())) {
+    return ProcessFileRequest(string(req.uri()), base_dir, file_cache);
   }
 
-  // The user must be asking for a query.
-  return ProcessQueryRequest(req.uri(), indices);
+  // The user must be asking for a query.  Only HTTP/1.1 clients
+  // understand a chunked body; everybody else gets the whole page at once.
+  HttpResponse rep = ProcessQueryRequest(string(req.uri()), queries,
+                                         query_deadline_ms);
+  if (req.version() != "HTTP/1.1")
+    rep.BufferStreamedBody();
+  return rep;
+}
+
+static bool NormalizeFilePath(const string& file_name,
+                              string* const normalized) {
+  normalized->clear();
+  if (!file_name.empty() && file_name.back() == '/')
+    return false;
+  size_t start = 0;
+  while (start <= file_name.size()) {
+    size_t end = file_name.find('/', start);
+    if (end == string::npos)
+      end = file_name.size();
+    std::string_view part(file_name.data() + start, end - start);
+    if (part == "..")
+      return false;
+    if (!part.empty() && part != ".") {
+      if (!normalized->empty())
+        *normalized += '/';
+      normalized->append(part.data(), part.size());
+    }
+    start = end + 1;
+  }
+  return true;
 }
 
 static HttpResponse ProcessFileRequest(const string& uri,
-                                const string& base_dir) {
+                                const string& base_dir,
+                                StaticFileCache* file_cache) {
   // The response we'll build up.
   HttpResponse ret;
 
@@ -182,9 +968,10 @@ static HttpResponse ProcessFileRequest(const string& uri,
   //    the user is asking for. Note that we identify a request
   //    as a file request if the URI starts with '/static/'
   //
-  // 2. Use the FileReader class to read the file into memory
+  // 2. Use the FileReader class to open the file
   //
-  // 3. Copy the file content into the ret.body
+  // 3. Make the open file the body of ret, so that it gets sent
+  //    straight from the page cache with sendfile()
   //
   // 4. Depending on the file name suffix, set the response
   //    Content-type header as appropriate, e.g.,:
@@ -212,10 +999,30 @@ static HttpResponse ProcessFileRequest(const string& uri,
   file_name = file_name.replace(0, 8, "");
   FileReader fr(base_dir, file_name);
 
-  if (fr.ReadFile(&file_name)) {
+  // hot files are answered straight from the cache, without resolving
+  // the path: the key is the lexically normalized name, and entries
+  // are only made for names that passed IsPathSafe() on a miss
+  string cache_key;
+  if (file_cache != nullptr && NormalizeFilePath(file_name, &cache_key)) {
+    cache_key = base_dir + "/" + cache_key;
+    std::shared_ptr<const string> prepared = file_cache->Lookup(cache_key);
+    if (prepared != nullptr) {
+      ret.SetPrepared(prepared);
+      return ret;
+    }
+  }
+
+  int file_fd;
+  struct stat file_stat;
+  if (fr.OpenFile(&file_fd, &file_stat)) {
+    ret.SetBodyFile(file_fd, 0, file_stat.st_size);
+
     // get the file name suffix
     __SIZE_TYPE__ dot_pos = file_name.rfind(".");
-    std::string suffix = file_name.substr(dot_pos, file_name.length() - 1);
+    std::string suffix = "";
+    if (dot_pos != string::npos) {
+      suffix = file_name.substr(dot_pos);
+    }
 
     // set content_type based on file name suffix
     if (suffix == ".html" || suffix == ".htm") {
@@ -246,6 +1053,19 @@ static HttpResponse ProcessFileRequest(const string& uri,
     ret.set_protocol("HTTP/1.1");
     ret.set_response_code(200);
     ret.set_message("OK");
+
+    // small files are prepared in full and cached for next time
+    if (!cache_key.empty() && file_stat.st_size <= kMaxCachedFileBytes) {
+      std::shared_ptr<const string> prepared =
+        std::make_shared<const string>(ret.GenerateResponseString());
+      if (prepared->size() ==
+          ret.GenerateHeaderString().size() + file_stat.st_size) {
+        file_cache->Insert(cache_key, file_stat, prepared);
+      }
+      HttpResponse cached;
+      cached.SetPrepared(prepared);
+      return cached;
+    }
     return ret;
   }
 
@@ -260,9 +1080,29 @@ static HttpResponse ProcessFileRequest(const string& uri,
 }
 
 static HttpResponse ProcessQueryRequest(const string& uri,
-                                 const list<string>& indices) {
-  // The response we're building up.
+                                 QueryProcessorPool* queries,
+                                 uint32_t deadline_ms) {
+  // The response we're building up.  The page is streamed, so that the
+  // client can show the logo and search box while we run the query.
+  // The query's clock starts now, not when the page is sent.
   HttpResponse ret;
+  QueryDeadline deadline = QueryDeadline::After(deadline_ms);
+  ret.SetBodyProducer([uri, queries, deadline](HttpBodySink* sink) {
+    return WriteQueryPage(uri, queries, deadline, sink);
+  });
+
+  // set the response protocol, response code, and message
+  ret.set_protocol("HTTP/1.1");
+  ret.set_response_code(200);
+  ret.set_message("OK");
+
+  return ret;
+}
+
+static bool WriteQueryPage(const string& uri,
+                           QueryProcessorPool* queries,
+                           const QueryDeadline& deadline,
+                           HttpBodySink* sink) {
 
   // Your job here is to figure out how to present the user with
   // the same query interface as our solution_binaries/http333d server.
@@ -277,7 +1117,7 @@ static HttpResponse ProcessQueryRequest(const string& uri,
   //    search terms from a typed-in search query.  convert them
   //    to lower case.
   //
-  // 4. Initialize and use hw3::QueryProcessor to process queries with the
+  // 4. Borrow a QueryProcessor from the pool to process queries with the
   //    search indices.
   //
   // 5. With your results, try figuring out how to hyperlink results to file
@@ -286,8 +1126,10 @@ static HttpResponse ProcessQueryRequest(const string& uri,
 
   // STEP 3:
 
-  // 333gle setup
-  ret.AppendToBody(kThreegleStr);
+  // 333gle setup; send it right away, before we run the query
+  sink->Write(kThreegleStr);
+  if (!sink->Flush())
+    return false;
 
   // parse the uri to get query and convert the query to lower case
   URLParser p;
@@ -302,11 +1144,14 @@ static HttpResponse ProcessQueryRequest(const string& uri,
     vector<string> qvec;
     boost::split(qvec, query, boost::is_any_of(" "), boost::token_compress_on);
 
-    // construct a QueryProcessor to answer query
-    hw3::QueryProcessor qp(indices, false);
-
-    // search for the matched documents
-    vector<hw3::QueryProcessor::QueryResult> qr = qp.ProcessQuery(qvec);
+    // borrow an open QueryProcessor to answer query, and search for
+    // the matched documents, giving up at the deadline
+    bool partial;
+    vector<hw3::QueryProcessor::QueryResult> qr;
+    {
+      QueryProcessorPool::Lease qp(queries);
+      qr = qp->ProcessQuery(qvec, deadline, &partial);
+    }
 
     if (qr.size() == 0) {  // no matched documents found
       const char* noMatchStr1 = 
@@ -316,53 +1161,52 @@ static HttpResponse ProcessQueryRequest(const string& uri,
         "</b>\r\n"
         "<p>\r\n"
         "\r\n";
-      ret.AppendToBody(noMatchStr1);
-      ret.AppendToBody(EscapeHtml(query));
-      ret.AppendToBody(noMatchStr2);
+      sink->Write(noMatchStr1);
+      sink->Write(EscapeHtml(query));
+      sink->Write(noMatchStr2);
     } else {  // display the number of results found
       std::stringstream ss;
-      ret.AppendToBody("<p><br>\r\n");
+      sink->Write("<p><br>\r\n");
       ss << qr.size();
-      ret.AppendToBody(ss.str());
+      sink->Write(ss.str());
       ss.str("");
 
-      ret.AppendToBody((qr.size() == 1) ? " result " : " results ");
-      ret.AppendToBody("found for <b>");
-      ret.AppendToBody(EscapeHtml(query));
-      ret.AppendToBody("</b>\r\n");
-      ret.AppendToBody("<p>\r\n\r\n");
+      sink->Write((qr.size() == 1) ? " result " : " results ");
+      sink->Write("found for <b>");
+      sink->Write(EscapeHtml(query));
+      sink->Write("</b>\r\n");
+      sink->Write("<p>\r\n\r\n");
 
       // display each matched document with hyperlink
-      ret.AppendToBody("<ul>\r\n");
+      sink->Write("<ul>\r\n");
       for (uint32_t i = 0; i < qr.size(); i++) {
-        ret.AppendToBody(" <li> <a href=\"");
+        sink->Write(" <li> <a href=\"");
         if (qr[i].document_name.substr(0, 7) != "http://") {
-          ret.AppendToBody("/static/");
+          sink->Write("/static/");
         }
-        ret.AppendToBody(qr[i].document_name);
-        ret.AppendToBody("\">");
-        ret.AppendToBody(EscapeHtml(qr[i].document_name));
-        ret.AppendToBody("</a>");
-        ret.AppendToBody(" [");
+        sink->Write(qr[i].document_name);
+        sink->Write("\">");
+        sink->Write(EscapeHtml(qr[i].document_name));
+        sink->Write("</a>");
+        sink->Write(" [");
         ss << qr[i].rank;
-        ret.AppendToBody(ss.str());
+        sink->Write(ss.str());
         ss.str("");
-        ret.AppendToBody("]<br>\r\n");
+        sink->Write("]<br>\r\n");
       }
-      ret.AppendToBody("</ul>\r\n");
+      sink->Write("</ul>\r\n");
+    }
+
+    // own up to it if the query ran out of time
+    if (partial) {
+      sink->Write("<p><i>The search ran out of time; these are the results "
+                  "found so far.</i>\r\n");
     }
   }
 
   // the end of the response body
-  ret.AppendToBody("</body>\r\n");
-  ret.AppendToBody("</html>\r\n");
-
-  // set the response protocol, response code, and message
-  ret.set_protocol("HTTP/1.1");
-  ret.set_response_code(200);
-  ret.set_message("OK");
-
-  return ret;
+  sink->Write("</body>\r\n");
+  return sink->Write("</html>\r\n");
 }
 
 }  // namespace hw4
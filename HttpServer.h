@@ -16,23 +16,143 @@
 #include <string>
 #include <list>
 
+#include "./AdmissionController.h"
+#include "./DnsCache.h"
+#include "./EventLoop.h"
+#include "./HttpConnection.h"
+#include "./IoUring.h"
+#include "./QueryProcessorPool.h"
 #include "./ThreadPool.h"
 #include "./ServerSocket.h"
+#include "./StaticFileCache.h"
+#include "./TimerWheel.h"
 
 namespace hw4 {
 
+// Tunable knobs for an HttpServer.  The defaults give the server's
+// standard behavior.
+struct HttpServerOptions {
+  HttpServerOptions()
+    : use_io_uring(false), num_shards(1), resolve_dns(true),
+      scheduler(ThreadPool::kSharedQueue),
+      queue_capacity(ThreadPool::kDefaultQueueCapacity),
+      min_threads(8), max_threads(100), static_weight(4), query_weight(1),
+      static_cache_bytes(64 << 20), idle_timeout_ms(30000),
+      header_timeout_ms(10000), write_timeout_ms(30000),
+      max_header_bytes(32768), max_requests_per_connection(1000),
+      admission_target_ms(5), admission_interval_ms(100),
+      max_queued_requests(0), query_deadline_ms(1000),
+      index_mode(QueryProcessorPool::kStdioIndex),
+      stats_interval_secs(60) { }
+
+  // Accept and read client connections through io_uring rather than
+  // epoll, and write responses as linked io_uring writes.  The server
+  // falls back to epoll if the kernel doesn't support io_uring.
+  bool use_io_uring;
+
+  // The number of shards to run.  Each shard has its own SO_REUSEPORT
+  // listening socket, event loop thread and worker threads, all pinned
+  // to one CPU, and the kernel spreads new connections across them.
+  // Zero means one shard per CPU.
+  int num_shards;
+
+  // Log clients by DNS name.  Names are resolved in the background and
+  // cached, so connections never wait on DNS; a client is logged by its
+  // numeric address until its name is known.
+  bool resolve_dns;
+
+  // How each shard's thread pool hands connections to its workers.
+  ThreadPool::Scheduler scheduler;
+
+  // With ThreadPool::kBoundedQueue, how many connections may wait for
+  // a worker in each shard.  Connections that become ready while the
+  // queue is full are closed.
+  uint32_t queue_capacity;
+
+  // The bounds on the number of worker threads, split evenly across
+  // the shards.  The server starts with min_threads workers and adds
+  // more, up to max_threads, when connections wait too long for one;
+  // idle workers are retired again.  Setting both to the same value
+  // gives a fixed-size pool, as does ThreadPool::kWorkStealing, which
+  // always runs max_threads workers.
+  uint32_t min_threads;
+  uint32_t max_threads;
+
+  // Static file requests and query requests are queued for the workers
+  // in separate scheduling classes, served in proportion to these
+  // weights, so that a burst of expensive queries can't hold up cheap
+  // static files.  Ignored with ThreadPool::kWorkStealing.
+  uint32_t static_weight;
+  uint32_t query_weight;
+
+  // How many bytes of prepared static file responses to keep in
+  // memory, so that hot files are served without touching the file
+  // system.  Zero disables the cache.
+  size_t static_cache_bytes;
+
+  // How long, in milliseconds, a keep-alive connection may sit idle
+  // between requests; how long a client may take to send a whole
+  // request header, counting from the first byte (or from when it
+  // connected); and how long a response may wait for the client to
+  // take more of it.  Connections that run out of time are closed.
+  // Zero means no limit.
+  uint32_t idle_timeout_ms;
+  uint32_t header_timeout_ms;
+  uint32_t write_timeout_ms;
+
+  // The longest request header we accept, in bytes.  Longer ones get a
+  // "431 Request Header Fields Too Large" and the connection is closed.
+  // Zero means no limit.
+  size_t max_header_bytes;
+
+  // How many requests we answer on one connection before closing it.
+  // Zero means no limit.
+  uint32_t max_requests_per_connection;
+
+  // Admission control (see AdmissionController).  If, for a whole
+  // admission_interval_ms, no request waited less than
+  // admission_target_ms for a worker, the queue is standing and the
+  // shard is overloaded: until a request gets through quickly again,
+  // new requests are answered with "503 Service Unavailable" and a
+  // "Retry-After" header instead of joining the queue.  So are new
+  // requests while max_queued_requests are waiting in a shard's class.
+  // Zero turns either check off.
+  uint32_t admission_target_ms;
+  uint32_t admission_interval_ms;
+  uint32_t max_queued_requests;
+
+  // How long a query may run, in milliseconds.  A query that runs out
+  // of time answers with the results from the index files it finished,
+  // and says so.  Zero means no limit.
+  uint32_t query_deadline_ms;
+
+  // How queries read the index files: through hw3's stdio readers, one
+  // set per concurrent query; through readers every worker shares, over
+  // a single read-only mmap() of each file or pread() on a single
+  // descriptor per file; or not at all, having decoded them into memory
+  // at startup.
+  QueryProcessorPool::IndexMode index_mode;
+
+  // How often, in seconds, to print the counters of the static file
+  // cache and of each shard's admission control.  Zero means never.
+  uint32_t stats_interval_secs;
+};
+
 // The HttpServer class contains the main logic for the web server.
 class HttpServer {
  public:
   // Creates a new HttpServer object for port "port" and serving
   // files out of path "static_file_dir_path".  The indices for
-  // query processing are located in the "indices" list. The constructor
-  // does not do anything except memorize these variables.
+  // query processing are located in the "indices" list, and "options"
+  // tunes how the server runs. The constructor does not do anything
+  // except memorize these variables.
   explicit HttpServer(uint16_t port,
                       const std::string& static_file_dir_path,
-                      const std::list<std::string>& indices)
-    : socket_(port), static_file_dir_path_(static_file_dir_path),
-      indices_(indices) { }
+                      const std::list<std::string>& indices,
+                      const HttpServerOptions& options = HttpServerOptions())
+    : port_(port), socket_(port),
+      static_file_dir_path_(static_file_dir_path),
+      indices_(indices), options_(options) { }
 
   // The destructor closes the listening socket if it is open and
   // also terminates any threads in the threadpool.
@@ -41,6 +161,11 @@ class HttpServer {
   // Creates a listening socket for the server and launches it, accepting
   // connections and dispatching them to worker threads.
   //
+  // Each shard runs an event loop thread that owns its client
+  // connections while they are idle.  A connection is only handed to a
+  // worker thread once its HttpConnection has a complete request
+  // buffered, so idle keep-alive clients don't tie up any workers.
+  //
   // Returns: true if the server was able to start and run and false otherwise.
   //
   // The server continues to run until a kill command is used to send
@@ -48,22 +173,112 @@ class HttpServer {
   bool Run();
 
  private:
+  // Everything one shard of the server needs: its listening socket,
+  // its loop, and the CPU it runs on.  Defined in HttpServer.cc.
+  struct Shard;
+
+  // Serves connections on one shard until its loop fails, pinning the
+  // calling thread to the shard's CPU.  Returns false if the shard
+  // couldn't get started.
+  bool RunShard(Shard* shard);
+
+  // The thread start routine for every shard but the first, which runs
+  // on the thread that called Run().
+  static void* ShardThreadFn(void* arg);
+
+  // What the statistics thread reports on, and how to stop it.
+  // Defined in HttpServer.cc.
+  struct StatsReporter;
+
+  // The statistics thread's start routine: prints the counters every
+  // stats_interval_secs until the reporter is stopped.
+  static void* StatsThreadFn(void* arg);
+
+  // The two halves of RunShard(): serve connections from an epoll
+  // EventLoop or from an io_uring UringLoop.  Each returns false if it
+  // couldn't get started.
+  bool ServeEpoll(Shard* shard, ThreadPool* tp);
+  bool ServeUring(Shard* shard, ThreadPool* tp);
+
+  uint16_t port_;
+
+  // The listening socket of the first shard.
   ServerSocket socket_;
   std::string static_file_dir_path_;
   std::list<std::string> indices_;
-  static const int kNumThreads;
+  HttpServerOptions options_;
 };
 
+// An HttpServerTask holds everything we know about one client
+// connection.  While the connection is idle it belongs to the event
+// loop; once a complete request has been buffered, it is dispatched
+// to a worker thread, which either hands it back to the loop (with
+// EventLoop::Rearm() or UringLoop::Read()) or deletes it, closing the
+// connection.
 class HttpServerTask : public ThreadPool::Task {
  public:
-  explicit HttpServerTask(ThreadPool::thread_task_fn f)
-    : ThreadPool::Task(f) { }
+  HttpServerTask(ThreadPool::thread_task_fn f, int fd)
+    : ThreadPool::Task(f), client_fd(fd), queries(nullptr),
+      file_cache(nullptr),
+      options(nullptr), conn(fd), loop(nullptr), uring(nullptr),
+      timers(nullptr), awaiting_header(false), num_requests(0),
+      admission(nullptr), queued_ns(0), peer_closed(false),
+      has_request(false) {
+    timer.data = this;
+  }
+
+  // Makes sure the timer can't go off once the connection is gone.
+  ~HttpServerTask() {
+    if (timers != nullptr)
+      timers->Cancel(&timer);
+  }
 
   int client_fd;
   uint16_t c_port;
   std::string c_addr, c_dns, s_addr, s_dns;
   std::string base_dir;
-  std::list<std::string>* indices;
+
+  // The server's open query processors.
+  QueryProcessorPool* queries;
+
+  // The server's cache of static file responses, or null.
+  StaticFileCache* file_cache;
+
+  // The server's options, for the connection's limits.
+  const HttpServerOptions* options;
+
+  // The connection to the client.  Closes client_fd when destroyed.
+  HttpConnection conn;
+
+  // The loop to return the connection to once it goes idle; exactly
+  // one of these is set, depending on how the server is running.
+  EventLoop* loop;
+  UringLoop* uring;
+
+  // The shard's connection timers, and ours, which runs while the loop
+  // owns the connection: it shuts the connection down if the client
+  // takes too long.  "awaiting_header" tells whether the timer is
+  // running the header timeout or the idle timeout.
+  TimerWheel* timers;
+  TimerWheel::Timer timer;
+  bool awaiting_header;
+
+  // The number of requests answered on the connection.
+  uint32_t num_requests;
+
+  // While the task waits for a worker: the admission controller that
+  // let it in, and when it was queued.
+  AdmissionController* admission;
+  int64_t queued_ns;
+
+  // Set when the client has closed its end of the connection; we
+  // answer whatever requests are already buffered and then close.
+  bool peer_closed;
+
+  // The request the event loop parsed to pick the task's scheduling
+  // class, if it has been neither answered nor discarded yet.
+  HttpRequest request;
+  bool has_request;
 };
 
 }  // namespace hw4
@@ -16,16 +16,20 @@
 #include <errno.h>
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string.hpp>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include "./HttpUtils.h"
@@ -212,14 +216,31 @@ int WrappedRead(int fd, unsigned char* buf, int read_len) {
   return res;
 }
 
-int WrappedWrite(int fd, const unsigned char* buf, int write_len) {
+// Sleeps until the non-blocking "fd" can take more data, for at most
+// "timeout_ms" milliseconds (-1 means forever).  Returns false on error
+// or timeout.
+static bool WaitWritable(int fd, int timeout_ms) {
+  struct pollfd pfd = { fd, POLLOUT, 0 };
+  int res = poll(&pfd, 1, timeout_ms);
+  return res > 0 || (res == -1 && errno == EINTR);
+}
+
+int WrappedWrite(int fd, const unsigned char* buf, int write_len,
+                 int timeout_ms) {
   int res, written_so_far = 0;
 
   while (written_so_far < write_len) {
     res = write(fd, buf + written_so_far, write_len - written_so_far);
     if (res == -1) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      if (errno == EINTR)
         continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // A non-blocking socket's send buffer is full; sleep until
+        // it drains rather than spinning on write().
+        if (!WaitWritable(fd, timeout_ms))
+          break;
+        continue;
+      }
       break;
     }
     if (res == 0)
@@ -229,6 +250,86 @@ int WrappedWrite(int fd, const unsigned char* buf, int write_len) {
   return written_so_far;
 }
 
+int64_t WrappedWritev(int fd, const struct iovec* iov, int iovcnt,
+                      int timeout_ms) {
+  // We advance through a private copy of the iovecs as bytes go out.
+  vector<struct iovec> rest(iov, iov + iovcnt);
+  size_t first = 0;
+  int64_t written_so_far = 0;
+
+  while (first < rest.size()) {
+    int cnt = std::min(rest.size() - first, static_cast<size_t>(IOV_MAX));
+    ssize_t res = writev(fd, &rest[first], cnt);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+          WaitWritable(fd, timeout_ms))
+        continue;
+      break;
+    }
+    if (res == 0)
+      break;
+    written_so_far += res;
+
+    // Skip the buffers that went out whole, and trim the one that
+    // was cut short.
+    size_t left = res;
+    while (first < rest.size() && left >= rest[first].iov_len) {
+      left -= rest[first].iov_len;
+      first++;
+    }
+    if (left > 0) {
+      rest[first].iov_base = static_cast<char*>(rest[first].iov_base) + left;
+      rest[first].iov_len -= left;
+    }
+  }
+  return written_so_far;
+}
+
+int WrappedSend(int fd, const unsigned char* buf, int send_len, int flags,
+                int timeout_ms) {
+  int res, sent_so_far = 0;
+
+  while (sent_so_far < send_len) {
+    res = send(fd, buf + sent_so_far, send_len - sent_so_far,
+               flags | MSG_NOSIGNAL);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+          WaitWritable(fd, timeout_ms))
+        continue;
+      break;
+    }
+    if (res == 0)
+      break;
+    sent_so_far += res;
+  }
+  return sent_so_far;
+}
+
+int64_t WrappedSendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                        int timeout_ms) {
+  int64_t sent_so_far = 0;
+
+  while (static_cast<size_t>(sent_so_far) < count) {
+    ssize_t res = sendfile(out_fd, in_fd, &offset, count - sent_so_far);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN || errno == EWOULDBLOCK) &&
+          WaitWritable(out_fd, timeout_ms))
+        continue;
+      break;
+    }
+    if (res == 0)  // the file got shorter
+      break;
+    sent_so_far += res;
+  }
+  return sent_so_far;
+}
+
 bool ConnectToServer(const string& host_name, uint16_t port_num,
                      int* client_fd) {
   struct addrinfo hints;
@@ -16,6 +16,8 @@
 #define HW4_HTTPUTILS_H_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 #include <string>
 #include <utility>
@@ -111,8 +113,36 @@ int WrappedRead(int fd, unsigned char* buf, int read_len);
 // bytes have been written, or an error is encountered.  Returns
 // the total number of bytes written; if this number is less
 // than write_len, it's because some fatal error was encountered,
-// like the connection being dropped.
-int WrappedWrite(int fd, const unsigned char* buf, int write_len);
+// like the connection being dropped.  Works on non-blocking file
+// descriptors too, by waiting in poll() whenever write() would block.
+// If "timeout_ms" isn't -1, gives up once the fd has been unable to take
+// more data for that many milliseconds, so a client that stops reading
+// can't hold us up forever.
+int WrappedWrite(int fd, const unsigned char* buf, int write_len,
+                 int timeout_ms = -1);
+
+// Like WrappedWrite(), but gathers the bytes to write from the "iovcnt"
+// buffers in "iov" with writev(), so that several buffers cost a single
+// system call.  Returns the total number of bytes written.
+int64_t WrappedWritev(int fd, const struct iovec* iov, int iovcnt,
+                      int timeout_ms = -1);
+
+// Like WrappedWrite(), but writes to the socket "fd" with send(), so
+// that the caller can pass "flags" such as MSG_MORE (which tells the
+// kernel that more data will follow right away, so it can hold back a
+// short write and send it in the same packets as what comes next).
+int WrappedSend(int fd, const unsigned char* buf, int send_len, int flags,
+                int timeout_ms = -1);
+
+// A wrapper around "sendfile" that, like WrappedWrite(), copes with
+// partial transfers, EINTR, EAGAIN and "timeout_ms".  Sends "count"
+// bytes of the file "in_fd", starting at "offset", to the socket
+// "out_fd"; the bytes go straight from the page cache to the socket,
+// without being copied into user space.  Returns the number of bytes
+// sent, which is less than "count" only on a fatal error, a timeout, or
+// if the file was truncated.
+int64_t WrappedSendfile(int out_fd, int in_fd, off_t offset, size_t count,
+                        int timeout_ms = -1);
 
 // A convenience routine to manufacture a (blocking) socket to the
 // host_name and port number provided as arguments.  Hostname can
@@ -0,0 +1,227 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_INDEXLAYOUTV2_H_
+#define HW4_INDEXLAYOUTV2_H_
+
+#include <endian.h>  // for le32toh(), htole32(), etc.
+#include <stdint.h>  // for uint32_t, etc.
+
+// This header defines version 2 of the index file format, the hw4
+// counterpart of libhw3's LayoutStructs.h.  Version 1 (LayoutStructs.h)
+// has 32-bit offsets, which cap a file at 2 GiB, and packed big-endian
+// records, which cost an unaligned load and a byte swap apiece.
+// Version 2 fixes both:
+//
+//  - every offset is a 64-bit byte offset from the start of the file;
+//  - every record is little-endian and naturally aligned: each field
+//    sits at a multiple of its own size, and every section and array
+//    starts on an 8-byte boundary; and
+//  - the header carries a version number and feature flags, and points
+//    at the file's sections through a section table, so that later
+//    versions can add sections old readers skip.
+//
+// A version 2 file looks like this:
+//
+//   IndexFileHeaderV2
+//   IndexSectionV2[num_sections]       the section table
+//   the sections, in any order:
+//     kDocTableSection     DocTableHeaderV2, DocEntryV2[num_docs]
+//                          sorted by doc_id, then the names
+//     kDictionarySection   DictionaryHeaderV2, WordEntryV2[num_words]
+//                          sorted by word (as unsigned bytes), then the
+//                          words
+//     kPostingsSection     for each word, PostingV2[num_docs] sorted by
+//                          doc_id, then the word's positions, each a
+//                          uint32_t, document by document
+//
+// With kCompressedPostingsV2, each word's postings in the postings
+// section are instead PostingBlockV2[ceil(num_docs / kPostingsPerBlock)]
+// followed by the blocks themselves, each coded as PostingsCodec.h
+// describes.  A block's base docID is the max_doc_id of the block
+// before it, or zero for the first.
+//
+// The magic number differs from version 1's, so a version 1 reader
+// rejects a version 2 file rather than misreading it.  As in version
+// 1, the header is written last, so it doubles as a commit record, and
+// its checksum covers every byte after it.
+
+namespace hw4 {
+
+// The first four bytes of a version 2 index file ("IDX2" on disk).
+static const uint32_t kIndexMagicV2 = 0x32584449;
+static const uint32_t kIndexVersion2 = 2;
+
+// Feature flags in IndexFileHeaderV2::features.  Readers refuse files
+// with flags they don't know.
+static const uint64_t kCompressedPostingsV2 = 1 << 0;
+static const uint64_t kKnownIndexFeaturesV2 = kCompressedPostingsV2;
+
+// The kinds of section.
+static const uint32_t kDocTableSection = 1;
+static const uint32_t kDictionarySection = 2;
+static const uint32_t kPostingsSection = 3;
+
+struct IndexFileHeaderV2 {
+  uint32_t magic_number;  // kIndexMagicV2
+  uint32_t version;       // kIndexVersion2
+  uint64_t features;      // feature flags
+  uint64_t file_bytes;    // the size of the whole file
+  uint32_t checksum;      // CRC32 of everything after the header
+  uint32_t num_sections;  // entries in the section table that follows
+
+  void ToDiskFormat() {
+    magic_number = htole32(magic_number);
+    version = htole32(version);
+    features = htole64(features);
+    file_bytes = htole64(file_bytes);
+    checksum = htole32(checksum);
+    num_sections = htole32(num_sections);
+  }
+  void ToHostFormat() {
+    magic_number = le32toh(magic_number);
+    version = le32toh(version);
+    features = le64toh(features);
+    file_bytes = le64toh(file_bytes);
+    checksum = le32toh(checksum);
+    num_sections = le32toh(num_sections);
+  }
+};
+
+struct IndexSectionV2 {
+  uint32_t type;      // kDocTableSection, etc.
+  uint32_t reserved;
+  uint64_t offset;    // where the section starts
+  uint64_t bytes;     // how long it is
+
+  void ToDiskFormat() {
+    type = htole32(type);
+    offset = htole64(offset);
+    bytes = htole64(bytes);
+  }
+  void ToHostFormat() {
+    type = le32toh(type);
+    offset = le64toh(offset);
+    bytes = le64toh(bytes);
+  }
+};
+
+struct DocTableHeaderV2 {
+  uint64_t num_docs;
+
+  void ToDiskFormat() { num_docs = htole64(num_docs); }
+  void ToHostFormat() { num_docs = le64toh(num_docs); }
+};
+
+struct DocEntryV2 {
+  uint64_t doc_id;
+  uint64_t name_offset;  // where the name's bytes start
+  uint32_t name_bytes;
+  uint32_t reserved;
+
+  void ToDiskFormat() {
+    doc_id = htole64(doc_id);
+    name_offset = htole64(name_offset);
+    name_bytes = htole32(name_bytes);
+  }
+  void ToHostFormat() {
+    doc_id = le64toh(doc_id);
+    name_offset = le64toh(name_offset);
+    name_bytes = le32toh(name_bytes);
+  }
+};
+
+struct DictionaryHeaderV2 {
+  uint64_t num_words;
+
+  void ToDiskFormat() { num_words = htole64(num_words); }
+  void ToHostFormat() { num_words = le64toh(num_words); }
+};
+
+struct WordEntryV2 {
+  uint64_t word_offset;      // where the word's bytes start
+  uint64_t postings_offset;  // where the word's postings start
+  uint64_t postings_bytes;   // how long they are, positions included
+  uint32_t word_bytes;
+  uint32_t num_docs;         // the number of PostingV2s
+
+  void ToDiskFormat() {
+    word_offset = htole64(word_offset);
+    postings_offset = htole64(postings_offset);
+    postings_bytes = htole64(postings_bytes);
+    word_bytes = htole32(word_bytes);
+    num_docs = htole32(num_docs);
+  }
+  void ToHostFormat() {
+    word_offset = le64toh(word_offset);
+    postings_offset = le64toh(postings_offset);
+    postings_bytes = le64toh(postings_bytes);
+    word_bytes = le32toh(word_bytes);
+    num_docs = le32toh(num_docs);
+  }
+};
+
+struct PostingV2 {
+  uint64_t doc_id;
+  uint32_t num_positions;
+  uint32_t first_position;  // index of its first position in the word's
+                            // positions array
+
+  void ToDiskFormat() {
+    doc_id = htole64(doc_id);
+    num_positions = htole32(num_positions);
+    first_position = htole32(first_position);
+  }
+  void ToHostFormat() {
+    doc_id = le64toh(doc_id);
+    num_positions = le32toh(num_positions);
+    first_position = le32toh(first_position);
+  }
+};
+
+struct PostingBlockV2 {
+  uint64_t max_doc_id;  // the docID of the block's last document
+  uint64_t offset;      // where the coded block starts, from the start
+                        // of the word's postings
+  uint32_t num_docs;
+  uint32_t bytes;       // how long the coded block is
+
+  void ToDiskFormat() {
+    max_doc_id = htole64(max_doc_id);
+    offset = htole64(offset);
+    num_docs = htole32(num_docs);
+    bytes = htole32(bytes);
+  }
+  void ToHostFormat() {
+    max_doc_id = le64toh(max_doc_id);
+    offset = le64toh(offset);
+    num_docs = le32toh(num_docs);
+    bytes = le32toh(bytes);
+  }
+};
+
+struct PositionV2 {
+  uint32_t position;
+
+  void ToDiskFormat() { position = htole32(position); }
+  void ToHostFormat() { position = le32toh(position); }
+};
+
+static_assert(sizeof(IndexFileHeaderV2) == 32, "unexpected padding");
+static_assert(sizeof(IndexSectionV2) == 24, "unexpected padding");
+static_assert(sizeof(DocEntryV2) == 24, "unexpected padding");
+static_assert(sizeof(WordEntryV2) == 32, "unexpected padding");
+static_assert(sizeof(PostingV2) == 16, "unexpected padding");
+static_assert(sizeof(PostingBlockV2) == 24, "unexpected padding");
+
+}  // namespace hw4
+
+#endif  // HW4_INDEXLAYOUTV2_H_
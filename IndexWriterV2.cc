@@ -0,0 +1,359 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdint.h>   // for uint32_t, etc.
+#include <stdio.h>    // for FILE*, fopen(), etc.
+#include <unistd.h>   // for unlink()
+#include <algorithm>  // for std::min, std::sort
+#include <list>
+#include <memory>     // for std::unique_ptr
+#include <string>
+#include <vector>
+
+#include "./IndexWriterV2.h"
+#include "./IndexLayoutV2.h"
+#include "./PostingsCodec.h"
+#include "./SharedIndexReader.h"
+#include "./libhw3/Utils.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+  #include "libhw1/HashTable.h"
+  #include "libhw1/LinkedList.h"
+}
+
+using std::list;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace hw4 {
+
+// The number of sections IndexWriterV2 writes.
+static const uint32_t kNumSectionsV2 = 3;
+
+// Returns "offset" rounded up to the next 8-byte boundary.
+static uint64_t Align8(uint64_t offset) {
+  return (offset + 7) & ~static_cast<uint64_t>(7);
+}
+
+// Appends bytes to an index file, keeping track of where it is and
+// folding everything into the file's checksum.
+class IndexOutput {
+ public:
+  // Writes to "file", starting at "offset".
+  IndexOutput(FILE* file, uint64_t offset)
+    : file_(file), offset_(offset), ok_(true) { }
+
+  // Appends the "len" bytes at "bytes".
+  void Append(const void* bytes, size_t len) {
+    if (ok_ && fwrite(bytes, 1, len, file_) != len)
+      ok_ = false;
+    const unsigned char* p = static_cast<const unsigned char*>(bytes);
+    for (size_t i = 0; i < len; i++)
+      crc_.FoldByteIntoCRC(p[i]);
+    offset_ += len;
+  }
+
+  // Appends "record", one of those in IndexLayoutV2.h, in disk order.
+  template <typename T> void AppendRecord(T record) {
+    record.ToDiskFormat();
+    Append(&record, sizeof(record));
+  }
+
+  // Appends zeros up to the next 8-byte boundary.
+  void Align() {
+    static const unsigned char kZeros[8] = { 0 };
+    Append(kZeros, Align8(offset_) - offset_);
+  }
+
+  uint64_t offset() const { return offset_; }
+  bool ok() const { return ok_; }
+  uint32_t checksum() { return crc_.GetFinalCRC(); }
+
+ private:
+  FILE* file_;
+  uint64_t offset_;
+  bool ok_;
+  hw3::CRC32 crc_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// IndexWriterV2
+///////////////////////////////////////////////////////////////////////////////
+IndexWriterV2::IndexWriterV2(uint64_t features) : features_(features) {
+  Verify333((features & ~kKnownIndexFeaturesV2) == 0);
+}
+
+void IndexWriterV2::AddDocument(DocID_t doc_id, const string& name) {
+  docs_[doc_id] = name;
+}
+
+void IndexWriterV2::AddPostings(const string& word, DocID_t doc_id,
+                                const vector<DocPositionOffset_t>& positions) {
+  words_[word].push_back(Posting{doc_id, positions});
+}
+
+// Appends "record", one of those in IndexLayoutV2.h, to "out" in disk
+// order.
+template <typename T> static void AppendRecord(T record, string* out) {
+  record.ToDiskFormat();
+  out->append(reinterpret_cast<const char*>(&record), sizeof(record));
+}
+
+void IndexWriterV2::EncodePostings(const vector<const Posting*>& postings,
+                                   string* out) const {
+  if ((features_ & kCompressedPostingsV2) == 0) {
+    // The PostingV2s, then every document's positions.
+    uint32_t first_position = 0;
+    for (const Posting* p : postings) {
+      uint32_t num_positions = p->positions.size();
+      AppendRecord(PostingV2{p->doc_id, num_positions, first_position}, out);
+      first_position += num_positions;
+    }
+    for (const Posting* p : postings) {
+      for (DocPositionOffset_t pos : p->positions)
+        AppendRecord(PositionV2{pos}, out);
+    }
+    return;
+  }
+
+  // The block headers, then the coded blocks.
+  vector<PostingBlockV2> headers;
+  string blocks;
+  uint64_t base_doc_id = 0;
+  for (size_t begin = 0; begin < postings.size();
+       begin += kPostingsPerBlock) {
+    size_t end = std::min<size_t>(begin + kPostingsPerBlock,
+                                  postings.size());
+    PostingBlock block;
+    for (size_t i = begin; i < end; i++) {
+      block.doc_ids.push_back(postings[i]->doc_id);
+      block.num_positions.push_back(postings[i]->positions.size());
+      block.positions.insert(block.positions.end(),
+                             postings[i]->positions.begin(),
+                             postings[i]->positions.end());
+    }
+    size_t offset = blocks.size();
+    EncodePostingBlock(block, base_doc_id, &blocks);
+    headers.push_back(PostingBlockV2{block.doc_ids.back(), offset,
+                                     static_cast<uint32_t>(end - begin),
+                                     static_cast<uint32_t>(blocks.size() -
+                                                           offset)});
+    base_doc_id = block.doc_ids.back();
+  }
+  uint64_t headers_bytes = headers.size() * sizeof(PostingBlockV2);
+  for (PostingBlockV2& header : headers) {
+    header.offset += headers_bytes;
+    AppendRecord(header, out);
+  }
+  out->append(blocks);
+}
+
+int64_t IndexWriterV2::Write(const string& file_name) const {
+  // Code every word's postings first, in docID order, since the
+  // dictionary, which comes before them, says where each word's start
+  // and how long they are.
+  vector<string> encoded;
+  bool ok = true;
+  for (const auto& word : words_) {
+    vector<const Posting*> postings;
+    uint64_t num_positions = 0;
+    for (const Posting& p : word.second) {
+      postings.push_back(&p);
+      num_positions += p.positions.size();
+    }
+    if (num_positions > UINT32_MAX || word.second.size() > UINT32_MAX)
+      ok = false;
+    std::sort(postings.begin(), postings.end(),
+              [](const Posting* a, const Posting* b) {
+                return a->doc_id < b->doc_id;
+              });
+    encoded.emplace_back();
+    EncodePostings(postings, &encoded.back());
+  }
+
+  // Lay out the sections: the doctable, the dictionary and then the
+  // postings, each starting on an 8-byte boundary, as does each word's
+  // postings.
+  uint64_t doctable = Align8(sizeof(IndexFileHeaderV2) +
+                             kNumSectionsV2 * sizeof(IndexSectionV2));
+  uint64_t names = doctable + sizeof(DocTableHeaderV2) +
+                   docs_.size() * sizeof(DocEntryV2);
+  for (const auto& doc : docs_)
+    names += doc.second.length();
+  uint64_t dictionary = Align8(names);
+  uint64_t words = dictionary + sizeof(DictionaryHeaderV2) +
+                   words_.size() * sizeof(WordEntryV2);
+  for (const auto& word : words_)
+    words += word.first.length();
+  uint64_t postings = Align8(words);
+  uint64_t postings_end = postings;
+  for (const string& e : encoded)
+    postings_end += Align8(e.length());
+
+  FILE* f = fopen(file_name.c_str(), "wb");
+  if (f == nullptr)
+    return -1;
+
+  // Leave room for the header, which we write last, once we know the
+  // checksum.
+  IndexFileHeaderV2 header = { 0 };
+  ok = ok && fwrite(&header, sizeof(header), 1, f) == 1;
+  IndexOutput out(f, sizeof(header));
+
+  // The section table.  Each section runs up to the next.
+  const uint64_t kStarts[kNumSectionsV2 + 1] = {
+    doctable, dictionary, postings, postings_end
+  };
+  const uint32_t kTypes[kNumSectionsV2] = {
+    kDocTableSection, kDictionarySection, kPostingsSection
+  };
+  for (uint32_t i = 0; i < kNumSectionsV2; i++) {
+    out.AppendRecord(IndexSectionV2{kTypes[i], 0, kStarts[i],
+                                    kStarts[i + 1] - kStarts[i]});
+  }
+  out.Align();
+
+  // The doctable: the entries, then the names they point at.
+  out.AppendRecord(DocTableHeaderV2{docs_.size()});
+  uint64_t name_offset = out.offset() + docs_.size() * sizeof(DocEntryV2);
+  for (const auto& doc : docs_) {
+    out.AppendRecord(DocEntryV2{doc.first, name_offset,
+                                static_cast<uint32_t>(doc.second.length()),
+                                0});
+    name_offset += doc.second.length();
+  }
+  for (const auto& doc : docs_)
+    out.Append(doc.second.data(), doc.second.length());
+  out.Align();
+
+  // The dictionary: the entries, then the words they point at.
+  out.AppendRecord(DictionaryHeaderV2{words_.size()});
+  uint64_t word_offset = out.offset() + words_.size() * sizeof(WordEntryV2);
+  uint64_t postings_offset = postings;
+  size_t i = 0;
+  for (const auto& word : words_) {
+    out.AppendRecord(WordEntryV2{word_offset, postings_offset,
+                                 encoded[i].length(),
+                                 static_cast<uint32_t>(word.first.length()),
+                                 static_cast<uint32_t>(word.second.size())});
+    word_offset += word.first.length();
+    postings_offset += Align8(encoded[i].length());
+    i++;
+  }
+  for (const auto& word : words_)
+    out.Append(word.first.data(), word.first.length());
+  out.Align();
+
+  // The postings.
+  for (const string& e : encoded) {
+    out.Append(e.data(), e.length());
+    out.Align();
+  }
+  Verify333(out.offset() == postings_end);
+
+  // Now the header, which commits the file.
+  header.magic_number = kIndexMagicV2;
+  header.version = kIndexVersion2;
+  header.features = features_;
+  header.file_bytes = out.offset();
+  header.checksum = out.checksum();
+  header.num_sections = kNumSectionsV2;
+  header.ToDiskFormat();
+  ok = ok && out.ok() && fseek(f, 0, SEEK_SET) == 0 &&
+       fwrite(&header, sizeof(header), 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    unlink(file_name.c_str());
+    return -1;
+  }
+  return out.offset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// WriteIndexV2 and ConvertIndexToV2
+///////////////////////////////////////////////////////////////////////////////
+int64_t WriteIndexV2(MemIndex* mi, DocTable* dt, const char* file_name,
+                     uint64_t features) {
+  IndexWriterV2 writer(features);
+
+  // The doctable's id-->name table maps each docID to its name.
+  HTIterator* it = HTIterator_Allocate(DT_GetIDToNameTable(dt));
+  for (; HTIterator_IsValid(it); HTIterator_Next(it)) {
+    HTKeyValue_t kv;
+    HTIterator_Get(it, &kv);
+    writer.AddDocument(kv.key, static_cast<char*>(kv.value));
+  }
+  HTIterator_Free(it);
+
+  // Each MemIndex value is a WordPostings, whose postings map each
+  // docID to the list of the word's positions in it.
+  it = HTIterator_Allocate(mi);
+  for (; HTIterator_IsValid(it); HTIterator_Next(it)) {
+    HTKeyValue_t kv;
+    HTIterator_Get(it, &kv);
+    WordPostings* wp = static_cast<WordPostings*>(kv.value);
+
+    HTIterator* pit = HTIterator_Allocate(wp->postings);
+    for (; HTIterator_IsValid(pit); HTIterator_Next(pit)) {
+      HTKeyValue_t posting;
+      HTIterator_Get(pit, &posting);
+      vector<DocPositionOffset_t> positions;
+      LLIterator* lit =
+        LLIterator_Allocate(static_cast<LinkedList*>(posting.value));
+      for (; LLIterator_IsValid(lit); LLIterator_Next(lit)) {
+        LLPayload_t payload;
+        LLIterator_Get(lit, &payload);
+        positions.push_back(reinterpret_cast<intptr_t>(payload));
+      }
+      LLIterator_Free(lit);
+      writer.AddPostings(wp->word, posting.key, positions);
+    }
+    HTIterator_Free(pit);
+  }
+  HTIterator_Free(it);
+
+  return writer.Write(file_name);
+}
+
+int64_t ConvertIndexToV2(const string& in_file, const string& out_file,
+                         uint64_t features) {
+  SharedIndexReader reader;
+  if (!reader.Open(in_file, SharedIndexReader::kMmap))
+    return -1;
+  unique_ptr<SharedDocTableReader> dtr(reader.NewDocTableReader());
+  unique_ptr<SharedIndexTableReader> itr(reader.NewIndexTableReader());
+
+  IndexWriterV2 writer(features);
+  for (DocID_t doc_id : dtr->GetDocIDList()) {
+    string name;
+    if (!dtr->LookupDocID(doc_id, &name))
+      return -1;
+    writer.AddDocument(doc_id, name);
+  }
+  for (const string& word : itr->GetWordList()) {
+    unique_ptr<SharedDocIDTableReader> ditr(itr->LookupWord(word));
+    if (ditr == nullptr)
+      return -1;
+    for (const hw3::DocIDElementHeader& doc : ditr->GetDocIDList()) {
+      list<DocPositionOffset_t> positions;
+      if (!ditr->LookupDocID(doc.doc_id, &positions))
+        return -1;
+      writer.AddPostings(word, doc.doc_id,
+                         vector<DocPositionOffset_t>(positions.begin(),
+                                                     positions.end()));
+    }
+  }
+  return writer.Write(out_file);
+}
+
+}  // namespace hw4
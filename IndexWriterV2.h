@@ -0,0 +1,94 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_INDEXWRITERV2_H_
+#define HW4_INDEXWRITERV2_H_
+
+#include <stdint.h>  // for int64_t, etc.
+#include <map>       // for std::map
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+extern "C" {
+  #include "libhw2/DocTable.h"
+  #include "libhw2/MemIndex.h"
+}
+
+namespace hw4 {
+
+// An IndexWriterV2 gathers the documents and postings of an index, in
+// any order, and writes them out as a version 2 index file (see
+// IndexLayoutV2.h): the counterpart of libhw3's WriteIndex() for the
+// new format.
+//
+// The whole index is held in memory until Write() is called, since
+// every table of a version 2 file is sorted.
+class IndexWriterV2 {
+ public:
+  // Creates a writer for a file with the feature flags "features" (see
+  // IndexLayoutV2.h): kCompressedPostingsV2, to compress the postings,
+  // or zero.
+  explicit IndexWriterV2(uint64_t features = 0);
+  virtual ~IndexWriterV2() { }
+
+  // Adds the document "doc_id", whose file name is "name".
+  void AddDocument(DocID_t doc_id, const std::string& name);
+
+  // Records that "word" appears in document "doc_id" at "positions".
+  // Call it at most once for each word and document.
+  void AddPostings(const std::string& word, DocID_t doc_id,
+                   const std::vector<DocPositionOffset_t>& positions);
+
+  // Writes the index to the file "file_name", replacing it.  Returns
+  // the size of the file, in bytes, or a negative value on error.
+  int64_t Write(const std::string& file_name) const;
+
+ private:
+  // The documents a word appears in, and where.
+  struct Posting {
+    DocID_t doc_id;
+    std::vector<DocPositionOffset_t> positions;
+  };
+
+  // Appends the postings of a word, "postings", in docID order, to
+  // "out", coded as the file's features say.
+  void EncodePostings(const std::vector<const Posting*>& postings,
+                      std::string* out) const;
+
+  uint64_t features_;
+
+  // std::map keeps both tables sorted, words as unsigned bytes.
+  std::map<DocID_t, std::string> docs_;
+  std::map<std::string, std::vector<Posting>> words_;
+};
+
+// Writes the contents of a MemIndex and the docid_to_docname mapping of
+// a DocTable into a version 2 index file, as hw3::WriteIndex() does for
+// version 1.  "features" are the file's feature flags, as for
+// IndexWriterV2.
+//
+// Returns the size of the index file, in bytes, or a negative value on
+// error.
+int64_t WriteIndexV2(MemIndex* mi, DocTable* dt, const char* file_name,
+                     uint64_t features = 0);
+
+// Rewrites the index file "in_file", of either version, as the version
+// 2 index file "out_file", with the feature flags "features".
+//
+// Returns the size of the new file, in bytes, or a negative value on
+// error (including "in_file" not being a valid index file).
+int64_t ConvertIndexToV2(const std::string& in_file,
+                         const std::string& out_file,
+                         uint64_t features = 0);
+
+}  // namespace hw4
+
+#endif  // HW4_INDEXWRITERV2_H_
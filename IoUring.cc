@@ -0,0 +1,532 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <errno.h>         // for errno, EINVAL, etc.
+#include <stdlib.h>        // for calloc(), free()
+#include <string.h>        // for memset()
+#include <unistd.h>        // for syscall(), close()
+#include <sys/mman.h>      // for mmap(), munmap()
+#include <sys/socket.h>    // for SOCK_CLOEXEC, shutdown()
+#include <sys/syscall.h>   // for __NR_io_uring_setup, etc.
+#include <vector>
+
+#include "./IoUring.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::vector;
+
+namespace hw4 {
+
+// The user_data tag of the accept operation; reads use slot + 1.
+static const uint64_t kAcceptTag = 0;
+
+// Submission queue size of the server's ring.  Every idle client has a
+// read outstanding, but outstanding operations don't occupy submission
+// slots, so this only bounds how many we can queue between submits.
+static const uint32_t kLoopEntries = 256;
+
+// The number and size of the registered read buffers.
+static const int kNumFixedSlots = 256;
+static const int kSlotSize = 16384;
+
+// Submission queue size of each thread's write ring.
+static const uint32_t kWriteEntries = 64;
+
+///////////////////////////////////////////////////////////////////////////////
+// IoUring
+///////////////////////////////////////////////////////////////////////////////
+IoUring::IoUring()
+  : ring_fd_(-1), sq_entries_(0), features_(0),
+    sq_ring_(MAP_FAILED), sq_ring_len_(0),
+    cq_ring_(MAP_FAILED), cq_ring_len_(0),
+    sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_len_(0),
+    sq_head_(nullptr), sq_tail_(nullptr), sq_mask_(nullptr),
+    cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(nullptr),
+    cqes_(nullptr), sqe_tail_(0) { }
+
+IoUring::~IoUring() {
+  Close();
+}
+
+void IoUring::Close() {
+  if (sqes_ != MAP_FAILED)
+    munmap(sqes_, sqes_len_);
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    munmap(cq_ring_, cq_ring_len_);
+  if (sq_ring_ != MAP_FAILED)
+    munmap(sq_ring_, sq_ring_len_);
+  sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  sq_ring_ = cq_ring_ = MAP_FAILED;
+  if (ring_fd_ != -1)
+    close(ring_fd_);
+  ring_fd_ = -1;
+}
+
+bool IoUring::Initialize(uint32_t entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+    return false;
+  ring_fd_ = fd;
+  sq_entries_ = params.sq_entries;
+  features_ = params.features;
+
+  // Map the submission and completion rings.  Newer kernels put both
+  // in a single mapping.
+  sq_ring_len_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  cq_ring_len_ = params.cq_off.cqes +
+                 params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    if (cq_ring_len_ > sq_ring_len_)
+      sq_ring_len_ = cq_ring_len_;
+    cq_ring_len_ = sq_ring_len_;
+  }
+  sq_ring_ = mmap(nullptr, sq_ring_len_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    Close();
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_len_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      Close();
+      return false;
+    }
+  }
+  sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(
+      mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED) {
+    Close();
+    return false;
+  }
+
+  char* sq = static_cast<char*>(sq_ring_);
+  char* cq = static_cast<char*>(cq_ring_);
+  sq_head_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  cq_head_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  // We always fill submission entries in ring order, so the index
+  // array is just the identity mapping.
+  uint32_t* array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+  for (uint32_t i = 0; i < params.sq_entries; i++)
+    array[i] = i;
+  sqe_tail_ = *sq_tail_;
+
+  // Ask the kernel which operations it supports.
+  supported_ops_.assign(IORING_OP_LAST, false);
+  size_t probe_len = sizeof(struct io_uring_probe) +
+                     IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe* probe =
+    static_cast<struct io_uring_probe*>(calloc(1, probe_len));
+  Verify333(probe != nullptr);
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+              probe, IORING_OP_LAST) == 0) {
+    for (int i = 0; i < probe->ops_len && i < IORING_OP_LAST; i++) {
+      if (probe->ops[i].flags & IO_URING_OP_SUPPORTED)
+        supported_ops_[probe->ops[i].op] = true;
+    }
+  }
+  free(probe);
+  return true;
+}
+
+bool IoUring::SupportsOp(uint8_t op) const {
+  return op < supported_ops_.size() && supported_ops_[op];
+}
+
+struct io_uring_sqe* IoUring::GetSqe() {
+  uint32_t head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_)
+    return nullptr;
+  struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & *sq_mask_];
+  sqe_tail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int IoUring::Submit(uint32_t wait_nr) {
+  uint32_t to_submit = sqe_tail_ - *sq_tail_;
+  if (to_submit == 0 && wait_nr == 0)
+    return 0;
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+  int res = syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr,
+                    wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+  return res < 0 ? -errno : res;
+}
+
+int IoUring::Wait(uint32_t wait_nr, int timeout_ms) {
+  if (PeekCqe() != nullptr)
+    return 0;
+  int res;
+  if (timeout_ms >= 0) {
+    if (!HasFeature(IORING_FEAT_EXT_ARG))
+      return -EINVAL;
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = static_cast<int64_t>(timeout_ms % 1000) * 1000000;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    res = syscall(__NR_io_uring_enter, ring_fd_, 0, wait_nr,
+                  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                  &arg, sizeof(arg));
+  } else {
+    res = syscall(__NR_io_uring_enter, ring_fd_, 0, wait_nr,
+                  IORING_ENTER_GETEVENTS, nullptr, 0);
+  }
+  return res < 0 ? -errno : 0;
+}
+
+struct io_uring_cqe* IoUring::PeekCqe() {
+  uint32_t head = *cq_head_;
+  uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  if (head == tail)
+    return nullptr;
+  return &cqes_[head & *cq_mask_];
+}
+
+void IoUring::SeenCqe() {
+  __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
+
+bool IoUring::RegisterBuffers(const struct iovec* iovs, uint32_t num) {
+  return syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                 iovs, num) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// UringLoop
+///////////////////////////////////////////////////////////////////////////////
+UringLoop::UringLoop()
+  : listen_fd_(-1), multishot_(true), waiter_(pthread_self()),
+    fixed_bufs_(nullptr) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+}
+
+UringLoop::~UringLoop() {
+  // Tear down the ring first so the kernel stops using our buffers.
+  ring_.Close();
+  for (size_t i = 0; i < slots_.size(); i++) {
+    if (!slots_[i].fixed)
+      delete[] slots_[i].buf;
+  }
+  delete[] fixed_bufs_;
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+bool UringLoop::Initialize() {
+  if (!ring_.Initialize(kLoopEntries))
+    return false;
+  if (!ring_.SupportsOp(IORING_OP_ACCEPT) ||
+      !ring_.SupportsOp(IORING_OP_READ) ||
+      !ring_.SupportsOp(IORING_OP_READ_FIXED) ||
+      !ring_.HasFeature(IORING_FEAT_EXT_ARG)) {
+    ring_.Close();
+    return false;
+  }
+
+  // Carve the registered buffers out of one allocation.
+  fixed_bufs_ = new unsigned char[kNumFixedSlots * kSlotSize];
+  vector<struct iovec> iovs(kNumFixedSlots);
+  for (int i = 0; i < kNumFixedSlots; i++) {
+    iovs[i].iov_base = fixed_bufs_ + i * kSlotSize;
+    iovs[i].iov_len = kSlotSize;
+    slots_.push_back({fixed_bufs_ + i * kSlotSize, nullptr, true});
+  }
+  if (!ring_.RegisterBuffers(iovs.data(), kNumFixedSlots)) {
+    ring_.Close();
+    return false;
+  }
+  // Hand out low-numbered slots first.
+  for (int i = kNumFixedSlots - 1; i >= 0; i--)
+    free_fixed_.push_back(i);
+  return true;
+}
+
+bool UringLoop::StartAccept(int listen_fd) {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  listen_fd_ = listen_fd;
+  bool ok = QueueAccept() && ring_.Submit(0) >= 0;
+
+  // Kernels older than 5.19 reject IORING_ACCEPT_MULTISHOT right away;
+  // on those we fall back to re-issuing a single-shot accept after
+  // every connection.
+  struct io_uring_cqe* cqe = ring_.PeekCqe();
+  if (ok && cqe != nullptr && cqe->user_data == kAcceptTag &&
+      cqe->res == -EINVAL) {
+    ring_.SeenCqe();
+    multishot_ = false;
+    ok = QueueAccept() && ring_.Submit(0) >= 0;
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return ok;
+}
+
+bool UringLoop::QueueAccept() {
+  struct io_uring_sqe* sqe = ring_.GetSqe();
+  if (sqe == nullptr) {
+    ring_.Submit(0);
+    if ((sqe = ring_.GetSqe()) == nullptr)
+      return false;
+  }
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->ioprio = multishot_ ? IORING_ACCEPT_MULTISHOT : 0;
+  sqe->user_data = kAcceptTag;
+  return true;
+}
+
+int UringLoop::GetSlot() {
+  int slot;
+  if (!free_fixed_.empty()) {
+    slot = free_fixed_.back();
+    free_fixed_.pop_back();
+  } else if (!free_heap_.empty()) {
+    slot = free_heap_.back();
+    free_heap_.pop_back();
+  } else {
+    slot = slots_.size();
+    slots_.push_back({new unsigned char[kSlotSize], nullptr, false});
+  }
+  return slot;
+}
+
+bool UringLoop::Read(int fd, void* data) {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  struct io_uring_sqe* sqe = ring_.GetSqe();
+  if (sqe == nullptr) {
+    ring_.Submit(0);
+    sqe = ring_.GetSqe();
+  }
+  if (sqe == nullptr) {
+    Verify333(pthread_mutex_unlock(&lock_) == 0);
+    return false;
+  }
+
+  int slot = GetSlot();
+  Slot& s = slots_[slot];
+  s.data = data;
+  sqe->opcode = s.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(s.buf);
+  sqe->len = kSlotSize;
+  sqe->off = static_cast<uint64_t>(-1);  // i.e., the current position
+  if (s.fixed)
+    sqe->buf_index = slot;
+  sqe->user_data = slot + 1;
+
+  // Reads queued by the loop thread itself go out with its next Wait();
+  // anybody else has to submit now, as the loop may be asleep.
+  bool ok = true;
+  if (!pthread_equal(pthread_self(), waiter_))
+    ok = ring_.Submit(0) >= 0;
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return ok;
+}
+
+void UringLoop::ReleaseBuffer(int slot) {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  slots_[slot].data = nullptr;
+  if (slots_[slot].fixed) {
+    free_fixed_.push_back(slot);
+  } else {
+    free_heap_.push_back(slot);
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+}
+
+int UringLoop::Wait(Event* events, int max_events, int timeout_ms) {
+  // Flush anything we queued while handling the last batch, then sleep
+  // until something completes.
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  waiter_ = pthread_self();
+  int res = ring_.Submit(0);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  if (res >= 0)
+    res = ring_.Wait(1, timeout_ms);
+  if (res == -ETIME)
+    return 0;
+  if (res < 0) {
+    errno = -res;
+    return -1;
+  }
+
+  int num_events = 0;
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  struct io_uring_cqe* cqe;
+  while (num_events < max_events && (cqe = ring_.PeekCqe()) != nullptr) {
+    uint64_t tag = cqe->user_data;
+    int cqe_res = cqe->res;
+    uint32_t flags = cqe->flags;
+    ring_.SeenCqe();
+
+    if (tag == kAcceptTag) {
+      // A multishot accept stays armed as long as the kernel sets
+      // IORING_CQE_F_MORE; otherwise we have to issue a new one.
+      if (!(flags & IORING_CQE_F_MORE))
+        QueueAccept();
+      if (cqe_res < 0)
+        continue;
+      events[num_events++] = { nullptr, cqe_res, nullptr, -1 };
+    } else {
+      int slot = static_cast<int>(tag - 1);
+      events[num_events++] =
+        { slots_[slot].data, cqe_res, slots_[slot].buf, slot };
+    }
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return num_events;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Linked writes
+///////////////////////////////////////////////////////////////////////////////
+
+// Each worker thread lazily sets up its own ring for writes, so that
+// writers never contend with each other or with the server's loop.
+static thread_local IoUring t_write_ring;
+static thread_local bool t_write_ring_failed = false;
+
+// Gives up on a linked write once the ring itself has returned an
+// error.  The socket is shut down so that whatever is still in flight
+// fails promptly, and the "outstanding" completions are reaped.  If that
+// is impossible, or if "stranded" is set because the kernel never took
+// some of the queued entries, the ring is torn down instead, so that no
+// stale entry or completion can leak into the next call on this thread.
+static void AbandonLinkedWrite(int fd, uint32_t outstanding,
+                               bool stranded) {
+  shutdown(fd, SHUT_RDWR);
+  while (!stranded && outstanding > 0) {
+    if (t_write_ring.PeekCqe() != nullptr) {
+      t_write_ring.SeenCqe();
+      outstanding--;
+      continue;
+    }
+    int wres = t_write_ring.Wait(1, -1);
+    if (wres < 0 && wres != -EINTR)
+      stranded = true;
+  }
+  if (stranded) {
+    t_write_ring.Close();
+    t_write_ring_failed = true;
+  }
+}
+
+bool UringLinkedWrite(int fd, const struct iovec* iov, int iovcnt,
+                      int* written, int timeout_ms) {
+  if (!t_write_ring.initialized()) {
+    if (t_write_ring_failed)
+      return false;
+    if (!t_write_ring.Initialize(kWriteEntries) ||
+        !t_write_ring.SupportsOp(IORING_OP_WRITE) ||
+        !t_write_ring.HasFeature(IORING_FEAT_EXT_ARG)) {
+      t_write_ring.Close();
+      t_write_ring_failed = true;
+      return false;
+    }
+  }
+
+  // We advance through a private copy of the iovecs as bytes go out.
+  vector<struct iovec> rest(iov, iov + iovcnt);
+  size_t first = 0;
+  *written = 0;
+  while (first < rest.size()) {
+    // Queue as much of the remainder as fits, each write linked to the
+    // next so that the kernel issues them in order.  A short write
+    // breaks the chain, and we pick up where it stopped.
+    uint32_t queued = 0;
+    struct io_uring_sqe* last = nullptr;
+    for (size_t i = first; i < rest.size(); i++) {
+      if (rest[i].iov_len == 0)
+        continue;
+      struct io_uring_sqe* sqe = t_write_ring.GetSqe();
+      if (sqe == nullptr)
+        break;
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>(rest[i].iov_base);
+      sqe->len = rest[i].iov_len;
+      sqe->off = static_cast<uint64_t>(-1);
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->user_data = i;
+      last = sqe;
+      queued++;
+    }
+    if (last == nullptr)
+      break;
+    last->flags = 0;
+
+    // Without a timeout, we can wait for the whole chain as we submit
+    // it; with one, we have to wait for completions one at a time.
+    // The sq tail is already published, so entries the kernel did not
+    // take here cannot be resubmitted in order; give up on the ring.
+    int res = t_write_ring.Submit(timeout_ms < 0 ? queued : 0);
+    if (res != static_cast<int>(queued)) {
+      AbandonLinkedWrite(fd, 0, true);
+      return true;
+    }
+
+    // Reap every completion, even after a failure, so the ring is
+    // clean for the next call.
+    bool failed = false;
+    for (uint32_t done = 0; done < queued; done++) {
+      struct io_uring_cqe* cqe;
+      while ((cqe = t_write_ring.PeekCqe()) == nullptr) {
+        int wres = t_write_ring.Wait(1, failed ? -1 : timeout_ms);
+        if (wres == -ETIME) {
+          // The client has stopped reading.  Shut the socket down so
+          // that the writes still in flight fail, and reap them.
+          shutdown(fd, SHUT_RDWR);
+          failed = true;
+        } else if (wres < 0 && wres != -EINTR) {
+          AbandonLinkedWrite(fd, queued - done, false);
+          return true;
+        }
+      }
+      size_t i = cqe->user_data;
+      int cqe_res = cqe->res;
+      t_write_ring.SeenCqe();
+      if (cqe_res > 0) {
+        rest[i].iov_base = static_cast<char*>(rest[i].iov_base) + cqe_res;
+        rest[i].iov_len -= cqe_res;
+        *written += cqe_res;
+      } else if (cqe_res == 0 ||
+                 (cqe_res != -ECANCELED && cqe_res != -EINTR &&
+                  cqe_res != -EAGAIN)) {
+        failed = true;
+      }
+    }
+    if (failed)
+      return true;
+    while (first < rest.size() && rest[first].iov_len == 0)
+      first++;
+  }
+  return true;
+}
+
+}  // namespace hw4
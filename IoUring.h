@@ -0,0 +1,213 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_IOURING_H_
+#define HW4_IOURING_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <stdint.h>          // for uint32_t, etc.
+#include <sys/uio.h>         // for struct iovec
+#include <linux/io_uring.h>  // for io_uring_sqe, io_uring_cqe, etc.
+#include <vector>            // for std::vector
+
+namespace hw4 {
+
+// An IoUring is a minimal wrapper around a Linux io_uring instance,
+// talking to the kernel through the raw system calls so that we don't
+// depend on liburing.  Customers grab submission queue entries with
+// GetSqe(), fill them in, and hand them to the kernel with Submit();
+// completions are read back with PeekCqe() and SeenCqe().
+//
+// An IoUring is not thread-safe; callers that share one must
+// serialize GetSqe()/Submit() themselves.  Wait() and the completion
+// functions may run on one other thread concurrently with submission.
+class IoUring {
+ public:
+  IoUring();
+  virtual ~IoUring();
+
+  // Creates the ring with room for "entries" submissions.  Returns
+  // false if the kernel doesn't support io_uring (or it is disabled).
+  bool Initialize(uint32_t entries);
+
+  // Returns true if Initialize() succeeded.
+  bool initialized() const { return ring_fd_ != -1; }
+
+  // Unmaps and closes the ring, cancelling anything still in flight.
+  // Called by the destructor; safe to call more than once.
+  void Close();
+
+  // Returns true if the kernel supports the given IORING_OP_* opcode.
+  bool SupportsOp(uint8_t op) const;
+
+  // Returns true if the kernel reported the given IORING_FEAT_* feature.
+  bool HasFeature(uint32_t feature) const {
+    return (features_ & feature) != 0;
+  }
+
+  // Returns a zeroed submission queue entry, or nullptr if the
+  // submission queue is full.
+  struct io_uring_sqe* GetSqe();
+
+  // Hands every entry obtained through GetSqe() since the last call to
+  // the kernel, and waits until at least "wait_nr" completions are
+  // available.  Returns the number of entries submitted, or -errno.
+  int Submit(uint32_t wait_nr);
+
+  // Waits until at least "wait_nr" completions are available without
+  // submitting anything.  Returns 0 on success, or -errno.  If
+  // "timeout_ms" isn't -1, gives up after that many milliseconds and
+  // returns -ETIME; that needs IORING_FEAT_EXT_ARG.
+  int Wait(uint32_t wait_nr, int timeout_ms = -1);
+
+  // Returns the oldest unconsumed completion, or nullptr if there is
+  // none.  The entry stays valid until SeenCqe() is called.
+  struct io_uring_cqe* PeekCqe();
+
+  // Marks the completion returned by PeekCqe() as consumed.
+  void SeenCqe();
+
+  // Registers "num" buffers with the kernel for IORING_OP_READ_FIXED
+  // and IORING_OP_WRITE_FIXED.  Returns true on success.
+  bool RegisterBuffers(const struct iovec* iovs, uint32_t num);
+
+ private:
+  int ring_fd_;
+  uint32_t sq_entries_;
+  uint32_t features_;
+
+  // The shared memory regions, as mmap()'ed from the ring fd.
+  void* sq_ring_;
+  size_t sq_ring_len_;
+  void* cq_ring_;
+  size_t cq_ring_len_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_len_;
+
+  // Pointers into the shared regions.
+  uint32_t* sq_head_;
+  uint32_t* sq_tail_;
+  uint32_t* sq_mask_;
+  uint32_t* cq_head_;
+  uint32_t* cq_tail_;
+  uint32_t* cq_mask_;
+  struct io_uring_cqe* cqes_;
+
+  // The tail of the entries we've handed out but not yet submitted.
+  uint32_t sqe_tail_;
+
+  // The opcodes the kernel reported as supported.
+  std::vector<bool> supported_ops_;
+};
+
+// A UringLoop is the io_uring counterpart of EventLoop.  Rather than
+// waiting for sockets to become readable, it keeps a multishot accept
+// outstanding on the listening socket and a read outstanding on every
+// idle client, and reports the results.  Reads land in a pool of
+// buffers registered with the kernel (IORING_OP_READ_FIXED); once those
+// are all in use, reads fall back to plain heap buffers.
+//
+// One thread calls Wait() to collect completions.  Read() and
+// ReleaseBuffer() may be called from any thread.
+class UringLoop {
+ public:
+  // A completed operation, as reported by Wait().
+  struct Event {
+    void* data;                // the Read() data, or nullptr for an accept
+    int res;                   // the accepted fd, bytes read, or -errno
+    const unsigned char* buf;  // the bytes read (reads only)
+    int slot;                  // pass to ReleaseBuffer() when done (reads)
+  };
+
+  UringLoop();
+  virtual ~UringLoop();
+
+  // Sets up the ring and registers the read buffers.  Returns false if
+  // the kernel lacks any of the io_uring features we need, in which
+  // case the customer should fall back to an EventLoop.
+  bool Initialize();
+
+  // Starts a multishot accept on "listen_fd" (or, on kernels without
+  // multishot accept, a single-shot accept that is re-issued after every
+  // connection).  Each accepted socket is reported as an Event with a
+  // null data pointer.  Returns false on failure.
+  bool StartAccept(int listen_fd);
+
+  // Queues a read on "fd".  When it completes, Wait() reports an Event
+  // carrying "data".  Safe to call from any thread.  Returns true on
+  // success.
+  bool Read(int fd, void* data);
+
+  // Returns the buffer of a completed read to the pool.  Safe to call
+  // from any thread.
+  void ReleaseBuffer(int slot);
+
+  // Blocks until at least one operation completes, or for at most
+  // "timeout_ms" milliseconds (-1 means forever), then stores at most
+  // "max_events" completions in "events".  Returns the number stored
+  // (zero if we timed out), or -1 on error (including EINTR).
+  int Wait(Event* events, int max_events, int timeout_ms = -1);
+
+ private:
+  // A read buffer.  The first kNumFixedSlots slots are registered with
+  // the kernel; any beyond that are plain heap buffers.
+  struct Slot {
+    unsigned char* buf;
+    void* data;
+    bool fixed;
+  };
+
+  // Submits the multishot accept; the caller must hold lock_.
+  bool QueueAccept();
+
+  // Returns a free slot index, growing the pool if needed; the caller
+  // must hold lock_.
+  int GetSlot();
+
+  IoUring ring_;
+  int listen_fd_;
+
+  // Whether the kernel accepted IORING_ACCEPT_MULTISHOT.
+  bool multishot_;
+
+  // The thread that calls Wait().  Reads it queues are submitted
+  // together at the top of its next Wait().
+  pthread_t waiter_;
+
+  // Guards ring_ submissions and the slot pool.
+  pthread_mutex_t lock_;
+  std::vector<Slot> slots_;
+  std::vector<int> free_fixed_;
+  std::vector<int> free_heap_;
+  unsigned char* fixed_bufs_;
+};
+
+// Writes the "iovcnt" buffers in "iov" to "fd" as a chain of linked
+// io_uring writes, using a ring private to the calling thread, so the
+// whole response costs a single system call.  Blocks until everything
+// is written or an error occurs, and returns the bytes written through
+// "written".
+//
+// If "timeout_ms" isn't -1, gives up (shutting "fd" down, so that
+// writes still in flight fail) once no write has completed for that
+// many milliseconds.
+//
+// Returns false without writing anything if io_uring isn't available
+// on this thread, in which case the caller should use WrappedWrite().
+bool UringLinkedWrite(int fd, const struct iovec* iov, int iovcnt,
+                      int* written, int timeout_ms = -1);
+
+}  // namespace hw4
+
+#endif  // HW4_IOURING_H_
@@ -0,0 +1,149 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <endian.h>  // for htole64(), le64toh()
+#include <string.h>  // for memcpy()
+#include <string>
+#include <vector>
+
+#include "./PostingsCodec.h"
+
+using std::string;
+using std::vector;
+
+namespace hw4 {
+
+// Returns the two-bit length code of "value": 0, 1, 2 or 3 for 1, 2, 4
+// or 8 bytes.
+static uint32_t LengthCode(uint64_t value) {
+  if (value < (UINT64_C(1) << 8))
+    return 0;
+  if (value < (UINT64_C(1) << 16))
+    return 1;
+  if (value < (UINT64_C(1) << 32))
+    return 2;
+  return 3;
+}
+
+void EncodeStream(const uint64_t* values, size_t n, string* out) {
+  // Make room for the control bytes, and fill them in as the data
+  // bytes go out after them.
+  size_t control = out->size();
+  out->append((n + 3) / 4, '\0');
+  for (size_t i = 0; i < n; i++) {
+    uint32_t code = LengthCode(values[i]);
+    (*out)[control + i / 4] |= static_cast<char>(code << (2 * (i % 4)));
+    uint64_t le = htole64(values[i]);
+    out->append(reinterpret_cast<const char*>(&le), 1 << code);
+  }
+}
+
+const unsigned char* DecodeStream(const unsigned char* in,
+                                  const unsigned char* end, size_t n,
+                                  uint64_t* values) {
+  size_t num_controls = (n + 3) / 4;
+  if (static_cast<size_t>(end - in) < num_controls)
+    return nullptr;
+  const unsigned char* control = in;
+  in += num_controls;
+  for (size_t i = 0; i < n; i++) {
+    size_t len = 1 << ((control[i / 4] >> (2 * (i % 4))) & 3);
+    if (static_cast<size_t>(end - in) < len)
+      return nullptr;
+    uint64_t le = 0;
+    memcpy(&le, in, len);
+    values[i] = le64toh(le);
+    in += len;
+  }
+  return in;
+}
+
+void EncodePostingBlock(const PostingBlock& block, uint64_t base_doc_id,
+                        string* out) {
+  size_t num_docs = block.doc_ids.size();
+  vector<uint64_t> values(num_docs);
+  uint64_t prev = base_doc_id;
+  for (size_t i = 0; i < num_docs; i++) {
+    values[i] = block.doc_ids[i] - prev;
+    prev = block.doc_ids[i];
+  }
+  EncodeStream(values.data(), num_docs, out);
+
+  values.assign(block.num_positions.begin(), block.num_positions.end());
+  EncodeStream(values.data(), num_docs, out);
+
+  // Positions are gapped within each document, in 32-bit arithmetic,
+  // so that a position smaller than the one before still round-trips.
+  values.resize(block.positions.size());
+  size_t p = 0;
+  for (size_t i = 0; i < num_docs; i++) {
+    uint32_t prev_pos = 0;
+    for (uint32_t j = 0; j < block.num_positions[i]; j++, p++) {
+      values[p] = static_cast<uint32_t>(block.positions[p] - prev_pos);
+      prev_pos = block.positions[p];
+    }
+  }
+  EncodeStream(values.data(), values.size(), out);
+}
+
+bool DecodePostingBlock(const unsigned char* bytes, size_t len,
+                        uint64_t base_doc_id, uint32_t num_docs,
+                        PostingBlock* const block, bool positions) {
+  // Every integer takes at least a byte, which bounds the counts
+  // before we allocate room for them.
+  if (num_docs > len)
+    return false;
+  const unsigned char* end = bytes + len;
+  vector<uint64_t> values(num_docs);
+  bytes = DecodeStream(bytes, end, num_docs, values.data());
+  if (bytes == nullptr)
+    return false;
+  block->doc_ids.resize(num_docs);
+  uint64_t doc_id = base_doc_id;
+  for (uint32_t i = 0; i < num_docs; i++) {
+    doc_id += values[i];
+    block->doc_ids[i] = doc_id;
+  }
+
+  bytes = DecodeStream(bytes, end, num_docs, values.data());
+  if (bytes == nullptr)
+    return false;
+  block->num_positions.resize(num_docs);
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < num_docs; i++) {
+    if (values[i] > UINT32_MAX)
+      return false;
+    block->num_positions[i] = values[i];
+    total += values[i];
+  }
+  if (!positions) {
+    block->positions.clear();
+    return true;
+  }
+
+  if (total > static_cast<size_t>(end - bytes))
+    return false;
+  values.resize(total);
+  if (DecodeStream(bytes, end, total, values.data()) == nullptr)
+    return false;
+  block->positions.resize(total);
+  size_t p = 0;
+  for (uint32_t i = 0; i < num_docs; i++) {
+    uint32_t pos = 0;
+    for (uint32_t j = 0; j < block->num_positions[i]; j++, p++) {
+      pos += static_cast<uint32_t>(values[p]);
+      block->positions[p] = pos;
+    }
+  }
+  return true;
+}
+
+}  // namespace hw4
@@ -0,0 +1,75 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_POSTINGSCODEC_H_
+#define HW4_POSTINGSCODEC_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint64_t, etc.
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+namespace hw4 {
+
+// The codec behind version 2's compressed postings (see
+// IndexLayoutV2.h).  Postings are cut into blocks of up to
+// kPostingsPerBlock documents, and each block is coded as three
+// integer streams:
+//
+//  - the docID gaps: each document's docID minus the one before it
+//    (the first minus the block's base docID);
+//  - each document's number of positions; and
+//  - the position gaps: within each document, each position minus the
+//    one before it (the first as is).
+//
+// Each stream is coded as Stream VByte [Lemire et al., 2017]: first
+// the control bytes, one for every four integers, each holding a
+// two-bit length code for its four; then the integers' significant
+// bytes, little-endian and back to back.  Keeping the lengths apart
+// from the data means decoding never branches on a continuation bit,
+// and the data bytes of a stream are contiguous.  The codes are 1, 2,
+// 4 or 8 bytes, so that docID gaps may be 64 bits wide.
+static const uint32_t kPostingsPerBlock = 128;
+
+// The postings of one block, decoded.
+struct PostingBlock {
+  std::vector<uint64_t> doc_ids;        // in increasing order
+  std::vector<uint32_t> num_positions;  // one for each docID
+  std::vector<uint32_t> positions;      // every document's, back to back
+};
+
+// Appends the coded form of the "n" integers at "values" to "out".
+void EncodeStream(const uint64_t* values, size_t n, std::string* out);
+
+// Decodes "n" integers from the bytes in ["in", "end") into "values".
+// Returns a pointer to the byte after the stream, or nullptr if the
+// stream runs past "end".
+const unsigned char* DecodeStream(const unsigned char* in,
+                                  const unsigned char* end, size_t n,
+                                  uint64_t* values);
+
+// Appends the coded form of "block", whose docIDs are all greater than
+// "base_doc_id" (or equal, for the very first block of a word), to
+// "out".
+void EncodePostingBlock(const PostingBlock& block, uint64_t base_doc_id,
+                        std::string* out);
+
+// Decodes the "num_docs" documents of the block in the "len" bytes at
+// "bytes", whose base docID is "base_doc_id", into "block".  If
+// "positions" is false, skips the position stream, leaving
+// block->positions empty.  Returns false if the block is malformed.
+bool DecodePostingBlock(const unsigned char* bytes, size_t len,
+                        uint64_t base_doc_id, uint32_t num_docs,
+                        PostingBlock* const block, bool positions = true);
+
+}  // namespace hw4
+
+#endif  // HW4_POSTINGSCODEC_H_
@@ -0,0 +1,104 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <list>
+#include <string>
+
+#include "./QueryProcessorPool.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::list;
+using std::string;
+
+namespace hw4 {
+
+QueryProcessorPool::QueryProcessorPool(const list<string>& index_list,
+                                       uint32_t num_processors,
+                                       IndexMode mode)
+  : index_list_(index_list), resident_(nullptr) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+  if (mode == kStdioIndex) {
+    for (const string& file_name : index_list_) {
+      if (SharedIndexReader::FileVersion(file_name) == 2)
+        mode = kMappedIndex;
+    }
+  }
+  if (mode == kMappedIndex) {
+    shared_.reset(new SharedQueryProcessor(index_list_,
+                                           SharedIndexReader::kMmap));
+    return;
+  }
+  if (mode == kPreadIndex) {
+    shared_.reset(new SharedQueryProcessor(index_list_,
+                                           SharedIndexReader::kPread));
+    return;
+  }
+  if (mode == kResidentIndex) {
+    ResidentQueryProcessor* resident = new ResidentQueryProcessor(index_list_);
+    shared_.reset(resident);
+    resident_ = resident;
+    return;
+  }
+
+  // The first processor checks the files; the rest trust it.
+  all_.push_back(new DeadlineQueryProcessor(index_list_, true));
+  for (uint32_t i = 1; i < num_processors; i++)
+    all_.push_back(new DeadlineQueryProcessor(index_list_, false));
+  idle_ = all_;
+}
+
+QueryProcessorPool::~QueryProcessorPool() {
+  for (DeadlineQueryProcessor* qp : all_)
+    delete qp;
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+void QueryProcessorPool::PrintFootprint(std::ostream& out) const {
+  if (resident_ != nullptr)
+    resident_->PrintFootprint(out);
+}
+
+QueryEngine* QueryProcessorPool::Acquire() {
+  if (shared_ != nullptr)
+    return shared_.get();
+
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  DeadlineQueryProcessor* qp = nullptr;
+  if (!idle_.empty()) {
+    qp = idle_.back();
+    idle_.pop_back();
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  if (qp != nullptr)
+    return qp;
+
+  // Everybody's busy.  Open another one outside the lock, so that we
+  // don't hold up the queries returning theirs.
+  qp = new DeadlineQueryProcessor(index_list_, false);
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  all_.push_back(qp);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+  return qp;
+}
+
+void QueryProcessorPool::Release(QueryEngine* qp) {
+  if (shared_ != nullptr)
+    return;
+
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  idle_.push_back(static_cast<DeadlineQueryProcessor*>(qp));
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+}
+
+}  // namespace hw4
@@ -0,0 +1,116 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_QUERYPROCESSORPOOL_H_
+#define HW4_QUERYPROCESSORPOOL_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <stdint.h>  // for uint32_t, etc.
+#include <list>      // for std::list
+#include <memory>    // for std::unique_ptr
+#include <ostream>   // for std::ostream
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+#include "./DeadlineQueryProcessor.h"
+#include "./ResidentIndex.h"
+#include "./SharedIndexReader.h"
+
+namespace hw4 {
+
+// A QueryProcessorPool keeps query processors open on the server's
+// index files for the life of the server, so that answering a query
+// doesn't mean reopening every index file and re-reading its header.
+// The index files are opened, and their checksums validated, once when
+// the pool is created.
+//
+// How the processors read the index files depends on the pool's
+// IndexMode.  A kStdioIndex processor reads them through stdio streams
+// of its own, so it can only serve one query at a time.  Each worker
+// borrows one with a Lease and gives it back when the query is done;
+// if they're all busy, the pool opens another (without validating the
+// files again), so the pool grows to the number of queries that run at
+// once.  The other modes have a single, thread-safe processor that
+// every Lease shares: a SharedQueryProcessor for kMappedIndex and
+// kPreadIndex, and a ResidentQueryProcessor for kResidentIndex.
+//
+// hw3's readers only understand version 1 index files, so if any of
+// the files is a version 2 file (see IndexLayoutV2.h), kStdioIndex
+// falls back to kMappedIndex.
+//
+// A QueryProcessorPool is thread-safe.
+class QueryProcessorPool {
+ public:
+  // How the processors read the index files.
+  enum IndexMode {
+    kStdioIndex,     // hw3's readers, through FILE*s
+    kMappedIndex,    // SharedIndexReaders, through a shared mmap()
+    kPreadIndex,     // SharedIndexReaders, through pread() on a shared fd
+    kResidentIndex,  // ResidentIndexes, decoded into memory at startup
+  };
+
+  // Opens and validates the index files in "index_list", and opens
+  // processors on them that read them as "mode" says: with kStdioIndex,
+  // "num_processors" of them (at least one) to begin with.
+  QueryProcessorPool(const std::list<std::string>& index_list,
+                     uint32_t num_processors,
+                     IndexMode mode = kStdioIndex);
+  virtual ~QueryProcessorPool();
+
+  // With kResidentIndex, writes a line to "out" for each index file,
+  // saying how much memory it takes.  Otherwise writes nothing.
+  void PrintFootprint(std::ostream& out) const;
+
+  // A processor borrowed from the pool, which goes back to the pool
+  // when the Lease is destroyed.
+  class Lease {
+   public:
+    explicit Lease(QueryProcessorPool* pool)
+      : pool_(pool), qp_(pool->Acquire()) { }
+    ~Lease() { pool_->Release(qp_); }
+
+    const QueryEngine& operator*() const { return *qp_; }
+    const QueryEngine* operator->() const { return qp_; }
+
+   private:
+    QueryProcessorPool* pool_;
+    QueryEngine* qp_;
+
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+  };
+
+ private:
+  // Takes an idle processor, opening a new one if there is none.
+  QueryEngine* Acquire();
+
+  // Returns "qp", taken with Acquire(), to the pool.
+  void Release(QueryEngine* qp);
+
+  std::list<std::string> index_list_;
+
+  // The processor every Lease shares, if the mode has one, and that
+  // same processor if it's a ResidentQueryProcessor.
+  std::unique_ptr<QueryEngine> shared_;
+  const ResidentQueryProcessor* resident_;
+
+  // Guards the fields below.
+  pthread_mutex_t lock_;
+  std::vector<DeadlineQueryProcessor*> all_;
+  std::vector<DeadlineQueryProcessor*> idle_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_QUERYPROCESSORPOOL_H_
@@ -0,0 +1,62 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <string.h>  // for memcpy(), memmove()
+
+#include <algorithm>  // for std::max
+
+#include "./ReadBuffer.h"
+
+namespace hw4 {
+
+// The smallest slab we allocate.
+static const size_t kMinCapacity = 16384;
+
+char* ReadBuffer::PrepareWrite(size_t len, size_t* const avail) {
+  if (capacity_ - write_ < len) {
+    size_t unread = write_ - read_;
+    if (unread + len <= capacity_ && read_ > 0) {
+      // There's room if we slide the unread bytes to the front.
+      memmove(buf_, buf_ + read_, unread);
+    } else {
+      size_t capacity = std::max(std::max(capacity_ * 2, kMinCapacity),
+                                 unread + len);
+      char* buf = new char[capacity];
+      if (unread > 0)
+        memcpy(buf, buf_ + read_, unread);
+      delete[] buf_;
+      buf_ = buf;
+      capacity_ = capacity;
+    }
+    read_ = 0;
+    write_ = unread;
+  }
+  *avail = capacity_ - write_;
+  return buf_ + write_;
+}
+
+void ReadBuffer::Append(const char* data, size_t len) {
+  size_t avail;
+  memcpy(PrepareWrite(len, &avail), data, len);
+  Commit(len);
+}
+
+void ReadBuffer::Consume(size_t len) {
+  read_ += len;
+  if (read_ == write_) {
+    // Nothing left; start again at the front, so that the next read
+    // doesn't have to move anything.
+    read_ = 0;
+    write_ = 0;
+  }
+}
+
+}  // namespace hw4
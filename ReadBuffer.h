@@ -0,0 +1,69 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_READBUFFER_H_
+#define HW4_READBUFFER_H_
+
+#include <stddef.h>  // for size_t
+
+#include <string_view>
+
+namespace hw4 {
+
+// A ReadBuffer holds bytes read from a client that haven't been
+// consumed yet.  It is a single slab of memory with a read index and a
+// write index: reads land directly in the free space after the write
+// index, and consuming bytes just advances the read index, so bytes are
+// never copied out of the way one request at a time.  When the free
+// space runs out, the unread bytes are moved back to the front of the
+// slab, or the slab is grown.
+//
+// A ReadBuffer is not thread-safe.
+class ReadBuffer {
+ public:
+  ReadBuffer() : buf_(nullptr), capacity_(0), read_(0), write_(0) { }
+  virtual ~ReadBuffer() { delete[] buf_; }
+
+  // The unread bytes.  Only valid until the buffer is next modified.
+  std::string_view data() const {
+    return std::string_view(buf_ + read_, write_ - read_);
+  }
+  size_t size() const { return write_ - read_; }
+  bool empty() const { return read_ == write_; }
+
+  // Makes room for at least "len" more bytes and returns where they
+  // should go; the free space available there is stored in "avail".
+  // Call Commit() once the bytes are in place.
+  char* PrepareWrite(size_t len, size_t* const avail);
+
+  // Marks "len" bytes written at the address returned by PrepareWrite()
+  // as unread.
+  void Commit(size_t len) { write_ += len; }
+
+  // Copies "len" bytes into the buffer.
+  void Append(const char* data, size_t len);
+
+  // Marks the first "len" unread bytes as read.
+  void Consume(size_t len);
+
+ private:
+  ReadBuffer(const ReadBuffer&) = delete;
+  ReadBuffer& operator=(const ReadBuffer&) = delete;
+
+  char* buf_;
+  size_t capacity_;
+  size_t read_;   // the first unread byte
+  size_t write_;  // one past the last unread byte
+};
+
+}  // namespace hw4
+
+#endif  // HW4_READBUFFER_H_
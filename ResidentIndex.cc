@@ -0,0 +1,256 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <algorithm>    // for std::sort, std::lower_bound
+#include <list>
+#include <string>
+#include <string_view>  // for std::string_view
+#include <vector>
+
+#include "./ResidentIndex.h"
+#include "./SharedIndexReader.h"
+#include "./SortedSearch.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using hw3::DocIDElementHeader;
+using std::list;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+namespace hw4 {
+
+// A dense docID table has a slot for every docID up to the largest, so
+// we refuse files whose largest docID is more than this many times
+// their number of documents (plus a little).
+static const uint64_t kMaxDocIDSpread = 2;
+static const uint64_t kMaxDocIDSlack = 1024;
+
+// Returns true if "value" fits in the 32-bit fields of a ResidentIndex.
+static bool FitsIn32Bits(uint64_t value) {
+  return value <= UINT32_MAX;
+}
+
+// Returns the number of bytes "v" has allocated.
+template <typename T> static size_t AllocatedBytes(const vector<T>& v) {
+  return v.capacity() * sizeof(T);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ResidentIndex
+///////////////////////////////////////////////////////////////////////////////
+ResidentIndex::ResidentIndex() : footprint_() { }
+
+bool ResidentIndex::Load(const string& file_name, bool validate) {
+  // Walk the file through a mapping that we drop once we're done.
+  SharedIndexReader reader;
+  if (!reader.Open(file_name, SharedIndexReader::kMmap, validate))
+    return false;
+  unique_ptr<SharedDocTableReader> dtr(reader.NewDocTableReader());
+  unique_ptr<SharedIndexTableReader> itr(reader.NewIndexTableReader());
+
+  // The docID-->filename table, in docID order.
+  vector<DocID_t> doc_ids;
+  for (DocID_t doc_id : dtr->GetDocIDList())
+    doc_ids.push_back(doc_id);
+  std::sort(doc_ids.begin(), doc_ids.end());
+  DocID_t max_doc_id = doc_ids.empty() ? 0 : doc_ids.back();
+  if (max_doc_id > kMaxDocIDSpread * doc_ids.size() + kMaxDocIDSlack ||
+      !FitsIn32Bits(max_doc_id))
+    return false;
+
+  names_.clear();
+  name_offsets_.assign(max_doc_id + 2, 0);
+  auto next = doc_ids.begin();
+  for (DocID_t d = 0; d <= max_doc_id; d++) {
+    name_offsets_[d] = names_.size();
+    if (next != doc_ids.end() && *next == d) {
+      string name;
+      if (dtr->LookupDocID(d, &name))
+        names_ += name;
+      ++next;
+    }
+  }
+  if (!FitsIn32Bits(names_.size()))
+    return false;
+  name_offsets_[max_doc_id + 1] = names_.size();
+
+  // The dictionary, in word order, and each word's postings in docID
+  // order.
+  vector<string> words;
+  for (const string& word : itr->GetWordList())
+    words.push_back(word);
+  std::sort(words.begin(), words.end());
+
+  words_.clear();
+  dictionary_.clear();
+  postings_.clear();
+  for (const string& word : words) {
+    unique_ptr<SharedDocIDTableReader> ditr(itr->LookupWord(word));
+    if (ditr == nullptr)
+      continue;
+
+    if (!FitsIn32Bits(words_.size()) || !FitsIn32Bits(word.length()))
+      return false;
+    WordEntry entry;
+    entry.word_offset = words_.size();
+    entry.word_len = word.length();
+    entry.postings_begin = postings_.size();
+    for (const DocIDElementHeader& header : ditr->GetDocIDList()) {
+      if (header.doc_id > max_doc_id)
+        continue;
+      Posting posting;
+      posting.doc_id = header.doc_id;
+      posting.num_positions = header.num_positions;
+      postings_.push_back(posting);
+    }
+    if (!FitsIn32Bits(postings_.size()))
+      return false;
+    entry.postings_end = postings_.size();
+    std::sort(postings_.begin() + entry.postings_begin, postings_.end(),
+              [](const Posting& a, const Posting& b) {
+                return a.doc_id < b.doc_id;
+              });
+    words_ += word;
+    dictionary_.push_back(entry);
+  }
+
+  // Give back whatever the vectors over-allocated while growing.
+  words_.shrink_to_fit();
+  dictionary_.shrink_to_fit();
+  postings_.shrink_to_fit();
+  names_.shrink_to_fit();
+
+  footprint_.num_words = dictionary_.size();
+  footprint_.num_postings = postings_.size();
+  footprint_.num_docs = doc_ids.size();
+  footprint_.dictionary_bytes = words_.capacity() + AllocatedBytes(dictionary_);
+  footprint_.postings_bytes = AllocatedBytes(postings_);
+  footprint_.names_bytes = names_.capacity() + AllocatedBytes(name_offsets_);
+  return true;
+}
+
+bool ResidentIndex::LookupWord(const string& word,
+                               const Posting** const postings,
+                               size_t* const num_postings) const {
+  auto word_of = [this](const WordEntry& entry) {
+    return string_view(words_.data() + entry.word_offset, entry.word_len);
+  };
+  auto it = std::lower_bound(dictionary_.begin(), dictionary_.end(), word,
+                             [&word_of](const WordEntry& entry,
+                                        const string& w) {
+                               return word_of(entry) < w;
+                             });
+  if (it == dictionary_.end() || word_of(*it) != word)
+    return false;
+  *postings = postings_.data() + it->postings_begin;
+  *num_postings = it->postings_end - it->postings_begin;
+  return true;
+}
+
+bool ResidentIndex::LookupDocID(DocID_t doc_id, string* const ret_str) const {
+  if (doc_id >= name_offsets_.size() - 1)
+    return false;
+  uint32_t begin = name_offsets_[doc_id];
+  uint32_t end = name_offsets_[doc_id + 1];
+  if (begin == end)
+    return false;
+  ret_str->assign(names_, begin, end - begin);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ResidentQueryProcessor
+///////////////////////////////////////////////////////////////////////////////
+ResidentQueryProcessor::ResidentQueryProcessor(
+    const list<string>& index_list, bool validate) {
+  for (const string& file_name : index_list) {
+    ResidentIndex* index = new ResidentIndex;
+    Verify333(index->Load(file_name, validate));
+    file_names_.push_back(file_name);
+    indices_.emplace_back(index);
+  }
+}
+
+void ResidentQueryProcessor::PrintFootprint(std::ostream& out) const {
+  for (size_t i = 0; i < indices_.size(); i++) {
+    const ResidentIndex::Footprint& fp = indices_[i]->footprint();
+    out << "    " << file_names_[i] << ": " << fp.num_words << " words, "
+        << fp.num_postings << " postings, " << fp.num_docs
+        << " documents in " << (fp.total_bytes() >> 10) << " KiB"
+        << " (dictionary " << (fp.dictionary_bytes >> 10)
+        << ", postings " << (fp.postings_bytes >> 10)
+        << ", names " << (fp.names_bytes >> 10) << ")" << std::endl;
+  }
+}
+
+bool ResidentQueryProcessor::ProcessIndex(
+    int index, const vector<string>& query, const QueryDeadline& deadline,
+    vector<hw3::QueryProcessor::QueryResult>* const results) const {
+  typedef ResidentIndex::Posting Posting;
+  const ResidentIndex& ri = *indices_[index];
+  if (deadline.Expired())
+    return false;
+
+  // Find every word's postings; a missing word means no matches.
+  vector<std::pair<const Posting*, size_t>> lists;
+  for (const string& word : query) {
+    const Posting* postings;
+    size_t num_postings;
+    if (!ri.LookupWord(word, &postings, &num_postings))
+      return true;
+    lists.emplace_back(postings, num_postings);
+  }
+
+  // Start from the shortest list, and merge each longer one into it,
+  // keeping only the documents in both and adding up the occurrences.
+  // The longer list is galloped through rather than walked, so each
+  // merge costs about as much as the shorter list.
+  std::sort(lists.begin(), lists.end(),
+            [](const std::pair<const Posting*, size_t>& a,
+               const std::pair<const Posting*, size_t>& b) {
+              return a.second < b.second;
+            });
+  vector<Posting> matches(lists[0].first, lists[0].first + lists[0].second);
+  for (size_t w = 1; w < lists.size() && !matches.empty(); w++) {
+    const Posting* other = lists[w].first;
+    const Posting* other_end = other + lists[w].second;
+    size_t kept = 0;
+    for (size_t i = 0; i < matches.size() && other != other_end; i++) {
+      if (i % kDocsPerDeadlineCheck == 0 && deadline.Expired())
+        return false;
+      other += Gallop(0, other_end - other, [&](uint64_t j) {
+        return other[j].doc_id < matches[i].doc_id;
+      });
+      if (other != other_end && other->doc_id == matches[i].doc_id) {
+        matches[kept] = matches[i];
+        matches[kept].num_positions += other->num_positions;
+        kept++;
+      }
+    }
+    matches.resize(kept);
+  }
+
+  for (const Posting& match : matches) {
+    hw3::QueryProcessor::QueryResult result;
+    if (!ri.LookupDocID(match.doc_id, &result.document_name))
+      continue;
+    result.rank = match.num_positions;
+    results->push_back(result);
+  }
+  return true;
+}
+
+}  // namespace hw4
@@ -0,0 +1,142 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_RESIDENTINDEX_H_
+#define HW4_RESIDENTINDEX_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t, etc.
+#include <list>      // for std::list
+#include <memory>    // for std::unique_ptr
+#include <ostream>   // for std::ostream
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+#include "./DeadlineQueryProcessor.h"
+
+namespace hw4 {
+
+// A ResidentIndex is an index file decoded, once, into native
+// in-memory structures, so that answering a query never touches the
+// file again and never walks an on-disk hash chain or byte-swaps a
+// record.  It holds:
+//
+//  - a flat, sorted word dictionary: every word's bytes packed into one
+//    string, and a sorted array of entries pointing into it;
+//  - every word's postings, sorted by docID, packed back to back in one
+//    array (only the number of positions in each document is kept,
+//    since that's all ranking needs); and
+//  - a dense docID-->filename table: the names packed into one string,
+//    indexed by an array of offsets with one slot per docID.
+//
+// A ResidentIndex is read-only once loaded, so any number of threads
+// may share one.
+class ResidentIndex {
+ public:
+  // One document in a word's postings.
+  struct Posting {
+    uint32_t doc_id;
+    uint32_t num_positions;
+  };
+
+  // What the index holds, and how much memory that takes.
+  struct Footprint {
+    size_t num_words;
+    size_t num_postings;
+    size_t num_docs;
+    size_t dictionary_bytes;  // the word entries and their bytes
+    size_t postings_bytes;    // the postings arrays
+    size_t names_bytes;       // the docID-->filename table
+
+    size_t total_bytes() const {
+      return dictionary_bytes + postings_bytes + names_bytes;
+    }
+  };
+
+  ResidentIndex();
+  virtual ~ResidentIndex() { }
+
+  // Reads and decodes the index file "file_name", checking its header
+  // and, if "validate" is true, its checksum.  Returns false if the
+  // file can't be read, if its docIDs are too sparse for a dense table
+  // (hw2 hands them out consecutively, so they never are), or if it is
+  // too big for the 32-bit docIDs and offsets we keep: more than
+  // UINT32_MAX postings, or bytes of words or of file names.
+  bool Load(const std::string& file_name, bool validate = true);
+
+  // Looks up "word", setting "*postings" to its postings, sorted by
+  // docID, and "*num_postings" to how many there are.  Returns false
+  // if the word isn't in the index.
+  bool LookupWord(const std::string& word, const Posting** const postings,
+                  size_t* const num_postings) const;
+
+  // Looks up "doc_id", storing its file name through "ret_str".
+  // Returns false if it isn't there.
+  bool LookupDocID(DocID_t doc_id, std::string* const ret_str) const;
+
+  // Returns what the index holds.
+  const Footprint& footprint() const { return footprint_; }
+
+ private:
+  // A word in the dictionary: where its bytes are in words_, and where
+  // its postings are in postings_.
+  struct WordEntry {
+    uint32_t word_offset;
+    uint32_t word_len;
+    uint32_t postings_begin;
+    uint32_t postings_end;
+  };
+
+  std::string words_;
+  std::vector<WordEntry> dictionary_;
+  std::vector<Posting> postings_;
+
+  // The name of doc_id d is names_[name_offsets_[d], name_offsets_[d+1]);
+  // documents that aren't in the index have an empty name.
+  std::string names_;
+  std::vector<uint32_t> name_offsets_;
+
+  Footprint footprint_;
+
+  ResidentIndex(const ResidentIndex&) = delete;
+  ResidentIndex& operator=(const ResidentIndex&) = delete;
+};
+
+// A ResidentQueryProcessor is the QueryEngine over ResidentIndexes.
+// It intersects the query words' docID-sorted postings, starting from
+// the shortest.  It is thread-safe, so the whole server can share one.
+class ResidentQueryProcessor : public QueryEngine {
+ public:
+  // Loads every index file in "index_list", validating their checksums
+  // if "validate" is true.  Dies if one can't be loaded.
+  explicit ResidentQueryProcessor(const std::list<std::string>& index_list,
+                                  bool validate = true);
+  virtual ~ResidentQueryProcessor() { }
+
+  // Writes a line to "out" for each index file, saying how much memory
+  // it takes.
+  void PrintFootprint(std::ostream& out) const;
+
+ protected:
+  int num_indices() const override { return indices_.size(); }
+  bool ProcessIndex(int index, const std::vector<std::string>& query,
+                    const QueryDeadline& deadline,
+                    std::vector<hw3::QueryProcessor::QueryResult>* const
+                      results) const override;
+
+ private:
+  std::vector<std::string> file_names_;
+  std::vector<std::unique_ptr<ResidentIndex>> indices_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_RESIDENTINDEX_H_
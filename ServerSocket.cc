@@ -30,6 +30,8 @@ namespace hw4 {
 ServerSocket::ServerSocket(uint16_t port) {
   port_ = port;
   listen_sock_fd_ = -1;
+  nonblocking_ = false;
+  reuse_port_ = false;
 }
 
 ServerSocket::~ServerSocket() {
@@ -41,7 +43,8 @@ ServerSocket::~ServerSocket() {
   listen_sock_fd_ = -1;
 }
 
-bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
+bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd,
+                                 bool nonblocking) {
   // Use "getaddrinfo," "socket," "bind," and "listen" to
   // create a listening socket on port port_.  Return the
   // listening socket through the output parameter "listen_fd"
@@ -76,9 +79,10 @@ bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
   }
 
   int ret_fd = -1;
+  int sock_type = SOCK_STREAM | (nonblocking ? SOCK_NONBLOCK : 0);
   for (struct addrinfo *rp = result; rp != NULL; rp = rp->ai_next) {
     ret_fd = socket(rp->ai_family,
-                    rp->ai_socktype,
+                    sock_type,
                     rp->ai_protocol);
 
     if (ret_fd == -1) {
@@ -89,6 +93,12 @@ bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
     int optval = 1;
     Verify333(setsockopt(ret_fd, SOL_SOCKET, SO_REUSEADDR,
                          &optval, sizeof(optval)) == 0);
+    if (reuse_port_ && setsockopt(ret_fd, SOL_SOCKET, SO_REUSEPORT,
+                                  &optval, sizeof(optval)) != 0) {
+      close(ret_fd);
+      ret_fd = -1;
+      continue;
+    }
 
     // Binding the socket to the address and port number returned by getaddrinfo()
     if (bind(ret_fd, rp->ai_addr, rp->ai_addrlen) == 0) {
@@ -114,6 +124,7 @@ bool ServerSocket::BindAndListen(int ai_family, int* const listen_fd) {
   }
 
   listen_sock_fd_ = ret_fd;
+  nonblocking_ = nonblocking;
   *listen_fd = ret_fd;
 
   return true;
@@ -126,7 +137,9 @@ bool ServerSocket::Accept(int* const accepted_fd,
                           std::string* const server_addr,
                           std::string* const server_dns_name) const {
   // Accept a new connection on the listening socket listen_sock_fd_.
-  // (Block until a new connection arrives.)  Return the newly accepted
+  // (Block until a new connection arrives, unless the socket is
+  // non-blocking, in which case we return false with errno set to
+  // EAGAIN when there is nothing to accept.)  Return the newly accepted
   // socket, as well as information about both ends of the new connection,
   // through the various output parameters.
 
@@ -136,12 +149,13 @@ bool ServerSocket::Accept(int* const accepted_fd,
   struct sockaddr *addr = reinterpret_cast<struct sockaddr *>(&caddr);
   int client_fd = -1;
   while (1) {
-    client_fd = accept(listen_sock_fd_,
-                       addr,
-                       &caddr_len);
+    client_fd = accept4(listen_sock_fd_,
+                        addr,
+                        &caddr_len,
+                        nonblocking_ ? SOCK_NONBLOCK : 0);
 
     if (client_fd < 0) {
-      if ((errno == EAGAIN) || (errno == EINTR))
+      if (errno == EINTR || (!nonblocking_ && errno == EAGAIN))
         continue;
 
       return false;
@@ -155,55 +169,79 @@ bool ServerSocket::Accept(int* const accepted_fd,
   // store client file descriptor in output parameter
   *accepted_fd = client_fd;
 
+  DescribeConnection(client_fd, addr, client_addr, client_port,
+                     client_dns_name, server_addr, server_dns_name);
+  return true;
+}
+
+bool ServerSocket::GetConnectionInfo(int client_fd,
+                                     std::string* const client_addr,
+                                     uint16_t* const client_port,
+                                     std::string* const client_dns_name,
+                                     std::string* const server_addr,
+                                     std::string* const server_dns_name)
+                                     const {
+  struct sockaddr_storage caddr;
+  socklen_t caddr_len = sizeof(caddr);
+  struct sockaddr *addr = reinterpret_cast<struct sockaddr *>(&caddr);
+  if (getpeername(client_fd, addr, &caddr_len) != 0)
+    return false;
+
+  DescribeConnection(client_fd, addr, client_addr, client_port,
+                     client_dns_name, server_addr, server_dns_name);
+  return true;
+}
+
+void ServerSocket::DescribeConnection(int client_fd,
+                                      const struct sockaddr* addr,
+                                      std::string* const client_addr,
+                                      uint16_t* const client_port,
+                                      std::string* const client_dns_name,
+                                      std::string* const server_addr,
+                                      std::string* const server_dns_name)
+                                      const {
   // get client IP address and port and store them
   if (addr->sa_family == AF_INET) {  // client uses IPv4 address
     char str[INET_ADDRSTRLEN];
-    struct sockaddr_in *in4 = reinterpret_cast<struct sockaddr_in *>(addr);
+    const struct sockaddr_in *in4 =
+      reinterpret_cast<const struct sockaddr_in *>(addr);
     inet_ntop(AF_INET, &(in4->sin_addr), str, INET_ADDRSTRLEN);
 
     *client_addr = std::string(str);
     *client_port = htons(in4->sin_port);
   } else {  // client uses IPv6 address
     char str[INET6_ADDRSTRLEN];
-    struct sockaddr_in6 *in6 = reinterpret_cast<struct sockaddr_in6 *>(addr);
+    const struct sockaddr_in6 *in6 =
+      reinterpret_cast<const struct sockaddr_in6 *>(addr);
     inet_ntop(AF_INET6, &(in6->sin6_addr), str, INET6_ADDRSTRLEN);
     *client_addr = std::string(str);
     *client_port = htons(in6->sin6_port);
   }
 
-  // get client DNS name and store it
-  char hname[1024];
-  Verify333(getnameinfo(addr, caddr_len, hname, 1024, NULL, 0, 0) == 0);
-  *client_dns_name = std::string(hname);
+  // Reverse DNS lookups can block for seconds, so we don't do them
+  // here; the "DNS names" are the numeric addresses.  Customers that
+  // want real names can resolve them lazily through a DnsCache.
+  *client_dns_name = *client_addr;
 
-  // get the client IP address/DNS name and store them
-  char host_name[1024];
-  host_name[0] = '\0';
+  // get the server IP address and store it
   if (sock_family_ == AF_INET) {  // server use IPv4 address
     struct sockaddr_in server;
     socklen_t server_len = sizeof(server);
     char addr_buf[INET_ADDRSTRLEN];
     getsockname(client_fd, (struct sockaddr *) &server, &server_len);
     inet_ntop(AF_INET, &server.sin_addr, addr_buf, INET_ADDRSTRLEN);
-    getnameinfo((const struct sockaddr *) &server,
-                server_len, host_name, 1024, NULL, 0, 0);
 
     *server_addr = std::string(addr_buf);
-    *server_dns_name = std::string(host_name);
   } else {  // server uses IPv6 address
     struct sockaddr_in6 server;
     socklen_t server_len = sizeof(server);
     char addrbuf[INET6_ADDRSTRLEN];
     getsockname(client_fd, (struct sockaddr *) &server, &server_len);
     inet_ntop(AF_INET6, &server.sin6_addr, addrbuf, INET6_ADDRSTRLEN);
-    getnameinfo((const struct sockaddr *) &server,
-                server_len, host_name, 1024, NULL, 0, 0);
 
     *server_addr = std::string(addrbuf);
-    *server_dns_name = std::string(host_name);
   }
-
-  return true;
+  *server_dns_name = *server_addr;
 }
 
 }  // namespace hw4
@@ -35,6 +35,13 @@ class ServerSocket {
   // The destructor closes the listening socket if it is open.
   virtual ~ServerSocket();
 
+  // If "reuse_port" is true, BindAndListen() sets SO_REUSEPORT on the
+  // listening socket, so that several ServerSockets (typically one per
+  // thread) can listen on the same port and have the kernel spread
+  // incoming connections across them.  Must be called before
+  // BindAndListen().
+  void set_reuse_port(bool reuse_port) { reuse_port_ = reuse_port; }
+
   // This function causes the ServerSocket to attempt to create a
   // listening socket and to bind it to the given port number on
   // whatever IP address the host OS recommends for us.  The caller
@@ -48,12 +55,18 @@ class ServerSocket {
   //   can handle IPv6 and IPv4 clients on POSIX systems, while AF_UNSPEC
   //   might pick IPv4 and not be able to accept IPv6 connections.
   //
+  // - nonblocking: if true, the listening socket and every socket
+  //   handed out by Accept() are placed in non-blocking mode, which is
+  //   what an event loop wants.  Accept() then returns false with errno
+  //   set to EAGAIN once there are no more pending connections.
+  //
   // On failure this function returns false.  On success, it returns
   // true, sets listen_sock_fd_ to be the file descriptor for the
   // listening socket, and also returns (via an output parameter):
   //
   // - listen_fd: the file descriptor for the listening socket.
-  bool BindAndListen(int ai_family, int* const listen_fd);
+  bool BindAndListen(int ai_family, int* const listen_fd,
+                     bool nonblocking = false);
 
   // This function causes the ServerSocket to attempt to accept
   // an incoming connection from a client.  On failure, returns false.
@@ -70,14 +83,16 @@ class ServerSocket {
   // - client_port: a uint16_t containing the port number the client
   //   connected from.
   //
-  // - client_dnsname: a C++ string object containing the DNS name
-  //   of the client.
+  // - client_dnsname: a C++ string object for the DNS name of the
+  //   client.  Reverse lookups can block for seconds, so Accept() never
+  //   does one; this is just the numeric address.  Use a DnsCache to
+  //   resolve it without blocking.
   //
   // - server_addr: a C++ string object containing a printable
   //   representation of the server IP address for the connection.
   //
-  // - server_dnsname: a C++ string object containing the DNS name
-  //   of the server.
+  // - server_dnsname: a C++ string object for the DNS name of the
+  //   server; like client_dnsname, this is the numeric address.
   bool Accept(int* const accepted_fd,
               std::string* const client_addr,
               uint16_t* const client_port,
@@ -85,10 +100,33 @@ class ServerSocket {
               std::string* const server_addr,
               std::string* const server_dns_name) const;
 
+  // Fills in the same information about both ends of a connection as
+  // Accept() does, for a client socket that was accepted some other way
+  // (e.g., by an io_uring accept).  Returns false if "client_fd" isn't a
+  // connected socket.
+  bool GetConnectionInfo(int client_fd,
+                         std::string* const client_addr,
+                         uint16_t* const client_port,
+                         std::string* const client_dns_name,
+                         std::string* const server_addr,
+                         std::string* const server_dns_name) const;
+
  private:
+  // Formats the addresses of a connected client socket whose peer
+  // address is "addr" into the output parameters.
+  void DescribeConnection(int client_fd,
+                          const struct sockaddr* addr,
+                          std::string* const client_addr,
+                          uint16_t* const client_port,
+                          std::string* const client_dns_name,
+                          std::string* const server_addr,
+                          std::string* const server_dns_name) const;
+
   uint16_t port_;
   int listen_sock_fd_;
   int sock_family_;  // either AF_INET or AF_INET6 for ipv4 or ipv6/v4
+  bool nonblocking_;  // whether accepted sockets are non-blocking
+  bool reuse_port_;   // whether to set SO_REUSEPORT on the listening socket
 };
 
 }  // namespace hw4
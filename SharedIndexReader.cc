@@ -0,0 +1,1030 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <arpa/inet.h>  // for ntohl()
+#include <endian.h>     // for le32toh()
+#include <errno.h>      // for errno
+#include <fcntl.h>      // for open()
+#include <sys/mman.h>   // for mmap(), munmap()
+#include <sys/stat.h>   // for fstat()
+#include <unistd.h>     // for pread(), close()
+#include <algorithm>    // for std::min
+#include <atomic>       // for std::atomic
+#include <list>
+#include <string>
+#include <vector>
+
+#include "./SharedIndexReader.h"
+#include "./IndexLayoutV2.h"
+#include "./PostingsCodec.h"
+#include "./SortedSearch.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+  #include "libhw1/HashTable.h"
+}
+
+using hw3::BucketListHeader;
+using hw3::BucketRecord;
+using hw3::DocIDElementHeader;
+using hw3::DocIDElementPosition;
+using hw3::DoctableElementHeader;
+using hw3::ElementPositionRecord;
+using hw3::IndexFileHeader;
+using hw3::IndexFileOffset_t;
+using hw3::WordPostingsHeader;
+using std::list;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace hw4 {
+
+// The size of the blocks PreadIndexSource reads, and how many of them
+// each thread keeps.
+static const size_t kBlockBytes = 4096;
+static const uint32_t kBlocksPerThread = 8;
+
+// How many bytes at a time SharedIndexReader::Validate() checks.
+static const size_t kValidateChunkBytes = 64 * 1024;
+
+// A block of an index file, in a thread's PreadIndexSource buffer.
+struct CachedBlock {
+  uint64_t source;  // the id of the source it came from, or 0 if none
+  int64_t offset;   // where it starts in the file
+  unsigned char data[kBlockBytes];
+};
+static thread_local CachedBlock t_blocks[kBlocksPerThread];
+
+// The id of the next PreadIndexSource.  Ids start at one, so that
+// zero marks an empty block.
+static std::atomic<uint64_t> next_source_id(1);
+
+// Reads the "len" bytes at "offset" in "fd" into "buf", retrying short
+// reads.  Returns false on error or end of file.
+static bool PreadFully(int fd, unsigned char* buf, size_t len,
+                       int64_t offset) {
+  while (len > 0) {
+    ssize_t res = pread(fd, buf, len, offset);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    buf += res;
+    len -= res;
+    offset += res;
+  }
+  return true;
+}
+
+// Returns true if the "len" bytes at "offset" fit in a file of "size"
+// bytes.
+static bool InFile(int64_t offset, size_t len, size_t size) {
+  return offset >= 0 && static_cast<size_t>(offset) <= size &&
+         len <= size - offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MappedIndexSource
+///////////////////////////////////////////////////////////////////////////////
+MappedIndexSource::MappedIndexSource(const string& file_name)
+  : base_(nullptr), size_(0) {
+  // The mapping holds its own reference to the file, so we don't need
+  // to keep the descriptor open.
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base != MAP_FAILED) {
+      base_ = static_cast<const unsigned char*>(base);
+      size_ = st.st_size;
+    }
+  }
+  close(fd);
+}
+
+MappedIndexSource::~MappedIndexSource() {
+  if (base_ != nullptr)
+    munmap(const_cast<unsigned char*>(base_), size_);
+}
+
+const unsigned char* MappedIndexSource::Fetch(int64_t offset, size_t len,
+                                              unsigned char* scratch) const {
+  if (!InFile(offset, len, size_))
+    return nullptr;
+  return base_ + offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PreadIndexSource
+///////////////////////////////////////////////////////////////////////////////
+PreadIndexSource::PreadIndexSource(const string& file_name)
+  : fd_(-1), size_(0), id_(next_source_id.fetch_add(1)) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return;
+  }
+  fd_ = fd;
+  size_ = st.st_size;
+}
+
+PreadIndexSource::~PreadIndexSource() {
+  if (fd_ != -1)
+    close(fd_);
+}
+
+const unsigned char* PreadIndexSource::Fetch(int64_t offset, size_t len,
+                                             unsigned char* scratch) const {
+  if (!InFile(offset, len, size_))
+    return nullptr;
+
+  // Bytes that straddle a block boundary are read straight into the
+  // caller's scratch space.
+  int64_t block_offset = offset - offset % kBlockBytes;
+  if (NeedsScratch(offset, len)) {
+    if (!PreadFully(fd_, scratch, len, offset))
+      return nullptr;
+    return scratch;
+  }
+
+  // Otherwise they come from the block in this thread's buffer,
+  // reading it in if it isn't there already.
+  CachedBlock* block =
+    &t_blocks[(block_offset / kBlockBytes + id_) % kBlocksPerThread];
+  if (block->source != id_ || block->offset != block_offset) {
+    size_t block_len = std::min<size_t>(kBlockBytes, size_ - block_offset);
+    if (!PreadFully(fd_, block->data, block_len, block_offset)) {
+      block->source = 0;
+      return nullptr;
+    }
+    block->source = id_;
+    block->offset = block_offset;
+  }
+  return block->data + (offset - block_offset);
+}
+
+bool PreadIndexSource::NeedsScratch(int64_t offset, size_t len) const {
+  return offset % kBlockBytes + len > kBlockBytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Version 1 tables: the on-disk hash tables of LayoutStructs.h
+///////////////////////////////////////////////////////////////////////////////
+
+// Reads one of a version 1 file's hash tables; the base of the readers
+// of its three kinds of table.
+class HashTableReader {
+ public:
+  // Reads the hash table at "offset" in "index".
+  HashTableReader(const SharedIndexReader* index, IndexFileOffset_t offset)
+    : index_(index), offset_(offset) {
+    if (!index_->Read(offset_, &header_))
+      header_.num_buckets = 0;
+  }
+
+ protected:
+  // A chain of elements: the offset of its element position records,
+  // and how many there are.
+  struct Chain {
+    IndexFileOffset_t records;
+    int32_t num_records;
+  };
+
+  // Finds the chain that "hash_val" maps to.  Returns false if the
+  // table is malformed.
+  bool LookupChain(HTKey_t hash_val, Chain* const chain) const {
+    if (header_.num_buckets <= 0)
+      return false;
+    return GetChain(hash_val % header_.num_buckets, chain);
+  }
+
+  // Finds the chain of the "bucket"th bucket of the table.
+  bool GetChain(int32_t bucket, Chain* const chain) const {
+    // The bucket records follow the table's header, and each points at
+    // its chain's element position records.
+    BucketRecord rec;
+    int64_t rec_offset = static_cast<int64_t>(offset_) +
+                         sizeof(BucketListHeader) +
+                         static_cast<int64_t>(bucket) * sizeof(BucketRecord);
+    if (!index_->Read(rec_offset, &rec) || rec.chain_num_elements < 0)
+      return false;
+    chain->records = rec.position;
+    chain->num_records = rec.chain_num_elements;
+    return true;
+  }
+
+  // Sets "*element" to the offset of the "i"th element of "chain".
+  // Returns false if the record can't be read.
+  bool GetElement(const Chain& chain, int32_t i,
+                  IndexFileOffset_t* const element) const {
+    ElementPositionRecord rec;
+    if (!index_->Read(static_cast<int64_t>(chain.records) +
+                        static_cast<int64_t>(i) * sizeof(rec), &rec))
+      return false;
+    *element = rec.position;
+    return true;
+  }
+
+  // Returns the offsets of every element in the table.
+  vector<IndexFileOffset_t> GetElements() const {
+    vector<IndexFileOffset_t> elements;
+    for (int32_t b = 0; b < header_.num_buckets; b++) {
+      Chain chain;
+      if (!GetChain(b, &chain))
+        continue;
+      for (int32_t i = 0; i < chain.num_records; i++) {
+        IndexFileOffset_t element;
+        if (GetElement(chain, i, &element))
+          elements.push_back(element);
+      }
+    }
+    return elements;
+  }
+
+  const SharedIndexReader* index_;
+  IndexFileOffset_t offset_;
+  BucketListHeader header_;
+};
+
+class HashDocIDTableReader : public SharedDocIDTableReader,
+                             protected HashTableReader {
+ public:
+  HashDocIDTableReader(const SharedIndexReader* index,
+                       IndexFileOffset_t offset)
+    : HashTableReader(index, offset) { }
+
+  bool LookupDocID(const DocID_t& doc_id,
+                   list<DocPositionOffset_t>* const ret_val) const override {
+    Chain chain;
+    if (!LookupChain(doc_id, &chain))
+      return false;
+
+    for (int32_t i = 0; i < chain.num_records; i++) {
+      IndexFileOffset_t element;
+      DocIDElementHeader header;
+      if (!GetElement(chain, i, &element) ||
+          !index_->Read(element, &header) || header.doc_id != doc_id)
+        continue;
+
+      // The positions follow the element's header.
+      int64_t positions =
+        static_cast<int64_t>(element) + sizeof(DocIDElementHeader);
+      for (int32_t j = 0; j < header.num_positions; j++) {
+        DocIDElementPosition pos;
+        if (!index_->Read(positions + j * sizeof(pos), &pos))
+          return false;
+        ret_val->push_back(pos.position);
+      }
+      return true;
+    }
+    return false;
+  }
+
+  list<DocIDElementHeader> GetDocIDList() const override {
+    list<DocIDElementHeader> doc_ids;
+    for (IndexFileOffset_t element : GetElements()) {
+      DocIDElementHeader header;
+      if (index_->Read(element, &header))
+        doc_ids.push_back(header);
+    }
+    return doc_ids;
+  }
+};
+
+class HashIndexTableReader : public SharedIndexTableReader,
+                             protected HashTableReader {
+ public:
+  HashIndexTableReader(const SharedIndexReader* index,
+                       IndexFileOffset_t offset)
+    : HashTableReader(index, offset) { }
+
+  SharedDocIDTableReader* LookupWord(const string& word) const override {
+    HTKey_t hash_val = FNVHash64(
+        reinterpret_cast<unsigned char*>(const_cast<char*>(word.c_str())),
+        word.length());
+    Chain chain;
+    if (!LookupChain(hash_val, &chain))
+      return nullptr;
+
+    string scratch(word.length(), '\0');
+    for (int32_t i = 0; i < chain.num_records; i++) {
+      // Each element is a header, the word, and then the word's
+      // embedded docIDtable.
+      IndexFileOffset_t element;
+      WordPostingsHeader header;
+      if (!GetElement(chain, i, &element) ||
+          !index_->Read(element, &header) ||
+          static_cast<size_t>(header.word_bytes) != word.length())
+        continue;
+      int64_t word_offset =
+        static_cast<int64_t>(element) + sizeof(WordPostingsHeader);
+      const unsigned char* stored = index_->Fetch(
+          word_offset, word.length(),
+          reinterpret_cast<unsigned char*>(&scratch[0]));
+      if (stored == nullptr ||
+          memcmp(stored, word.data(), word.length()) != 0)
+        continue;
+      return new HashDocIDTableReader(index_,
+                                      word_offset + header.word_bytes);
+    }
+    return nullptr;
+  }
+
+  list<string> GetWordList() const override {
+    list<string> words;
+    for (IndexFileOffset_t element : GetElements()) {
+      WordPostingsHeader header;
+      int64_t word_offset =
+        static_cast<int64_t>(element) + sizeof(WordPostingsHeader);
+      if (!index_->Read(element, &header) || header.word_bytes < 0 ||
+          !index_->Contains(word_offset, header.word_bytes))
+        continue;
+      string scratch(header.word_bytes, '\0');
+      const unsigned char* bytes = index_->Fetch(
+          word_offset, scratch.length(),
+          reinterpret_cast<unsigned char*>(&scratch[0]));
+      if (bytes != nullptr)
+        words.emplace_back(reinterpret_cast<const char*>(bytes),
+                           scratch.length());
+    }
+    return words;
+  }
+};
+
+class HashDocTableReader : public SharedDocTableReader,
+                           protected HashTableReader {
+ public:
+  HashDocTableReader(const SharedIndexReader* index,
+                     IndexFileOffset_t offset)
+    : HashTableReader(index, offset) { }
+
+  bool LookupDocID(const DocID_t& doc_id,
+                   string* const ret_str) const override {
+    Chain chain;
+    if (!LookupChain(doc_id, &chain))
+      return false;
+
+    for (int32_t i = 0; i < chain.num_records; i++) {
+      IndexFileOffset_t element;
+      DoctableElementHeader header;
+      if (!GetElement(chain, i, &element) ||
+          !index_->Read(element, &header) || header.doc_id != doc_id)
+        continue;
+
+      // The file name follows the element's header.
+      int64_t name_offset =
+        static_cast<int64_t>(element) + sizeof(DoctableElementHeader);
+      if (header.file_name_bytes < 0 ||
+          !index_->Contains(name_offset, header.file_name_bytes))
+        return false;
+      string name(header.file_name_bytes, '\0');
+      const unsigned char* bytes = index_->Fetch(
+          name_offset, name.length(),
+          reinterpret_cast<unsigned char*>(&name[0]));
+      if (bytes == nullptr)
+        return false;
+      ret_str->assign(reinterpret_cast<const char*>(bytes), name.length());
+      return true;
+    }
+    return false;
+  }
+
+  list<DocID_t> GetDocIDList() const override {
+    list<DocID_t> doc_ids;
+    for (IndexFileOffset_t element : GetElements()) {
+      DoctableElementHeader header;
+      if (index_->Read(element, &header))
+        doc_ids.push_back(header.doc_id);
+    }
+    return doc_ids;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Version 2 tables: the sorted arrays of IndexLayoutV2.h
+///////////////////////////////////////////////////////////////////////////////
+
+class SortedDocIDTableReader : public SharedDocIDTableReader {
+ public:
+  // Reads the postings of the word whose dictionary entry is "word".
+  SortedDocIDTableReader(const SharedIndexReader* index,
+                         const WordEntryV2& word)
+    : index_(index), postings_(word.postings_offset),
+      positions_(word.postings_offset +
+                 static_cast<uint64_t>(word.num_docs) * sizeof(PostingV2)),
+      num_docs_(word.num_docs) { }
+
+  bool LookupDocID(const DocID_t& doc_id,
+                   list<DocPositionOffset_t>* const ret_val) const override {
+    PostingV2 posting;
+    bool ok = true;
+    uint64_t i = LowerBound(num_docs_, [&](uint64_t mid) {
+      ok = ok && GetPosting(mid, &posting);
+      return ok && posting.doc_id < doc_id;
+    });
+    if (!ok || i == num_docs_ || !GetPosting(i, &posting) ||
+        posting.doc_id != doc_id)
+      return false;
+
+    // The document's positions are a run of the word's positions
+    // array, so they come in one fetch.
+    int64_t offset = positions_ +
+      static_cast<int64_t>(posting.first_position) * sizeof(uint32_t);
+    size_t len = static_cast<size_t>(posting.num_positions) * sizeof(uint32_t);
+    if (!index_->Contains(offset, len))
+      return false;
+    vector<unsigned char> scratch;
+    const unsigned char* bytes = index_->Fetch(offset, len, &scratch);
+    if (bytes == nullptr)
+      return false;
+    for (size_t j = 0; j < len; j += sizeof(uint32_t)) {
+      uint32_t pos;
+      memcpy(&pos, bytes + j, sizeof(pos));
+      ret_val->push_back(le32toh(pos));
+    }
+    return true;
+  }
+
+  list<DocIDElementHeader> GetDocIDList() const override {
+    list<DocIDElementHeader> doc_ids;
+    for (uint64_t i = 0; i < num_docs_; i++) {
+      PostingV2 posting;
+      if (!GetPosting(i, &posting))
+        break;
+      doc_ids.emplace_back(posting.doc_id, posting.num_positions);
+    }
+    return doc_ids;
+  }
+
+  SharedPostingCursor* NewCursor() const override;
+
+ private:
+  friend class SortedPostingCursor;
+
+  bool GetPosting(uint64_t i, PostingV2* const posting) const {
+    return index_->Read(postings_ + i * sizeof(PostingV2), posting);
+  }
+
+  const SharedIndexReader* index_;
+  int64_t postings_;
+  int64_t positions_;
+  uint64_t num_docs_;
+};
+
+// A cursor over a SortedDocIDTableReader.  The PostingV2s are all the
+// same size, so the array itself serves as the skip list: SkipTo()
+// gallops through it.
+class SortedPostingCursor : public SharedPostingCursor {
+ public:
+  explicit SortedPostingCursor(const SortedDocIDTableReader* table)
+    : SharedPostingCursor(table->num_docs_), table_(table), i_(0) {
+    Load(0);
+  }
+
+  bool Next() override {
+    return valid_ && Load(i_ + 1);
+  }
+
+  bool SkipTo(DocID_t target) override {
+    if (!valid_ || doc_id_ >= target)
+      return valid_;
+    PostingV2 posting;
+    return Load(Gallop(i_ + 1, num_docs_, [&](uint64_t i) {
+      return table_->GetPosting(i, &posting) && posting.doc_id < target;
+    }));
+  }
+
+ private:
+  // Moves to the "i"th document.
+  bool Load(uint64_t i) {
+    PostingV2 posting;
+    i_ = i;
+    valid_ = i < num_docs_ && table_->GetPosting(i, &posting);
+    if (valid_) {
+      doc_id_ = posting.doc_id;
+      num_positions_ = posting.num_positions;
+    }
+    return valid_;
+  }
+
+  const SortedDocIDTableReader* table_;
+  uint64_t i_;
+};
+
+SharedPostingCursor* SortedDocIDTableReader::NewCursor() const {
+  return new SortedPostingCursor(this);
+}
+
+// Reads the postings of a word in a file with kCompressedPostingsV2.
+// Each lookup decodes a single block, found by binary search of the
+// blocks' headers.
+class CompressedDocIDTableReader : public SharedDocIDTableReader {
+ public:
+  // Reads the postings of the word whose dictionary entry is "word".
+  CompressedDocIDTableReader(const SharedIndexReader* index,
+                             const WordEntryV2& word)
+    : index_(index), postings_(word.postings_offset),
+      num_docs_(word.num_docs),
+      num_blocks_((num_docs_ + kPostingsPerBlock - 1) / kPostingsPerBlock) { }
+
+  bool LookupDocID(const DocID_t& doc_id,
+                   list<DocPositionOffset_t>* const ret_val) const override {
+    PostingBlockV2 header;
+    bool ok = true;
+    uint64_t b = LowerBound(num_blocks_, [&](uint64_t mid) {
+      ok = ok && GetBlockHeader(mid, &header);
+      return ok && header.max_doc_id < doc_id;
+    });
+    PostingBlock block;
+    if (!ok || b == num_blocks_ || !DecodeBlock(b, &block))
+      return false;
+
+    size_t first_position = 0;
+    for (size_t i = 0; i < block.doc_ids.size(); i++) {
+      if (block.doc_ids[i] == doc_id) {
+        ret_val->insert(ret_val->end(),
+                        block.positions.begin() + first_position,
+                        block.positions.begin() + first_position +
+                          block.num_positions[i]);
+        return true;
+      }
+      first_position += block.num_positions[i];
+    }
+    return false;
+  }
+
+  list<DocIDElementHeader> GetDocIDList() const override {
+    list<DocIDElementHeader> doc_ids;
+    PostingBlock block;
+    for (uint64_t b = 0; b < num_blocks_ && DecodeBlock(b, &block); b++) {
+      for (size_t i = 0; i < block.doc_ids.size(); i++)
+        doc_ids.emplace_back(block.doc_ids[i], block.num_positions[i]);
+    }
+    return doc_ids;
+  }
+
+  SharedPostingCursor* NewCursor() const override;
+
+ private:
+  friend class CompressedPostingCursor;
+
+  bool GetBlockHeader(uint64_t b, PostingBlockV2* const header) const {
+    return index_->Read(postings_ + b * sizeof(PostingBlockV2), header);
+  }
+
+  // Decodes the "b"th block into "block", without its positions unless
+  // "positions" is true.  Returns false if it's malformed.
+  bool DecodeBlock(uint64_t b, PostingBlock* const block,
+                   bool positions = true) const {
+    PostingBlockV2 header, prev;
+    prev.max_doc_id = 0;
+    if (!GetBlockHeader(b, &header) ||
+        (b > 0 && !GetBlockHeader(b - 1, &prev)) ||
+        header.num_docs > kPostingsPerBlock ||
+        !index_->Contains(postings_ + header.offset, header.bytes))
+      return false;
+    vector<unsigned char> scratch;
+    const unsigned char* bytes = index_->Fetch(postings_ + header.offset,
+                                               header.bytes, &scratch);
+    return bytes != nullptr &&
+           DecodePostingBlock(bytes, header.bytes, prev.max_doc_id,
+                              header.num_docs, block, positions);
+  }
+
+  const SharedIndexReader* index_;
+  int64_t postings_;
+  uint64_t num_docs_;
+  uint64_t num_blocks_;
+};
+
+// A cursor over a CompressedDocIDTableReader.  The block headers are
+// its skip entries, one every kPostingsPerBlock documents: SkipTo()
+// gallops over them to the one block that might hold the target, and
+// decodes only that block, leaving out its positions.
+class CompressedPostingCursor : public SharedPostingCursor {
+ public:
+  explicit CompressedPostingCursor(const CompressedDocIDTableReader* table)
+    : SharedPostingCursor(table->num_docs_), table_(table), b_(0), i_(0) {
+    LoadBlock(0);
+  }
+
+  bool Next() override {
+    if (!valid_)
+      return false;
+    if (i_ + 1 < block_.doc_ids.size())
+      return Load(i_ + 1);
+    return LoadBlock(b_ + 1);
+  }
+
+  bool SkipTo(DocID_t target) override {
+    if (!valid_ || doc_id_ >= target)
+      return valid_;
+    if (block_.doc_ids.back() < target) {
+      PostingBlockV2 header;
+      uint64_t b = Gallop(b_ + 1, table_->num_blocks_, [&](uint64_t i) {
+        return table_->GetBlockHeader(i, &header) &&
+               header.max_doc_id < target;
+      });
+      if (!LoadBlock(b))
+        return false;
+    }
+    return Load(std::lower_bound(block_.doc_ids.begin() + i_,
+                                 block_.doc_ids.end(), target) -
+                block_.doc_ids.begin());
+  }
+
+ private:
+  // Moves to the first document of the "b"th block.
+  bool LoadBlock(uint64_t b) {
+    b_ = b;
+    valid_ = b < table_->num_blocks_ &&
+             table_->DecodeBlock(b, &block_, false);
+    return valid_ && Load(0);
+  }
+
+  // Moves to the "i"th document of the current block.
+  bool Load(size_t i) {
+    i_ = i;
+    valid_ = i < block_.doc_ids.size();
+    if (valid_) {
+      doc_id_ = block_.doc_ids[i];
+      num_positions_ = block_.num_positions[i];
+    }
+    return valid_;
+  }
+
+  const CompressedDocIDTableReader* table_;
+  PostingBlock block_;
+  uint64_t b_;
+  size_t i_;
+};
+
+SharedPostingCursor* CompressedDocIDTableReader::NewCursor() const {
+  return new CompressedPostingCursor(this);
+}
+
+class SortedIndexTableReader : public SharedIndexTableReader {
+ public:
+  // Reads the dictionary section at "offset" in "index".
+  SortedIndexTableReader(const SharedIndexReader* index, int64_t offset)
+    : index_(index), entries_(offset + sizeof(DictionaryHeaderV2)) {
+    DictionaryHeaderV2 header;
+    num_words_ = index_->Read(offset, &header) ? header.num_words : 0;
+  }
+
+  SharedDocIDTableReader* LookupWord(const string& word) const override {
+    WordEntryV2 entry;
+    bool ok = true;
+    uint64_t i = LowerBound(num_words_, [&](uint64_t mid) {
+      return GetWord(mid, &entry) && CompareWord(entry, word, &ok) < 0;
+    });
+    if (!ok || i == num_words_ || !GetWord(i, &entry) ||
+        CompareWord(entry, word, &ok) != 0 || !ok)
+      return nullptr;
+    if (index_->features() & kCompressedPostingsV2)
+      return new CompressedDocIDTableReader(index_, entry);
+    return new SortedDocIDTableReader(index_, entry);
+  }
+
+  list<string> GetWordList() const override {
+    list<string> words;
+    for (uint64_t i = 0; i < num_words_; i++) {
+      WordEntryV2 entry;
+      if (!GetWord(i, &entry))
+        break;
+      if (!index_->Contains(entry.word_offset, entry.word_bytes))
+        continue;
+      string scratch(entry.word_bytes, '\0');
+      const unsigned char* bytes = index_->Fetch(
+          entry.word_offset, scratch.length(),
+          reinterpret_cast<unsigned char*>(&scratch[0]));
+      if (bytes != nullptr)
+        words.emplace_back(reinterpret_cast<const char*>(bytes),
+                           scratch.length());
+    }
+    return words;
+  }
+
+ private:
+  bool GetWord(uint64_t i, WordEntryV2* const entry) const {
+    return index_->Read(entries_ + i * sizeof(WordEntryV2), entry);
+  }
+
+  // Compares the word of "entry" with "word" as unsigned bytes,
+  // returning less than, equal to or greater than zero as memcmp()
+  // does.  Clears "*ok" if the word can't be read.
+  int CompareWord(const WordEntryV2& entry, const string& word,
+                  bool* const ok) const {
+    if (!index_->Contains(entry.word_offset, entry.word_bytes)) {
+      *ok = false;
+      return 0;
+    }
+    string scratch(entry.word_bytes, '\0');
+    const unsigned char* stored = index_->Fetch(
+        entry.word_offset, scratch.length(),
+        reinterpret_cast<unsigned char*>(&scratch[0]));
+    if (stored == nullptr) {
+      *ok = false;
+      return 0;
+    }
+    size_t len = std::min<size_t>(entry.word_bytes, word.length());
+    int cmp = memcmp(stored, word.data(), len);
+    if (cmp != 0)
+      return cmp;
+    if (entry.word_bytes == word.length())
+      return 0;
+    return entry.word_bytes < word.length() ? -1 : 1;
+  }
+
+  const SharedIndexReader* index_;
+  int64_t entries_;
+  uint64_t num_words_;
+};
+
+class SortedDocTableReader : public SharedDocTableReader {
+ public:
+  // Reads the doctable section at "offset" in "index".
+  SortedDocTableReader(const SharedIndexReader* index, int64_t offset)
+    : index_(index), entries_(offset + sizeof(DocTableHeaderV2)) {
+    DocTableHeaderV2 header;
+    num_docs_ = index_->Read(offset, &header) ? header.num_docs : 0;
+  }
+
+  bool LookupDocID(const DocID_t& doc_id,
+                   string* const ret_str) const override {
+    DocEntryV2 entry;
+    bool ok = true;
+    uint64_t i = LowerBound(num_docs_, [&](uint64_t mid) {
+      ok = ok && GetDoc(mid, &entry);
+      return ok && entry.doc_id < doc_id;
+    });
+    if (!ok || i == num_docs_ || !GetDoc(i, &entry) ||
+        entry.doc_id != doc_id ||
+        !index_->Contains(entry.name_offset, entry.name_bytes))
+      return false;
+
+    string name(entry.name_bytes, '\0');
+    const unsigned char* bytes = index_->Fetch(
+        entry.name_offset, name.length(),
+        reinterpret_cast<unsigned char*>(&name[0]));
+    if (bytes == nullptr)
+      return false;
+    ret_str->assign(reinterpret_cast<const char*>(bytes), name.length());
+    return true;
+  }
+
+  list<DocID_t> GetDocIDList() const override {
+    list<DocID_t> doc_ids;
+    for (uint64_t i = 0; i < num_docs_; i++) {
+      DocEntryV2 entry;
+      if (!GetDoc(i, &entry))
+        break;
+      doc_ids.push_back(entry.doc_id);
+    }
+    return doc_ids;
+  }
+
+ private:
+  bool GetDoc(uint64_t i, DocEntryV2* const entry) const {
+    return index_->Read(entries_ + i * sizeof(DocEntryV2), entry);
+  }
+
+  const SharedIndexReader* index_;
+  int64_t entries_;
+  uint64_t num_docs_;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// SharedIndexReader
+///////////////////////////////////////////////////////////////////////////////
+
+// Returns the format version that the first four bytes of an index
+// file, "magic", announce, or 0 if neither.
+static int VersionOf(const unsigned char* magic) {
+  uint32_t word;
+  memcpy(&word, magic, sizeof(word));
+  if (ntohl(word) == hw3::kMagicNumber)
+    return 1;
+  if (le32toh(word) == kIndexMagicV2)
+    return 2;
+  return 0;
+}
+
+int SharedIndexReader::FileVersion(const string& file_name) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1)
+    return 0;
+  unsigned char magic[sizeof(uint32_t)];
+  bool ok = PreadFully(fd, magic, sizeof(magic), 0);
+  close(fd);
+  return ok ? VersionOf(magic) : 0;
+}
+
+bool SharedIndexReader::Open(const string& file_name, Access access,
+                             bool validate) {
+  if (access == kMmap) {
+    MappedIndexSource* source = new MappedIndexSource(file_name);
+    source_.reset(source);
+    if (!source->ok())
+      return false;
+  } else {
+    PreadIndexSource* source = new PreadIndexSource(file_name);
+    source_.reset(source);
+    if (!source->ok())
+      return false;
+  }
+
+  unsigned char scratch[sizeof(uint32_t)];
+  const unsigned char* magic = Fetch(0, sizeof(scratch), scratch);
+  version_ = magic == nullptr ? 0 : VersionOf(magic);
+  if (version_ == 1)
+    return OpenV1(validate);
+  if (version_ == 2)
+    return OpenV2(validate);
+  return false;
+}
+
+bool SharedIndexReader::OpenV1(bool validate) {
+  // Check that the tables the header describes fit in the file.
+  IndexFileHeader header;
+  if (!Read(0, &header))
+    return false;
+  int64_t tables_bytes = static_cast<int64_t>(header.doctable_bytes) +
+                         header.index_bytes;
+  if (header.doctable_bytes < 0 || header.index_bytes < 0 ||
+      !InFile(sizeof(IndexFileHeader), tables_bytes, source_->size()))
+    return false;
+  doctable_offset_ = sizeof(IndexFileHeader);
+  index_offset_ = doctable_offset_ + header.doctable_bytes;
+
+  // The checksum covers the tables.
+  return !validate ||
+         Validate(sizeof(IndexFileHeader),
+                  sizeof(IndexFileHeader) + tables_bytes, header.checksum);
+}
+
+bool SharedIndexReader::OpenV2(bool validate) {
+  IndexFileHeaderV2 header;
+  if (!Read(0, &header) || header.version != kIndexVersion2 ||
+      (header.features & ~kKnownIndexFeaturesV2) != 0 ||
+      header.file_bytes != source_->size())
+    return false;
+  features_ = header.features;
+
+  // Find the sections we read, checking that they fit in the file and
+  // skipping any we don't know.
+  doctable_offset_ = index_offset_ = -1;
+  for (uint32_t i = 0; i < header.num_sections; i++) {
+    IndexSectionV2 section;
+    if (!Read(sizeof(header) + static_cast<int64_t>(i) * sizeof(section),
+              &section))
+      return false;
+    int64_t offset = static_cast<int64_t>(section.offset);
+    if (!InFile(offset, section.bytes, source_->size()))
+      return false;
+    if (section.type == kDocTableSection)
+      doctable_offset_ = offset;
+    else if (section.type == kDictionarySection)
+      index_offset_ = offset;
+  }
+  if (doctable_offset_ == -1 || index_offset_ == -1)
+    return false;
+
+  // The checksum covers everything after the header.
+  return !validate ||
+         Validate(sizeof(header), header.file_bytes, header.checksum);
+}
+
+bool SharedIndexReader::Validate(int64_t begin, int64_t end,
+                                 uint32_t checksum) const {
+  hw3::CRC32 crc;
+  vector<unsigned char> scratch(kValidateChunkBytes);
+  for (int64_t offset = begin; offset < end; ) {
+    size_t len = std::min<int64_t>(kValidateChunkBytes, end - offset);
+    const unsigned char* bytes = Fetch(offset, len, scratch.data());
+    if (bytes == nullptr)
+      return false;
+    for (size_t i = 0; i < len; i++)
+      crc.FoldByteIntoCRC(bytes[i]);
+    offset += len;
+  }
+  return crc.GetFinalCRC() == checksum;
+}
+
+bool SharedIndexReader::Contains(int64_t offset, size_t len) const {
+  return InFile(offset, len, source_->size());
+}
+
+SharedDocTableReader* SharedIndexReader::NewDocTableReader() const {
+  if (version_ == 2)
+    return new SortedDocTableReader(this, doctable_offset_);
+  return new HashDocTableReader(this, doctable_offset_);
+}
+
+SharedIndexTableReader* SharedIndexReader::NewIndexTableReader() const {
+  if (version_ == 2)
+    return new SortedIndexTableReader(this, index_offset_);
+  return new HashIndexTableReader(this, index_offset_);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SharedQueryProcessor
+///////////////////////////////////////////////////////////////////////////////
+SharedQueryProcessor::SharedQueryProcessor(const list<string>& index_list,
+                                           SharedIndexReader::Access access,
+                                           bool validate) {
+  for (const string& file_name : index_list) {
+    SharedIndexReader* reader = new SharedIndexReader;
+    Verify333(reader->Open(file_name, access, validate));
+    readers_.emplace_back(reader);
+    dtr_array_.emplace_back(reader->NewDocTableReader());
+    itr_array_.emplace_back(reader->NewIndexTableReader());
+  }
+}
+
+bool SharedQueryProcessor::ProcessIndex(
+    int index, const vector<string>& query, const QueryDeadline& deadline,
+    vector<hw3::QueryProcessor::QueryResult>* const results) const {
+  if (readers_[index]->version() >= 2)
+    return IntersectIndex(index, query, deadline, results);
+  return EvaluateIndex(*itr_array_[index], *dtr_array_[index], query,
+                       deadline, results);
+}
+
+bool SharedQueryProcessor::IntersectIndex(
+    int index, const vector<string>& query, const QueryDeadline& deadline,
+    vector<hw3::QueryProcessor::QueryResult>* const results) const {
+  if (deadline.Expired())
+    return false;
+
+  // Open a cursor on every word's postings; a missing word means no
+  // matches.  The tables must outlive their cursors.
+  vector<unique_ptr<SharedDocIDTableReader>> tables;
+  vector<unique_ptr<SharedPostingCursor>> cursors;
+  for (const string& word : query) {
+    tables.emplace_back(itr_array_[index]->LookupWord(word));
+    if (tables.back() == nullptr)
+      return true;
+    cursors.emplace_back(tables.back()->NewCursor());
+    if (cursors.back() == nullptr || !cursors.back()->valid())
+      return true;
+  }
+
+  // The rarest word leads.  Each of its documents is a candidate, which
+  // every other word, rarest first, must also contain; the first that
+  // doesn't names the next candidate worth trying.
+  std::sort(cursors.begin(), cursors.end(),
+            [](const unique_ptr<SharedPostingCursor>& a,
+               const unique_ptr<SharedPostingCursor>& b) {
+              return a->num_docs() < b->num_docs();
+            });
+  SharedPostingCursor* lead = cursors[0].get();
+  list<DocIDElementHeader> matches;
+  int checked = 0;
+  while (lead->valid()) {
+    if (++checked % kDocsPerDeadlineCheck == 0 && deadline.Expired())
+      return false;
+    DocID_t doc_id = lead->doc_id();
+    int32_t rank = lead->num_positions();
+    size_t w = 1;
+    for (; w < cursors.size(); w++) {
+      if (!cursors[w]->SkipTo(doc_id) || cursors[w]->doc_id() != doc_id)
+        break;
+      rank += cursors[w]->num_positions();
+    }
+    if (w == cursors.size()) {
+      matches.emplace_back(doc_id, rank);
+      lead->Next();
+    } else if (cursors[w]->valid()) {
+      lead->SkipTo(cursors[w]->doc_id());
+    } else {
+      break;  // one of the words has no more documents
+    }
+  }
+
+  for (const DocIDElementHeader& match : matches) {
+    hw3::QueryProcessor::QueryResult result;
+    if (!dtr_array_[index]->LookupDocID(match.doc_id,
+                                        &result.document_name))
+      continue;
+    result.rank = match.num_positions;
+    results->push_back(result);
+  }
+  return true;
+}
+
+}  // namespace hw4
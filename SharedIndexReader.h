@@ -0,0 +1,347 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_SHAREDINDEXREADER_H_
+#define HW4_SHAREDINDEXREADER_H_
+
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for int64_t, etc.
+#include <string.h>  // for memcpy()
+#include <list>      // for std::list
+#include <memory>    // for std::unique_ptr
+#include <string>    // for std::string
+#include <vector>    // for std::vector
+
+#include "./DeadlineQueryProcessor.h"
+#include "./libhw3/LayoutStructs.h"
+
+namespace hw4 {
+
+// An IndexSource gives the shared index readers the bytes of an index
+// file.  Sources never change the file's offset or any other state the
+// callers can see, so any number of threads may read through one
+// source at once.
+class IndexSource {
+ public:
+  virtual ~IndexSource() { }
+
+  // Returns the size of the file.
+  virtual size_t size() const = 0;
+
+  // Returns a pointer to the "len" bytes at "offset" in the file, or
+  // nullptr if they run past the end of it or can't be read.  The
+  // source either points into memory of its own or copies the bytes
+  // into "scratch", which must have room for "len" bytes.  Either way
+  // the bytes are only good until the calling thread's next Fetch().
+  virtual const unsigned char* Fetch(int64_t offset, size_t len,
+                                     unsigned char* scratch) const = 0;
+
+  // Returns true if Fetch() of the "len" bytes at "offset" would copy
+  // them into its scratch space, so that callers only make room for
+  // bytes that actually need it.
+  virtual bool NeedsScratch(int64_t offset, size_t len) const = 0;
+};
+
+// An IndexSource over a read-only mmap() of the whole file, so that a
+// fetch is just pointer arithmetic once the pages are resident.
+class MappedIndexSource : public IndexSource {
+ public:
+  // Maps "file_name".  Check ok() to see if that worked.
+  explicit MappedIndexSource(const std::string& file_name);
+  virtual ~MappedIndexSource();
+
+  // Returns true if the file was mapped.
+  bool ok() const { return base_ != nullptr; }
+
+  size_t size() const override { return size_; }
+  const unsigned char* Fetch(int64_t offset, size_t len,
+                             unsigned char* scratch) const override;
+  bool NeedsScratch(int64_t offset, size_t len) const override {
+    return false;
+  }
+
+ private:
+  const unsigned char* base_;
+  size_t size_;
+};
+
+// An IndexSource that reads the file with pread() on one descriptor
+// that every thread shares, so the number of descriptors doesn't grow
+// with the number of threads querying.  Each thread keeps a few recent
+// blocks of the file in a small buffer of its own, shared by every
+// PreadIndexSource, so that the several small records of one lookup
+// usually cost a single pread().
+class PreadIndexSource : public IndexSource {
+ public:
+  // Opens "file_name".  Check ok() to see if that worked.
+  explicit PreadIndexSource(const std::string& file_name);
+  virtual ~PreadIndexSource();
+
+  // Returns true if the file was opened.
+  bool ok() const { return fd_ != -1; }
+
+  size_t size() const override { return size_; }
+  const unsigned char* Fetch(int64_t offset, size_t len,
+                             unsigned char* scratch) const override;
+  bool NeedsScratch(int64_t offset, size_t len) const override;
+
+ private:
+  int fd_;
+  size_t size_;
+
+  // Tells this source's blocks apart in the per-thread buffers from
+  // those of any source that lived at the same address before.
+  uint64_t id_;
+};
+
+class SharedDocTableReader;
+class SharedIndexTableReader;
+
+// A SharedIndexReader is the thread-safe counterpart of
+// hw3::FileIndexReader.  Rather than seeking and reading through a
+// FILE*, it and the table readers it manufactures read the index file
+// through an IndexSource, either a read-only mmap() of the file or
+// pread() on a single descriptor, and decode its records as they go.
+//
+// It reads both versions of the index file format: version 1, whose
+// tables are the on-disk hash tables of libhw3's LayoutStructs.h, and
+// version 2 (see IndexLayoutV2.h), whose tables are sorted arrays.
+// The table readers hide the difference.
+//
+// The readers hold no cursor or buffer of their own, so any number of
+// threads may share one SharedIndexReader and the readers it made.
+class SharedIndexReader {
+ public:
+  // How to read the file.
+  enum Access {
+    kMmap,   // through a MappedIndexSource
+    kPread,  // through a PreadIndexSource
+  };
+
+  SharedIndexReader() : version_(0), features_(0) { }
+  virtual ~SharedIndexReader() { }
+
+  // Opens the index file "file_name" for reading as "access" says,
+  // checking its header, and, if "validate" is true, its checksum.
+  // Returns false if the file can't be read or isn't a well-formed
+  // index file.
+  bool Open(const std::string& file_name, Access access,
+            bool validate = true);
+
+  // Returns the format version of the open file: 1 or 2.
+  int version() const { return version_; }
+
+  // Returns the feature flags of the open file (see IndexLayoutV2.h);
+  // always zero for version 1.
+  uint64_t features() const { return features_; }
+
+  // Returns the format version of the index file "file_name", judging
+  // by its magic number, or 0 if it isn't an index file at all.
+  static int FileVersion(const std::string& file_name);
+
+  // Manufacture readers for the file's docid-->filename table and its
+  // word-->docIDtable index.  The caller must delete them, before the
+  // SharedIndexReader.
+  SharedDocTableReader* NewDocTableReader() const;
+  SharedIndexTableReader* NewIndexTableReader() const;
+
+  // Returns true if the "len" bytes at "offset" lie within the file.
+  // Readers check this before making room for bytes whose length the
+  // file itself gives.
+  bool Contains(int64_t offset, size_t len) const;
+
+  // Fetches the "len" bytes at "offset" in the file, as
+  // IndexSource::Fetch() does.
+  const unsigned char* Fetch(int64_t offset, size_t len,
+                             unsigned char* scratch) const {
+    return source_->Fetch(offset, len, scratch);
+  }
+
+  // Like Fetch(), but grows "scratch" to fit the bytes only if the
+  // source has to copy them, so that a fetch from a mapped file never
+  // allocates.  Callers can keep "scratch" around to reuse it.
+  const unsigned char* Fetch(int64_t offset, size_t len,
+                             std::vector<unsigned char>* scratch) const {
+    if (!Contains(offset, len))
+      return nullptr;
+    if (source_->NeedsScratch(offset, len) && scratch->size() < len)
+      scratch->resize(len);
+    return source_->Fetch(offset, len, scratch->data());
+  }
+
+  // Decodes the record at "offset", one of those in LayoutStructs.h or
+  // IndexLayoutV2.h, into "record", in host order.  Returns false if it
+  // runs past the end of the file.
+  template <typename T> bool Read(int64_t offset, T* const record) const {
+    const unsigned char* p = source_->Fetch(
+        offset, sizeof(T), reinterpret_cast<unsigned char*>(record));
+    if (p == nullptr)
+      return false;
+    if (p != reinterpret_cast<unsigned char*>(record))
+      memcpy(record, p, sizeof(T));
+    record->ToHostFormat();
+    return true;
+  }
+
+ private:
+  // Check the header of a version 1 or version 2 file, and find its
+  // tables.  Return false if the file is malformed.
+  bool OpenV1(bool validate);
+  bool OpenV2(bool validate);
+
+  // Returns true if the CRC32 of the bytes in ["begin", "end") is
+  // "checksum".
+  bool Validate(int64_t begin, int64_t end, uint32_t checksum) const;
+
+  std::unique_ptr<IndexSource> source_;
+  int version_;
+  uint64_t features_;
+
+  // Where the docid-->filename table and the word index start: in a
+  // version 2 file, the doctable and dictionary sections.
+  int64_t doctable_offset_;
+  int64_t index_offset_;
+
+  SharedIndexReader(const SharedIndexReader&) = delete;
+  SharedIndexReader& operator=(const SharedIndexReader&) = delete;
+};
+
+// Walks the postings of one word in docID order.  Version 2 files keep
+// postings sorted by docID, so a cursor can skip ahead to a docID
+// without looking at every document in between.
+class SharedPostingCursor {
+ public:
+  // Starts out on no document; the maker moves it onto the first.
+  explicit SharedPostingCursor(uint64_t num_docs)
+    : num_docs_(num_docs), valid_(false), doc_id_(0), num_positions_(0) { }
+  virtual ~SharedPostingCursor() { }
+
+  // Returns the number of documents the word appears in.
+  uint64_t num_docs() const { return num_docs_; }
+
+  // Returns true while the cursor is on a document, and false once it
+  // has run off the end of the postings (or found them malformed).
+  bool valid() const { return valid_; }
+
+  // Return the docID of the current document, and the number of times
+  // the word appears in it.
+  DocID_t doc_id() const { return doc_id_; }
+  int32_t num_positions() const { return num_positions_; }
+
+  // Moves to the next document.  Returns valid().
+  virtual bool Next() = 0;
+
+  // Moves forward to the first document whose docID is at least
+  // "target", staying put if the current one is.  Returns valid().
+  virtual bool SkipTo(DocID_t target) = 0;
+
+ protected:
+  uint64_t num_docs_;
+  bool valid_;
+  DocID_t doc_id_;
+  int32_t num_positions_;
+};
+
+// Reads the docid-->positions table of one word; the counterpart of
+// hw3::DocIDTableReader.
+class SharedDocIDTableReader {
+ public:
+  virtual ~SharedDocIDTableReader() { }
+
+  // Returns a new'ed cursor over the table, on its first document, or
+  // nullptr if the table isn't kept in docID order (as in version 1
+  // files).  The caller must delete it, before the table reader.
+  virtual SharedPostingCursor* NewCursor() const { return nullptr; }
+
+  // Looks up "doc_id", storing the positions of the word in that
+  // document through "ret_val".  Returns false if it isn't there.
+  virtual bool LookupDocID(const DocID_t& doc_id,
+                           std::list<DocPositionOffset_t>* const ret_val)
+    const = 0;
+
+  // Returns the docID and number of positions of every document in
+  // the table.
+  virtual std::list<hw3::DocIDElementHeader> GetDocIDList() const = 0;
+};
+
+// Reads the word-->docIDtable index of a file; the counterpart of
+// hw3::IndexTableReader.
+class SharedIndexTableReader {
+ public:
+  virtual ~SharedIndexTableReader() { }
+
+  // Looks up "word", returning a new'ed reader for its docIDtable, or
+  // nullptr if the word isn't in the index.  The caller must delete it.
+  virtual SharedDocIDTableReader* LookupWord(const std::string& word)
+    const = 0;
+
+  // Returns every word in the index.
+  virtual std::list<std::string> GetWordList() const = 0;
+};
+
+// Reads the docid-->filename table of a file; the counterpart of
+// hw3::DocTableReader.
+class SharedDocTableReader {
+ public:
+  virtual ~SharedDocTableReader() { }
+
+  // Looks up "doc_id", storing its file name through "ret_str".
+  // Returns false if it isn't there.
+  virtual bool LookupDocID(const DocID_t& doc_id,
+                           std::string* const ret_str) const = 0;
+
+  // Returns the docID of every document in the table.
+  virtual std::list<DocID_t> GetDocIDList() const = 0;
+};
+
+// A SharedQueryProcessor is the QueryEngine over SharedIndexReaders.
+// Unlike a DeadlineQueryProcessor, it is thread-safe, so the whole
+// server can share one.
+//
+// Against a version 2 file, it intersects the query's words with
+// SharedPostingCursors: it walks the postings of the rarest word and
+// skips each other word's cursor forward to every candidate, so a
+// query costs about as much as its shortest posting list, however
+// common the other words are.  Version 1 files aren't kept in docID
+// order, so against those it evaluates queries as EvaluateIndex()
+// does.
+class SharedQueryProcessor : public QueryEngine {
+ public:
+  // Opens every index file in "index_list" for reading as "access"
+  // says, validating their checksums if "validate" is true.  Dies if
+  // one can't be read.
+  SharedQueryProcessor(const std::list<std::string>& index_list,
+                       SharedIndexReader::Access access,
+                       bool validate = true);
+  virtual ~SharedQueryProcessor() { }
+
+ protected:
+  int num_indices() const override { return readers_.size(); }
+  bool ProcessIndex(int index, const std::vector<std::string>& query,
+                    const QueryDeadline& deadline,
+                    std::vector<hw3::QueryProcessor::QueryResult>* const
+                      results) const override;
+
+ private:
+  // Like ProcessIndex(), but through SharedPostingCursors.
+  bool IntersectIndex(int index, const std::vector<std::string>& query,
+                      const QueryDeadline& deadline,
+                      std::vector<hw3::QueryProcessor::QueryResult>* const
+                        results) const;
+
+  std::vector<std::unique_ptr<SharedIndexReader>> readers_;
+  std::vector<std::unique_ptr<SharedDocTableReader>> dtr_array_;
+  std::vector<std::unique_ptr<SharedIndexTableReader>> itr_array_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_SHAREDINDEXREADER_H_
@@ -0,0 +1,63 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_SORTEDSEARCH_H_
+#define HW4_SORTEDSEARCH_H_
+
+#include <stdint.h>   // for uint64_t
+#include <algorithm>  // for std::min
+
+namespace hw4 {
+
+// Searches over sorted arrays, shared by the index readers.  The
+// arrays are described by predicates rather than iterators, so that the
+// same search works on an array in memory and on one in an index file,
+// read entry by entry.
+
+// Returns the index of the first of the "num" entries of a sorted array
+// for which "less(i)" is false, where "less(i)" says whether the "i"th
+// entry sorts before the key.
+template <typename Less> uint64_t LowerBound(uint64_t num, Less less) {
+  uint64_t lo = 0, hi = num;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    if (less(mid))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Like LowerBound(), but searches only the entries from "from" on, and
+// gallops: it probes "from", "from" + 2, "from" + 6, "from" + 14, ...
+// (each step twice as long as the one before) until it passes the key,
+// then binary searches the last step.  So skipping "n" entries costs
+// O(log n) probes, however long the array.
+template <typename Less> uint64_t Gallop(uint64_t from, uint64_t num,
+                                         Less less) {
+  // Every entry before "lo" sorts before the key.
+  uint64_t lo = from;
+  for (uint64_t step = 1; lo < num; step *= 2) {
+    uint64_t probe = std::min(lo + step - 1, num - 1);
+    if (!less(probe)) {
+      return lo + LowerBound(probe - lo, [&](uint64_t i) {
+        return less(lo + i);
+      });
+    }
+    lo = probe + 1;
+  }
+  return num;
+}
+
+}  // namespace hw4
+
+#endif  // HW4_SORTEDSEARCH_H_
@@ -0,0 +1,176 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <sys/stat.h>   // for stat()
+#include <time.h>       // for clock_gettime()
+#include <functional>   // for std::hash
+#include <string>
+
+#include "./StaticFileCache.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+using std::shared_ptr;
+using std::string;
+
+namespace hw4 {
+
+// Returns the time on the monotonic clock, in nanoseconds.
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+StaticFileCache::StaticFileCache(size_t max_bytes, uint32_t num_shards,
+                                 uint32_t revalidate_ms)
+  : revalidate_ns_(static_cast<int64_t>(revalidate_ms) * 1000000),
+    hits_(0), misses_(0), evictions_(0), invalidations_(0) {
+  if (num_shards == 0)
+    num_shards = 1;
+  shard_max_bytes_ = max_bytes / num_shards;
+  for (uint32_t i = 0; i < num_shards; i++) {
+    Shard* shard = new Shard;
+    Verify333(pthread_mutex_init(&shard->lock, nullptr) == 0);
+    shard->bytes = 0;
+    shards_.push_back(shard);
+  }
+}
+
+StaticFileCache::~StaticFileCache() {
+  for (Shard* shard : shards_) {
+    Verify333(pthread_mutex_destroy(&shard->lock) == 0);
+    delete shard;
+  }
+}
+
+shared_ptr<const string> StaticFileCache::Lookup(const string& path) {
+  Shard* shard = ShardFor(path);
+  shared_ptr<const string> response;
+  bool revalidate = false;
+  Entry identity;
+
+  Verify333(pthread_mutex_lock(&shard->lock) == 0);
+  auto found = shard->index.find(path);
+  if (found != shard->index.end()) {
+    EntryList::iterator it = found->second;
+    shard->lru.splice(shard->lru.begin(), shard->lru, it);
+    response = it->response;
+
+    // Only go to the file system if we haven't checked in a while, and
+    // then claim the check so that other threads keep serving the entry
+    // in the meantime.
+    int64_t now = NowNs();
+    if (now - it->checked_ns >= revalidate_ns_) {
+      it->checked_ns = now;
+      revalidate = true;
+      identity = *it;
+    }
+  }
+  Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+
+  // stat() the file without holding the lock.  If it changed, drop the
+  // entry, unless it has been replaced while we weren't looking.
+  if (revalidate) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !SameFile(identity, st)) {
+      Verify333(pthread_mutex_lock(&shard->lock) == 0);
+      found = shard->index.find(path);
+      if (found != shard->index.end() &&
+          found->second->response == identity.response) {
+        Erase(shard, found->second);
+        invalidations_.fetch_add(1, std::memory_order_relaxed);
+      }
+      Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+      response = nullptr;
+    }
+  }
+
+  if (response != nullptr) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    misses_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return response;
+}
+
+void StaticFileCache::Insert(const string& path, const struct stat& st,
+                             shared_ptr<const string> response) {
+  if (response->size() > shard_max_bytes_)
+    return;
+
+  Entry entry;
+  entry.path = path;
+  entry.response = response;
+  entry.dev = st.st_dev;
+  entry.ino = st.st_ino;
+  entry.size = st.st_size;
+  entry.mtime = st.st_mtim;
+  entry.checked_ns = NowNs();
+
+  Shard* shard = ShardFor(path);
+  Verify333(pthread_mutex_lock(&shard->lock) == 0);
+
+  // Somebody may have beaten us to it; the newer response wins.
+  auto found = shard->index.find(path);
+  if (found != shard->index.end())
+    Erase(shard, found->second);
+
+  // Evict from the cold end of the list until the response fits.
+  while (!shard->lru.empty() &&
+         shard->bytes + response->size() > shard_max_bytes_) {
+    Erase(shard, std::prev(shard->lru.end()));
+    evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  shard->lru.push_front(entry);
+  shard->index[path] = shard->lru.begin();
+  shard->bytes += response->size();
+  Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+}
+
+StaticFileCache::Stats StaticFileCache::GetStats() {
+  Stats stats;
+  stats.hits = hits_.load(std::memory_order_relaxed);
+  stats.misses = misses_.load(std::memory_order_relaxed);
+  stats.evictions = evictions_.load(std::memory_order_relaxed);
+  stats.invalidations = invalidations_.load(std::memory_order_relaxed);
+  stats.bytes = 0;
+  stats.entries = 0;
+  for (Shard* shard : shards_) {
+    Verify333(pthread_mutex_lock(&shard->lock) == 0);
+    stats.bytes += shard->bytes;
+    stats.entries += shard->lru.size();
+    Verify333(pthread_mutex_unlock(&shard->lock) == 0);
+  }
+  return stats;
+}
+
+StaticFileCache::Shard* StaticFileCache::ShardFor(const string& path) {
+  return shards_[std::hash<string>()(path) % shards_.size()];
+}
+
+void StaticFileCache::Erase(Shard* shard, EntryList::iterator it) {
+  shard->bytes -= it->response->size();
+  shard->index.erase(it->path);
+  shard->lru.erase(it);
+}
+
+bool StaticFileCache::SameFile(const Entry& entry, const struct stat& st) {
+  return entry.dev == st.st_dev && entry.ino == st.st_ino &&
+         entry.size == st.st_size &&
+         entry.mtime.tv_sec == st.st_mtim.tv_sec &&
+         entry.mtime.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+}  // namespace hw4
@@ -0,0 +1,121 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_STATICFILECACHE_H_
+#define HW4_STATICFILECACHE_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <stddef.h>       // for size_t
+#include <stdint.h>       // for uint64_t, etc.
+#include <sys/stat.h>     // for struct stat
+#include <atomic>         // for std::atomic
+#include <list>           // for std::list
+#include <memory>         // for std::shared_ptr
+#include <string>         // for std::string
+#include <unordered_map>  // for std::unordered_map
+#include <vector>         // for std::vector
+
+namespace hw4 {
+
+// A StaticFileCache holds fully prepared responses (status line,
+// headers and body, ready to write to a socket) for small static
+// files, so that hot files can be served without touching the file
+// system.  Entries are keyed by the path of the file, and remember the
+// identity (device, inode, size and modification time) of the file
+// they were made from.  An entry is revalidated with stat() at most
+// once per revalidation interval; if the file changed, the entry is
+// dropped and the next request goes to the file system again.
+//
+// The cache is split into shards, each with its own lock and its own
+// LRU list, so that threads serving different files rarely contend.
+// Each shard evicts its least recently used entries to stay within its
+// share of the byte budget.
+//
+// A StaticFileCache is thread-safe.
+class StaticFileCache {
+ public:
+  // Counters describing how the cache has been doing.
+  struct Stats {
+    uint64_t hits;           // lookups answered from the cache
+    uint64_t misses;         // lookups that found nothing usable
+    uint64_t evictions;      // entries evicted to make room
+    uint64_t invalidations;  // entries dropped because the file changed
+    uint64_t bytes;          // bytes of responses currently cached
+    uint64_t entries;        // responses currently cached
+  };
+
+  // Creates a cache holding at most "max_bytes" bytes of responses,
+  // spread over "num_shards" shards.  Entries are revalidated at most
+  // every "revalidate_ms" milliseconds.
+  StaticFileCache(size_t max_bytes, uint32_t num_shards,
+                  uint32_t revalidate_ms);
+  virtual ~StaticFileCache();
+
+  // Looks up the prepared response for the file at "path".  Returns
+  // nullptr if there is none, or if it is stale.
+  std::shared_ptr<const std::string> Lookup(const std::string& path);
+
+  // Caches "response", the prepared response for the file at "path",
+  // whose stat() information is "st".  Responses bigger than a shard's
+  // whole budget aren't cached.
+  void Insert(const std::string& path, const struct stat& st,
+              std::shared_ptr<const std::string> response);
+
+  // Returns a snapshot of the counters.
+  Stats GetStats();
+
+ private:
+  // A cached response, along with the identity of the file.
+  struct Entry {
+    std::string path;
+    std::shared_ptr<const std::string> response;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int64_t checked_ns;
+  };
+  typedef std::list<Entry> EntryList;
+
+  // One shard of the cache: an LRU list, most recently used first, and
+  // an index into it.
+  struct Shard {
+    pthread_mutex_t lock;
+    EntryList lru;
+    std::unordered_map<std::string, EntryList::iterator> index;
+    size_t bytes;
+  };
+
+  // Returns the shard that "path" lives in.
+  Shard* ShardFor(const std::string& path);
+
+  // Removes "it" from "shard"; the caller must hold the shard's lock.
+  void Erase(Shard* shard, EntryList::iterator it);
+
+  // Returns true if "st" describes the same file as "entry".
+  static bool SameFile(const Entry& entry, const struct stat& st);
+
+  std::vector<Shard*> shards_;
+  size_t shard_max_bytes_;
+  int64_t revalidate_ns_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> invalidations_;
+};
+
+}  // namespace hw4
+
+#endif  // HW4_STATICFILECACHE_H_
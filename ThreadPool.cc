@@ -9,8 +9,12 @@
  * author.
  */
 
+#include <sched.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "./ThreadPool.h"
 
@@ -20,121 +24,945 @@ extern "C" {
 
 namespace hw4 {
 
-// This is the thread start routine, i.e., the function that threads
-// are born into.
-void* ThreadLoop(void* t_pool);
+// The initial number of slots in a worker's deque; it doubles as needed.
+static const int64_t kInitialDequeSize = 64;
 
-ThreadPool::ThreadPool(uint32_t num_threads) {
+// How many victims an idle worker tries before going to sleep, per
+// worker in the pool.
+static const uint32_t kStealAttemptsPerWorker = 2;
+
+// How often the tuner of an elastic pool reconsiders its size.
+static const int64_t kTuneIntervalNs = 100 * 1000 * 1000;
+
+// The tuner adds workers when tasks wait longer than this on average
+// for a worker to pick them up, or when tasks are queued and more than
+// kHighUtilization of the workers are busy.
+static const int64_t kMaxQueueWaitNs = 2 * 1000 * 1000;
+static const double kHighUtilization = 0.85;
+
+// The tuner retires workers once fewer than kLowUtilization of them
+// have been busy for kQuietRounds rounds in a row, sizing the pool so
+// that about kTargetUtilization of the remaining workers are busy.
+static const double kLowUtilization = 0.3;
+static const double kTargetUtilization = 0.6;
+static const uint32_t kQuietRounds = 20;
+
+// Returns the time on the monotonic clock, in nanoseconds.
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// A TaskDeque is a Chase-Lev work-stealing deque [Chase and Lev, SPAA
+// 2005], with the memory orderings of Le et al. [PPoPP 2013].  The
+// owning worker pushes and takes tasks at the bottom without locking;
+// any other thread may steal from the top.  When the array fills up,
+// the owner replaces it with one twice the size.  A thief might still
+// be reading the old array, so old arrays are only freed along with the
+// deque.
+class TaskDeque {
+ public:
+  TaskDeque() : top_(0), bottom_(0) {
+    arrays_.push_back(new Array(kInitialDequeSize));
+    array_.store(arrays_.back(), std::memory_order_relaxed);
+  }
+
+  ~TaskDeque() {
+    for (Array* a : arrays_)
+      delete a;
+  }
+
+  // Pushes "t" onto the bottom.  Owner only.
+  void Push(ThreadPool::Task* t) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t top = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if (b - top > a->size - 1)
+      a = Grow(a, b, top);
+    a->Put(b, t);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Takes the task at the bottom, or returns nullptr if the deque is
+  // empty.  Owner only.
+  ThreadPool::Task* Take() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t top = top_.load(std::memory_order_relaxed);
+    if (top > b) {
+      // Empty.
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    ThreadPool::Task* t = a->Get(b);
+    if (top == b) {
+      // The last task; race any thieves for it.
+      if (!top_.compare_exchange_strong(top, top + 1,
+                                        std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        t = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return t;
+  }
+
+  // Steals the task at the top.  Returns nullptr if the deque is empty
+  // or another thread got there first.  Safe to call from any thread.
+  ThreadPool::Task* Steal() {
+    int64_t top = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (top >= b)
+      return nullptr;
+    Array* a = array_.load(std::memory_order_acquire);
+    ThreadPool::Task* t = a->Get(top);
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return t;
+  }
+
+  // Returns true if the deque looks empty.  Safe to call from any
+  // thread, though the answer may be stale by the time it's used.
+  bool Empty() const {
+    return bottom_.load(std::memory_order_acquire) <=
+           top_.load(std::memory_order_acquire);
+  }
+
+ private:
+  // A circular array of task slots; "size" is a power of two.
+  struct Array {
+    typedef ThreadPool::Task Task;
+
+    explicit Array(int64_t n) : size(n), slots(new std::atomic<Task*>[n]) { }
+    ~Array() { delete[] slots; }
+
+    Task* Get(int64_t i) const {
+      return slots[i & (size - 1)].load(std::memory_order_relaxed);
+    }
+    void Put(int64_t i, Task* t) {
+      slots[i & (size - 1)].store(t, std::memory_order_relaxed);
+    }
+
+    int64_t size;
+    std::atomic<Task*>* slots;
+  };
+
+  // Replaces "a" by an array twice its size holding the same tasks.
+  Array* Grow(Array* a, int64_t b, int64_t top) {
+    Array* bigger = new Array(a->size * 2);
+    for (int64_t i = top; i < b; i++)
+      bigger->Put(i, a->Get(i));
+    arrays_.push_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  // top_ and bottom_ are written by different threads, so keep them on
+  // separate cache lines.
+  alignas(64) std::atomic<int64_t> top_;
+  alignas(64) std::atomic<int64_t> bottom_;
+  std::atomic<Array*> array_;
+  std::vector<Array*> arrays_;  // owner only
+};
+
+// A worker thread of a kWorkStealing pool.  Tasks dispatched from
+// outside the pool land in "inbox", a lock-free stack linked through
+// Task::next_; the worker moves them onto its deque in batches, so that
+// they can be stolen.
+struct alignas(64) ThreadPool::Worker {
+  Worker(ThreadPool* p, uint32_t i)
+    : pool(p), index(i), inbox(nullptr), parked(false), wakeup(false),
+      rand_state(i * 2654435761u + 1) {
+    Verify333(pthread_mutex_init(&lock, nullptr) == 0);
+    Verify333(pthread_cond_init(&cond, nullptr) == 0);
+  }
+  ~Worker() {
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&cond);
+  }
+
+  // Returns a pseudo-random number, for picking steal victims.
+  uint32_t Random() {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+  }
+
+  ThreadPool* pool;
+  uint32_t index;
+  TaskDeque deque;
+  alignas(64) std::atomic<Task*> inbox;
+
+  // "parked" is set while the worker is (about to be) asleep on
+  // "cond"; "wakeup" is guarded by "lock".
+  alignas(64) std::atomic<bool> parked;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool wakeup;
+
+  uint32_t rand_state;  // owner only
+};
+
+// A TaskRing is Vyukov's bounded multi-producer, multi-consumer queue.
+// Every cell carries a sequence number that says whose turn it is: a
+// producer may fill the cell at position "pos" once its sequence is
+// pos, and a consumer may empty it once its sequence is pos + 1.  A
+// push or pop therefore costs one compare-and-swap on the shared
+// position, and never blocks.  Cells and positions sit on cache lines
+// of their own, so threads working on neighboring cells don't bounce
+// lines between them.
+class ThreadPool::TaskRing {
+ public:
+  explicit TaskRing(uint32_t capacity) : enqueue_pos_(0), dequeue_pos_(0) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    mask_ = size - 1;
+    cells_ = new Cell[size];
+    for (size_t i = 0; i < size; i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+      cells_[i].task = nullptr;
+    }
+  }
+
+  ~TaskRing() { delete[] cells_; }
+
+  // Enqueues "t".  Returns false if the ring is full.
+  bool Push(Task* t) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (1) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // The cell still holds a task from the previous lap: full.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->task = t;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Dequeues the oldest task, or returns nullptr if the ring is empty.
+  Task* Pop() {
+    size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (1) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff =
+        static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        // Nothing has been pushed into this cell yet: empty.
+        return nullptr;
+      } else {
+        pos = dequeue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    Task* t = cell->task;
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return t;
+  }
+
+  // Returns true if no task has been claimed for pushing but not yet
+  // popped.  The answer may be stale by the time it's used.
+  bool Empty() const {
+    return enqueue_pos_.load() == dequeue_pos_.load();
+  }
+
+ private:
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    Task* task;
+  };
+
+  Cell* cells_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> enqueue_pos_;
+  alignas(64) std::atomic<size_t> dequeue_pos_;
+};
+
+// static
+thread_local ThreadPool::Worker* ThreadPool::current_worker_ = nullptr;
+
+ThreadPool::ThreadPool(uint32_t num_threads, int cpu, Scheduler scheduler,
+                       uint32_t queue_capacity, uint32_t min_threads,
+                       const std::vector<uint32_t>& class_weights)
+  : scheduler_(scheduler), cpu_(cpu), elastic_(false),
+    min_threads_(num_threads), max_threads_(num_threads), retire_(0),
+    tasks_run_(0), wait_ns_(0), busy_ns_(0), num_busy_(0),
+    num_workers_(0), workers_(nullptr), next_worker_(0), num_parked_(0),
+    stop_(false), num_sleepers_(0) {
   // Initialize our member variables.
   num_threads_running_ = 0;
   terminate_threads_ = false;
   Verify333(pthread_mutex_init(&q_lock_, nullptr) == 0);
   Verify333(pthread_cond_init(&q_cond_, nullptr) == 0);
+  Verify333(pthread_cond_init(&startup_cond_, nullptr) == 0);
+  Verify333(pthread_cond_init(&tuner_cond_, nullptr) == 0);
 
-  // Allocate the array of pthread structures.
-  thread_array_ = new pthread_t[num_threads];
+  // A work-stealing pool needs a deque and an inbox per thread, so
+  // its size is fixed.
+  if (scheduler_ == kWorkStealing) {
+    num_workers_ = num_threads;
+    workers_ = new Worker*[num_threads];
+    for (uint32_t i = 0; i < num_threads; i++)
+      workers_[i] = new Worker(this, i);
+  } else {
+    class_weights_ = class_weights;
+    if (class_weights_.empty())
+      class_weights_.push_back(1);
+    for (uint32_t& weight : class_weights_)
+      weight = std::max<uint32_t>(weight, 1);
+    class_credits_.assign(class_weights_.size(), 0);
+    work_queues_.resize(class_weights_.size());
+    if (scheduler_ == kBoundedQueue) {
+      for (size_t i = 0; i < class_weights_.size(); i++)
+        rings_.push_back(new TaskRing(queue_capacity));
+    }
+    if (min_threads > 0 && min_threads < num_threads) {
+      elastic_ = true;
+      min_threads_ = min_threads;
+    }
+  }
 
-  // Spawn the threads one by one, passing them a pointer to self
-  // as the argument to the thread start routine.
+  // Spawn the initial threads one by one.
   Verify333(pthread_mutex_lock(&q_lock_) == 0);
-  for (uint32_t i = 0; i < num_threads; i++) {
-    Verify333(pthread_create(&(thread_array_[i]),
-                             nullptr,
-                             &ThreadLoop,
-                             static_cast<void*>(this)) == 0);
+  for (uint32_t i = 0; i < min_threads_; i++) {
+    if (scheduler_ == kWorkStealing) {
+      SpawnThread(&ThreadPool::WorkerLoop, static_cast<void*>(workers_[i]));
+    } else if (scheduler_ == kBoundedQueue) {
+      SpawnThread(&ThreadPool::RingLoop, static_cast<void*>(this));
+    } else {
+      SpawnThread(&ThreadPool::ThreadLoop, static_cast<void*>(this));
+    }
   }
 
   // Wait for all of the threads to be born and initialized.
-  while (num_threads_running_ != num_threads) {
-    Verify333(pthread_mutex_unlock(&q_lock_) == 0);
-    sleep(1);  // give another thread the chance to acquire the lock
-    Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  while (num_threads_running_ != min_threads_) {
+    Verify333(pthread_cond_wait(&startup_cond_, &q_lock_) == 0);
   }
   Verify333(pthread_mutex_unlock(&q_lock_) == 0);
 
+  // An elastic pool gets a tuner to resize it.
+  if (elastic_) {
+    Verify333(pthread_create(&tuner_, nullptr, &ThreadPool::TunerLoop,
+                             static_cast<void*>(this)) == 0);
+  }
+
   // Done!  The thread pool is ready, and all of the worker threads
-  // are initialized and waiting on q_cond_ to be notified of available
-  // work.
+  // are initialized and waiting to be notified of available work.
 }
 
 ThreadPool:: ~ThreadPool() {
   Verify333(pthread_mutex_lock(&q_lock_) == 0);
-  uint32_t num_threads = num_threads_running_;
 
-  // Tell all of the worker threads to terminate.
+  // Tell the tuner and all of the worker threads to terminate.  The
+  // tuner goes first, so that it can't start any more workers.
   terminate_threads_ = true;
+  stop_.store(true);
+  if (elastic_) {
+    Verify333(pthread_cond_signal(&tuner_cond_) == 0);
+    Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+    Verify333(pthread_join(tuner_, nullptr) == 0);
+    Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  }
+  if (scheduler_ == kWorkStealing) {
+    for (uint32_t i = 0; i < num_workers_; i++) {
+      Worker* w = workers_[i];
+      Verify333(pthread_mutex_lock(&w->lock) == 0);
+      w->wakeup = true;
+      Verify333(pthread_cond_signal(&w->cond) == 0);
+      Verify333(pthread_mutex_unlock(&w->lock) == 0);
+    }
+  }
 
-  // Join with the running threads 1-by-1 until they have all died.
-  for (uint32_t i = 0; i < num_threads; i++) {
+  // Join with the threads 1-by-1 until they have all died.  Nobody
+  // retires once terminate_threads_ is set, so the lists stay put.
+  std::vector<pthread_t> threads(threads_);
+  threads.insert(threads.end(), retired_.begin(), retired_.end());
+  for (pthread_t thread : threads) {
     // Use a sledgehammer and broadcast every loop iteration, just to
     // be extra-certain that worker threads wake up and see the terminate flag.
     Verify333(pthread_cond_broadcast(&q_cond_) == 0);
     Verify333(pthread_mutex_unlock(&q_lock_) == 0);
-    Verify333(pthread_join(thread_array_[i], nullptr) == 0);
+    Verify333(pthread_join(thread, nullptr) == 0);
     Verify333(pthread_mutex_lock(&q_lock_) == 0);
   }
 
   // All of the worker threads are dead, so clean up the thread
   // structures.
   Verify333(num_threads_running_ == 0);
-  if (thread_array_ != nullptr) {
-    delete[] thread_array_;
-  }
-  thread_array_ = nullptr;
+  threads_.clear();
+  retired_.clear();
   Verify333(pthread_mutex_unlock(&q_lock_) == 0);
 
-  // Empty the task queue, serially issuing any remaining work.
-  while (!work_queue_.empty()) {
-    Task* nextTask = work_queue_.front();
-    work_queue_.pop_front();
-    nextTask->func_(nextTask);
+  // Empty the task queues, serially issuing any remaining work.
+  for (std::list<Task*>& queue : work_queues_) {
+    while (!queue.empty()) {
+      Task* nextTask = queue.front();
+      queue.pop_front();
+      nextTask->func_(nextTask);
+    }
+  }
+
+  // Likewise for the workers' inboxes and deques.
+  for (uint32_t i = 0; i < num_workers_; i++) {
+    Worker* w = workers_[i];
+    Task* batch = w->inbox.exchange(nullptr);
+    Task* nextTask = (batch != nullptr) ? AcceptBatch(w, batch)
+                                        : w->deque.Take();
+    while (nextTask != nullptr) {
+      nextTask->func_(nextTask);
+      nextTask = w->deque.Take();
+    }
+    delete w;
+  }
+  delete[] workers_;
+
+  // And for the rings.
+  for (TaskRing* ring : rings_) {
+    Task* nextTask;
+    while ((nextTask = ring->Pop()) != nullptr)
+      nextTask->func_(nextTask);
+    delete ring;
   }
 }
 
 // Enqueue a Task for dispatch.
-void ThreadPool::Dispatch(Task* t) {
+bool ThreadPool::Dispatch(Task* t) {
+  if (elastic_)
+    t->dispatch_ns_ = NowNs();
+
+  if (scheduler_ == kBoundedQueue) {
+    Verify333(stop_.load(std::memory_order_relaxed) == false);
+    if (!rings_[ClassOf(t)]->Push(t))
+      return false;
+    WakeSleepers(1);
+    return true;
+  }
+
+  if (scheduler_ == kWorkStealing) {
+    Verify333(stop_.load(std::memory_order_relaxed) == false);
+
+    // A worker dispatching more work keeps it, but lets an idle worker
+    // know there's something to steal.
+    Worker* self = current_worker_;
+    if (self != nullptr && self->pool == this) {
+      self->deque.Push(t);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      UnparkAny(self->index + 1);
+      return true;
+    }
+
+    // Otherwise, push onto the next worker's inbox.  If that worker is
+    // busy, wake an idle one to steal the task instead.
+    uint32_t i = next_worker_.fetch_add(1, std::memory_order_relaxed)
+                 % num_workers_;
+    Worker* w = workers_[i];
+    Task* head = w->inbox.load(std::memory_order_relaxed);
+    do {
+      t->next_ = head;
+    } while (!w->inbox.compare_exchange_weak(head, t));
+    if (!Unpark(w))
+      UnparkAny(i + 1);
+    return true;
+  }
+
   Verify333(pthread_mutex_lock(&q_lock_) == 0);
   Verify333(terminate_threads_ == false);
-  work_queue_.push_back(t);
+  work_queues_[ClassOf(t)].push_back(t);
   Verify333(pthread_cond_signal(&q_cond_) == 0);
   Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  return true;
+}
+
+size_t ThreadPool::DispatchBatch(Task** tasks, size_t n) {
+  if (elastic_) {
+    int64_t now = NowNs();
+    for (size_t i = 0; i < n; i++)
+      tasks[i]->dispatch_ns_ = now;
+  }
+
+  if (scheduler_ == kBoundedQueue) {
+    Verify333(stop_.load(std::memory_order_relaxed) == false);
+    size_t i = 0;
+    while (i < n && rings_[ClassOf(tasks[i])]->Push(tasks[i]))
+      i++;
+    WakeSleepers(i);
+    return i;
+  }
+
+  if (scheduler_ == kWorkStealing) {
+    for (size_t i = 0; i < n; i++)
+      Dispatch(tasks[i]);
+    return n;
+  }
+
+  // One trip through the lock for the whole batch.
+  Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  Verify333(terminate_threads_ == false);
+  for (size_t i = 0; i < n; i++)
+    work_queues_[ClassOf(tasks[i])].push_back(tasks[i]);
+  size_t wakeups = std::min(n, threads_.size());
+  for (size_t i = 0; i < wakeups; i++)
+    Verify333(pthread_cond_signal(&q_cond_) == 0);
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  return n;
+}
+
+uint32_t ThreadPool::ClassOf(const Task* t) const {
+  return std::min<uint32_t>(t->class_, class_weights_.size() - 1);
+}
+
+int ThreadPool::PickClass(int64_t* credits) const {
+  // Every non-empty class earns its weight in credit, and the richest
+  // one is served and pays back the total.  Over time each class is
+  // served in proportion to its weight, and the picks are interleaved
+  // rather than bunched up.
+  int best = -1;
+  int64_t total = 0;
+  for (size_t i = 0; i < class_weights_.size(); i++) {
+    bool empty = (scheduler_ == kBoundedQueue) ? rings_[i]->Empty()
+                                               : work_queues_[i].empty();
+    if (empty)
+      continue;
+    credits[i] += class_weights_[i];
+    total += class_weights_[i];
+    if (best == -1 || credits[i] > credits[best])
+      best = i;
+  }
+  if (best != -1)
+    credits[best] -= total;
+  return best;
+}
+
+ThreadPool::Task* ThreadPool::PopShared() {
+  int c = PickClass(class_credits_.data());
+  if (c == -1)
+    return nullptr;
+  Task* t = work_queues_[c].front();
+  work_queues_[c].pop_front();
+  return t;
+}
+
+ThreadPool::Task* ThreadPool::PopRing(int64_t* credits) {
+  int c = PickClass(credits);
+  if (c == -1)
+    return nullptr;
+  Task* t = rings_[c]->Pop();
+  if (t != nullptr)
+    return t;
+
+  // Another worker beat us to it; take whatever else there is.
+  for (TaskRing* ring : rings_) {
+    t = ring->Pop();
+    if (t != nullptr)
+      return t;
+  }
+  return nullptr;
 }
 
-// This is the main loop that all worker threads are born into.  They
-// wait for a signal on the work queue condition variable, then they
-// grab work off the queue.  Threads return (i.e., terminate)
-// when they notice that terminate_threads_ is true.
-void* ThreadLoop(void* t_pool) {
+bool ThreadPool::QueuesEmpty() const {
+  for (size_t i = 0; i < class_weights_.size(); i++) {
+    bool empty = (scheduler_ == kBoundedQueue) ? rings_[i]->Empty()
+                                               : work_queues_[i].empty();
+    if (!empty)
+      return false;
+  }
+  return true;
+}
+
+uint32_t ThreadPool::num_threads() {
+  Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  uint32_t n = threads_.size();
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+  return n;
+}
+
+void ThreadPool::SpawnThread(void* (*start)(void*), void* arg) {
+  // If we've been asked to, pin the thread to a single CPU.
+  pthread_attr_t attr;
+  Verify333(pthread_attr_init(&attr) == 0);
+  if (cpu_ >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_, &cpus);
+    Verify333(pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus) == 0);
+  }
+  pthread_t thread;
+  Verify333(pthread_create(&thread, &attr, start, arg) == 0);
+  Verify333(pthread_attr_destroy(&attr) == 0);
+  threads_.push_back(thread);
+}
+
+bool ThreadPool::ShouldRetire() {
+  if (retire_ == 0 || terminate_threads_)
+    return false;
+  retire_--;
+
+  // Move ourselves to the list of threads for the tuner to join.
+  pthread_t self = pthread_self();
+  for (size_t i = 0; i < threads_.size(); i++) {
+    if (pthread_equal(threads_[i], self)) {
+      threads_.erase(threads_.begin() + i);
+      break;
+    }
+  }
+  retired_.push_back(self);
+  return true;
+}
+
+void ThreadPool::RunTask(Task* t) {
+  if (!elastic_) {
+    t->func_(t);
+    return;
+  }
+
+  // The task may well delete itself, so note what we need up front.
+  int64_t start = NowNs();
+  wait_ns_.fetch_add(start - t->dispatch_ns_, std::memory_order_relaxed);
+  num_busy_.fetch_add(1, std::memory_order_relaxed);
+  t->func_(t);
+  num_busy_.fetch_sub(1, std::memory_order_relaxed);
+  busy_ns_.fetch_add(NowNs() - start, std::memory_order_relaxed);
+  tasks_run_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* ThreadPool::TunerLoop(void* arg) {
+  ThreadPool* pool = static_cast<ThreadPool*>(arg);
+  uint32_t quiet_rounds = 0;
+
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  int64_t next = NowNs() + kTuneIntervalNs;
+  while (!pool->terminate_threads_) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    int64_t wait_ns = std::max<int64_t>(next - NowNs(), 0);
+    deadline.tv_sec += (deadline.tv_nsec + wait_ns) / 1000000000;
+    deadline.tv_nsec = (deadline.tv_nsec + wait_ns) % 1000000000;
+    pthread_cond_timedwait(&(pool->tuner_cond_), &(pool->q_lock_),
+                           &deadline);
+    if (pool->terminate_threads_)
+      break;
+    if (NowNs() < next)
+      continue;
+    next += kTuneIntervalNs;
+    pool->Tune(&quiet_rounds);
+
+    // Reap the threads that retired since last time.
+    std::vector<pthread_t> retired;
+    retired.swap(pool->retired_);
+    Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+    for (pthread_t thread : retired)
+      Verify333(pthread_join(thread, nullptr) == 0);
+    Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  }
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+  return nullptr;
+}
+
+void ThreadPool::Tune(uint32_t* quiet_rounds) {
+  uint64_t tasks = tasks_run_.exchange(0, std::memory_order_relaxed);
+  uint64_t wait_ns = wait_ns_.exchange(0, std::memory_order_relaxed);
+  uint64_t busy_ns = busy_ns_.exchange(0, std::memory_order_relaxed);
+
+  // How many workers were busy on average, counting any that are in
+  // the middle of a long task right now.
+  double busy = static_cast<double>(busy_ns) / kTuneIntervalNs;
+  busy = std::max(busy, static_cast<double>(num_busy_.load()));
+
+  uint32_t live = threads_.size() - std::min<size_t>(retire_,
+                                                      threads_.size());
+  bool backlog = !QueuesEmpty();
+  int64_t avg_wait_ns = (tasks > 0) ? wait_ns / tasks : 0;
+
+  if ((avg_wait_ns > kMaxQueueWaitNs ||
+       (backlog && busy >= live * kHighUtilization)) &&
+      live < max_threads_) {
+    // Grow by a quarter at a time, so that a burst is absorbed within a
+    // few rounds.  Cancel pending retirements first.
+    *quiet_rounds = 0;
+    uint32_t grow = std::max<uint32_t>(live / 4, 1);
+    grow = std::min(grow, max_threads_ - live);
+    uint32_t unretire = std::min(grow, retire_);
+    retire_ -= unretire;
+    for (uint32_t i = unretire; i < grow; i++) {
+      if (scheduler_ == kBoundedQueue) {
+        SpawnThread(&ThreadPool::RingLoop, static_cast<void*>(this));
+      } else {
+        SpawnThread(&ThreadPool::ThreadLoop, static_cast<void*>(this));
+      }
+    }
+    return;
+  }
+
+  if (backlog || busy >= live * kLowUtilization ||
+      avg_wait_ns > kMaxQueueWaitNs / 4) {
+    *quiet_rounds = 0;
+    return;
+  }
+  if (++*quiet_rounds < kQuietRounds || live <= min_threads_)
+    return;
+
+  // We've been oversized for a while; shrink by up to a quarter.
+  *quiet_rounds = 0;
+  uint32_t target = static_cast<uint32_t>(busy / kTargetUtilization) + 1;
+  target = std::max(target, min_threads_);
+  if (target >= live)
+    return;
+  uint32_t shrink = std::min(live - target, std::max<uint32_t>(live / 4, 1));
+  retire_ += shrink;
+  for (uint32_t i = 0; i < shrink; i++)
+    Verify333(pthread_cond_signal(&q_cond_) == 0);
+}
+
+void ThreadPool::WakeSleepers(size_t n) {
+  // Pairs with the increment of num_sleepers_ in RingLoop(): either we
+  // see the sleeper, or it sees our tasks in the ring.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (n == 0 || num_sleepers_.load() == 0)
+    return;
+  Verify333(pthread_mutex_lock(&q_lock_) == 0);
+  uint32_t sleepers = num_sleepers_.load();
+  if (n >= sleepers) {
+    Verify333(pthread_cond_broadcast(&q_cond_) == 0);
+  } else {
+    for (size_t i = 0; i < n; i++)
+      Verify333(pthread_cond_signal(&q_cond_) == 0);
+  }
+  Verify333(pthread_mutex_unlock(&q_lock_) == 0);
+}
+
+// This is the main loop that kSharedQueue worker threads are born
+// into.  They wait for a signal on the work queue condition variable,
+// then they grab work off the queue.  Threads return (i.e., terminate)
+// when they notice that terminate_threads_ is true, or when the tuner
+// retires them.
+void* ThreadPool::ThreadLoop(void* t_pool) {
   ThreadPool* pool = static_cast<ThreadPool*>(t_pool);
 
   // Grab the lock, increment the thread count so that the ThreadPool
   // constructor knows this new thread is alive.
   Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
   pool->num_threads_running_++;
+  Verify333(pthread_cond_signal(&(pool->startup_cond_)) == 0);
 
   // This is our main thread work loop.
   while (pool->terminate_threads_ == false) {
-    // Wait to be signaled that something has happened.
-    Verify333(pthread_cond_wait(&(pool->q_cond_), &(pool->q_lock_)) == 0);
-
-    // Keep trying to dequeue work until the work queue is empty.
-    while (!pool->work_queue_.empty() && (pool->terminate_threads_ == false)) {
-      ThreadPool::Task* nextTask = pool->work_queue_.front();
-      pool->work_queue_.pop_front();
-
+    // Keep trying to dequeue work until the work queue is empty.  A
+    // thread the tuner just added may find a backlog waiting for it.
+    ThreadPool::Task* nextTask;
+    while ((pool->terminate_threads_ == false) &&
+           (nextTask = pool->PopShared()) != nullptr) {
       // We picked up a Task, so invoke the task function with the
       // lock released, then check so see if more tasks are waiting to
       // be picked up.
       Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
-      nextTask->func_(nextTask);
+      pool->RunTask(nextTask);
       Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
     }
+    if (pool->terminate_threads_ || pool->ShouldRetire())
+      break;
+
+    // Wait to be signaled that something has happened.
+    Verify333(pthread_cond_wait(&(pool->q_cond_), &(pool->q_lock_)) == 0);
+  }
+
+  // All done, exit.
+  pool->num_threads_running_--;
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+  return nullptr;
+}
+
+// This is the main loop of kWorkStealing worker threads.  They run
+// tasks for as long as they can find any, and park when they can't.
+void* ThreadPool::WorkerLoop(void* arg) {
+  Worker* w = static_cast<Worker*>(arg);
+  ThreadPool* pool = w->pool;
+  current_worker_ = w;
+
+  // Let the ThreadPool constructor know this new thread is alive.
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  pool->num_threads_running_++;
+  Verify333(pthread_cond_signal(&(pool->startup_cond_)) == 0);
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+
+  while (!pool->stop_.load(std::memory_order_acquire)) {
+    Task* nextTask = pool->FindWork(w);
+    if (nextTask != nullptr) {
+      nextTask->func_(nextTask);
+    } else {
+      pool->Park(w);
+    }
+  }
+
+  // All done, exit.
+  current_worker_ = nullptr;
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  pool->num_threads_running_--;
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+  return nullptr;
+}
+
+// This is the main loop of kBoundedQueue worker threads.  They pop
+// tasks off the ring without locking, and only take q_lock_ to sleep
+// when the ring is empty.
+void* ThreadPool::RingLoop(void* arg) {
+  ThreadPool* pool = static_cast<ThreadPool*>(arg);
+  std::vector<int64_t> credits(pool->rings_.size(), 0);
+
+  // Let the ThreadPool constructor know this new thread is alive.
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+  pool->num_threads_running_++;
+  Verify333(pthread_cond_signal(&(pool->startup_cond_)) == 0);
+  Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+
+  while (!pool->stop_.load(std::memory_order_acquire)) {
+    Task* nextTask = pool->PopRing(credits.data());
+    if (nextTask != nullptr) {
+      pool->RunTask(nextTask);
+      continue;
+    }
+
+    // Count ourselves as a sleeper before the final check, so that a
+    // concurrent Dispatch() either sees us or we see its task.
+    Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
+    if (pool->ShouldRetire()) {
+      Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
+      break;
+    }
+    pool->num_sleepers_.fetch_add(1);
+    while (pool->QueuesEmpty() && !pool->stop_.load() &&
+           pool->retire_ == 0) {
+      Verify333(pthread_cond_wait(&(pool->q_cond_),
+                                  &(pool->q_lock_)) == 0);
+    }
+    pool->num_sleepers_.fetch_sub(1);
+    Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
   }
 
   // All done, exit.
+  Verify333(pthread_mutex_lock(&(pool->q_lock_)) == 0);
   pool->num_threads_running_--;
   Verify333(pthread_mutex_unlock(&(pool->q_lock_)) == 0);
   return nullptr;
 }
 
+ThreadPool::Task* ThreadPool::FindWork(Worker* w) {
+  Task* t = w->deque.Take();
+  if (t != nullptr)
+    return t;
+
+  Task* batch = w->inbox.exchange(nullptr, std::memory_order_acquire);
+  if (batch != nullptr)
+    return AcceptBatch(w, batch);
+
+  // Our own queues are dry, so go stealing.  A victim's inbox is fair
+  // game too, in case its owner is stuck on a long task.
+  if (num_workers_ < 2)
+    return nullptr;
+  uint32_t attempts = kStealAttemptsPerWorker * num_workers_;
+  for (uint32_t i = 0; i < attempts; i++) {
+    Worker* victim = workers_[w->Random() % num_workers_];
+    if (victim == w)
+      continue;
+    t = victim->deque.Steal();
+    if (t != nullptr)
+      return t;
+    if (victim->inbox.load(std::memory_order_relaxed) != nullptr) {
+      batch = victim->inbox.exchange(nullptr, std::memory_order_acquire);
+      if (batch != nullptr)
+        return AcceptBatch(w, batch);
+    }
+  }
+  return nullptr;
+}
+
+ThreadPool::Task* ThreadPool::AcceptBatch(Worker* w, Task* batch) {
+  // The chain runs newest to oldest, so pushing it in order leaves the
+  // oldest task at the bottom, where we take from: within a batch,
+  // tasks run in the order they were dispatched.
+  Task* oldest = batch;
+  bool more = false;
+  for (Task* next = batch->next_; next != nullptr; next = next->next_) {
+    w->deque.Push(oldest);
+    oldest = next;
+    more = true;
+  }
+  oldest->next_ = nullptr;
+
+  // Let an idle worker help with the rest of the batch.
+  if (more)
+    UnparkAny(w->index + 1);
+  return oldest;
+}
+
+void ThreadPool::Park(Worker* w) {
+  // Advertise that we're going to sleep before checking for work one
+  // last time.  A Dispatch() racing with us either sees "parked" and
+  // wakes us, or its task is visible to HasWork().
+  w->parked.store(true);
+  num_parked_.fetch_add(1);
+  if (!HasWork() && !stop_.load()) {
+    Verify333(pthread_mutex_lock(&w->lock) == 0);
+    while (!w->wakeup && !stop_.load())
+      Verify333(pthread_cond_wait(&w->cond, &w->lock) == 0);
+    w->wakeup = false;
+    Verify333(pthread_mutex_unlock(&w->lock) == 0);
+  }
+  num_parked_.fetch_sub(1);
+  w->parked.store(false);
+}
+
+bool ThreadPool::Unpark(Worker* w) {
+  if (!w->parked.load())
+    return false;
+  Verify333(pthread_mutex_lock(&w->lock) == 0);
+  w->wakeup = true;
+  Verify333(pthread_cond_signal(&w->cond) == 0);
+  Verify333(pthread_mutex_unlock(&w->lock) == 0);
+  return true;
+}
+
+void ThreadPool::UnparkAny(uint32_t start) {
+  if (num_parked_.load() == 0)
+    return;
+  for (uint32_t i = 0; i < num_workers_; i++) {
+    if (Unpark(workers_[(start + i) % num_workers_]))
+      return;
+  }
+}
+
+bool ThreadPool::HasWork() const {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (uint32_t i = 0; i < num_workers_; i++) {
+    Worker* w = workers_[i];
+    if (w->inbox.load() != nullptr || !w->deque.Empty())
+      return true;
+  }
+  return false;
+}
+
 }  // namespace hw4
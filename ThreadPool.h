@@ -16,8 +16,11 @@ extern "C" {
 #include <pthread.h>  // for the pthread threading/mutex functions
 }
 
+#include <stddef.h>   // for size_t
 #include <stdint.h>   // for uint32_t, etc.
+#include <atomic>     // for std::atomic
 #include <list>       // for std::list
+#include <vector>     // for std::vector
 
 namespace hw4 {
 
@@ -28,13 +31,68 @@ namespace hw4 {
 // pointer in the task to process it.  When it is done processing the
 // task, the thread returns to the pool to receive and process the next
 // available task.
+//
+// Tasks can be split into scheduling classes, each with its own queue
+// and weight.  Idle workers pick among the classes with waiting tasks
+// in proportion to their weights, so a flood of tasks in one class
+// delays the others by at most a weighted share of the workers.
+//
+// A pool can also be elastic: it starts with a small core of workers
+// and a background tuner thread adds workers when tasks wait too long
+// for one, and retires them again once they sit mostly idle.
 class ThreadPool {
  public:
+  // How a ThreadPool hands tasks to its worker threads.
+  enum Scheduler {
+    // A single FIFO queue, shared by every worker and guarded by
+    // q_lock_.
+    kSharedQueue,
+
+    // Every worker owns a deque of tasks.  Dispatch() spreads tasks
+    // round-robin across the workers without taking a lock, and a
+    // worker that runs out of tasks steals from a randomly chosen
+    // victim.  Idle workers sleep on their own condition variable, so
+    // a dispatch wakes at most one of them.
+    kWorkStealing,
+
+    // A fixed-capacity, lock-free ring shared by every worker.  Neither
+    // Dispatch() nor a worker taking a task allocates or locks, and
+    // Dispatch() refuses tasks once the ring is full, so that
+    // customers can shed load rather than queue without bound.
+    kBoundedQueue
+  };
+
+  // The default ring capacity for kBoundedQueue.
+  static const uint32_t kDefaultQueueCapacity = 4096;
+
   // Construct a new ThreadPool with a certain number of worker
-  // threads.  Arguments:
+  // threads.  The constructor returns as soon as the initial workers
+  // are running.  Arguments:
+  //
+  //  - num_threads:  the number of threads in the pool, or for an
+  //    elastic pool, the most it will grow to.
   //
-  //  - num_threads:  the number of threads in the pool.
-  explicit ThreadPool(uint32_t num_threads);
+  //  - cpu:  if non-negative, every worker thread is pinned to this CPU.
+  //
+  //  - scheduler:  how tasks are handed to the worker threads.
+  //
+  //  - queue_capacity:  for kBoundedQueue, how many tasks may wait at
+  //    once.  Rounded up to a power of two.
+  //
+  //  - min_threads:  if non-zero and less than num_threads, the pool is
+  //    elastic: it starts with min_threads workers and never shrinks
+  //    below that.  kWorkStealing pools are never elastic.
+  //
+  //  - class_weights:  the relative weight of each scheduling class;
+  //    empty means a single class.  A kBoundedQueue pool gives each
+  //    class a ring of queue_capacity tasks.  kWorkStealing pools
+  //    ignore classes.
+  explicit ThreadPool(uint32_t num_threads, int cpu = -1,
+                      Scheduler scheduler = kSharedQueue,
+                      uint32_t queue_capacity = kDefaultQueueCapacity,
+                      uint32_t min_threads = 0,
+                      const std::vector<uint32_t>& class_weights =
+                        std::vector<uint32_t>());
   virtual ~ThreadPool();
 
   // This inner class defines what a Task is.  A worker thread will
@@ -50,23 +108,43 @@ class ThreadPool {
    public:
     // "f" is the task function that a worker thread should invoke to
     // process the task.
-    explicit Task(thread_task_fn func) : func_(func) { }
+    explicit Task(thread_task_fn func)
+      : func_(func), class_(0), next_(nullptr), dispatch_ns_(0) { }
 
     // The dispatch function.
     thread_task_fn func_;
+
+    // The scheduling class to queue the task in, counting from zero.
+    uint32_t class_;
+
+    // Links the task into a worker's inbox (kWorkStealing only), so
+    // that queuing a task never allocates.
+    Task* next_;
+
+    // When an elastic pool queued the task, so that it can tell how
+    // long tasks wait for a worker.
+    int64_t dispatch_ns_;
   };
 
   // Customers use Dispatch() to enqueue a Task for dispatch to a
-  // worker thread.
-  void Dispatch(Task* t);
+  // worker thread.  Returns false, without taking ownership of the
+  // Task, if the pool is a kBoundedQueue and its queue is full.
+  bool Dispatch(Task* t);
+
+  // Enqueues the "n" Tasks in "tasks", in order, waking as many
+  // workers as needed at once.  Returns how many were enqueued; with a
+  // full kBoundedQueue, that may be fewer than "n", and the customer
+  // keeps ownership of tasks[returned value] onward.
+  size_t DispatchBatch(Task** tasks, size_t n);
 
   // A lock and condition variable that worker threads and the
   // Dispatch function use to guard the Task queue.
   pthread_mutex_t q_lock_;
   pthread_cond_t  q_cond_;
 
-  // The queue of Tasks waiting to be dispatched to a worker thread.
-  std::list<Task*> work_queue_;
+  // The queues of Tasks waiting to be dispatched to a worker thread,
+  // one per scheduling class.
+  std::vector<std::list<Task*>> work_queues_;
 
   // This should be set to "true" when it is time for the worker
   // threads to terminate, i.e., when the ThreadPool is
@@ -80,9 +158,140 @@ class ThreadPool {
   // terminate, they decrement it.
   uint32_t num_threads_running_;
 
+  // Returns how many worker threads the pool has right now.
+  uint32_t num_threads();
+
  private:
-  // The pthreads pthread_t structures representing each thread.
-  pthread_t* thread_array_;
+  // The start routine of kSharedQueue worker threads.
+  static void* ThreadLoop(void* t_pool);
+
+  // A worker thread's deque, inbox, and parking spot (kWorkStealing
+  // only); defined in ThreadPool.cc.
+  struct Worker;
+
+  // The kBoundedQueue ring; defined in ThreadPool.cc.
+  class TaskRing;
+
+  // The start routine of kWorkStealing worker threads.
+  static void* WorkerLoop(void* arg);
+
+  // The start routine of kBoundedQueue worker threads.
+  static void* RingLoop(void* arg);
+
+  // Wakes up to "n" kBoundedQueue workers sleeping on q_cond_.
+  void WakeSleepers(size_t n);
+
+  // Returns the index of the scheduling class "t" belongs in.
+  uint32_t ClassOf(const Task* t) const;
+
+  // Picks the class to serve next among those whose queue looks
+  // non-empty, by smooth weighted round-robin over "credits" (one per
+  // class).  Returns -1 if every queue looks empty.
+  int PickClass(int64_t* credits) const;
+
+  // Takes the next kSharedQueue task; the caller must hold q_lock_.
+  Task* PopShared();
+
+  // Takes the next kBoundedQueue task, using the calling worker's own
+  // round-robin "credits".
+  Task* PopRing(int64_t* credits);
+
+  // Returns true if no task is queued in any class.  For kBoundedQueue
+  // the answer may be stale by the time it's used; for kSharedQueue,
+  // the caller must hold q_lock_.
+  bool QueuesEmpty() const;
+
+  // Returns the next task for "w" to run: from its own deque, then its
+  // inbox, then stolen from another worker.  Returns nullptr if every
+  // worker looked idle.
+  Task* FindWork(Worker* w);
+
+  // Moves a chain of inbox tasks, newest first, onto the deque of "w",
+  // and returns the oldest of them for "w" to run.
+  Task* AcceptBatch(Worker* w, Task* batch);
+
+  // Puts "w" to sleep until a task is dispatched to it or the pool
+  // shuts down.
+  void Park(Worker* w);
+
+  // Wakes "w" if it is parked; returns true if it was.
+  bool Unpark(Worker* w);
+
+  // Wakes one parked worker, if any, starting the search at "start".
+  void UnparkAny(uint32_t start);
+
+  // Returns true if any worker has a task waiting.
+  bool HasWork() const;
+
+  // Starts a worker thread at "start", pinned to cpu_ if we have one.
+  // The caller must hold q_lock_.
+  void SpawnThread(void* (*start)(void*), void* arg);
+
+  // Called by an idle worker with q_lock_ held.  Returns true if the
+  // tuner wants a worker to retire, in which case the caller has been
+  // signed off and must exit.
+  bool ShouldRetire();
+
+  // Invokes "t", recording how long it waited and ran if the pool is
+  // elastic.
+  void RunTask(Task* t);
+
+  // The start routine of the tuner thread, which resizes an elastic
+  // pool every so often.
+  static void* TunerLoop(void* arg);
+
+  // One round of tuning; the caller must hold q_lock_.  "quiet_rounds"
+  // counts the consecutive rounds in which the pool looked oversized.
+  void Tune(uint32_t* quiet_rounds);
+
+  // The pthreads pthread_t structures of the running workers, and of
+  // retired workers that haven't been joined yet.  Guarded by q_lock_.
+  std::vector<pthread_t> threads_;
+  std::vector<pthread_t> retired_;
+
+  // Signaled by each new worker once it's running, for the constructor.
+  pthread_cond_t startup_cond_;
+
+  Scheduler scheduler_;
+  int cpu_;
+
+  // The elastic sizing state.  retire_ counts the workers the tuner
+  // has asked to exit (guarded by q_lock_), and the counters sum up
+  // the tasks run since the tuner last looked.
+  bool elastic_;
+  uint32_t min_threads_;
+  uint32_t max_threads_;
+  uint32_t retire_;
+  std::atomic<uint64_t> tasks_run_;
+  std::atomic<uint64_t> wait_ns_;
+  std::atomic<uint64_t> busy_ns_;
+  std::atomic<uint32_t> num_busy_;
+  pthread_t tuner_;
+  pthread_cond_t tuner_cond_;
+
+  // The kWorkStealing state.  next_worker_ picks the worker that
+  // receives the next Dispatch(); num_parked_ counts sleeping workers;
+  // stop_ mirrors terminate_threads_ for the lock-free workers.
+  uint32_t num_workers_;
+  Worker** workers_;
+  std::atomic<uint32_t> next_worker_;
+  std::atomic<uint32_t> num_parked_;
+  std::atomic<bool> stop_;
+
+  // The weight of each scheduling class, and the kSharedQueue round-
+  // robin credits (guarded by q_lock_).
+  std::vector<uint32_t> class_weights_;
+  std::vector<int64_t> class_credits_;
+
+  // The kBoundedQueue state: one ring per class.  num_sleepers_ counts
+  // the workers waiting on q_cond_ for a ring to fill, so Dispatch()
+  // only takes q_lock_ when somebody needs waking.
+  std::vector<TaskRing*> rings_;
+  std::atomic<uint32_t> num_sleepers_;
+
+  // The worker running on the calling thread, if it belongs to a
+  // kWorkStealing pool.
+  static thread_local Worker* current_worker_;
 };
 
 }  // namespace hw4
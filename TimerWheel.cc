@@ -0,0 +1,154 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <time.h>  // for clock_gettime()
+
+#include "./TimerWheel.h"
+
+extern "C" {
+  #include "libhw1/CSE333.h"
+}
+
+namespace hw4 {
+
+// Returns the time on the monotonic clock, in nanoseconds.
+static int64_t NowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+TimerWheel::TimerWheel(uint32_t tick_ms)
+  : start_ns_(NowNs()),
+    tick_ns_(static_cast<int64_t>(tick_ms > 0 ? tick_ms : 1) * 1000000),
+    current_(0), count_(0) {
+  Verify333(pthread_mutex_init(&lock_, nullptr) == 0);
+  for (int level = 0; level < kLevels; level++) {
+    for (int slot = 0; slot < kSlots; slot++) {
+      Timer* head = &slots_[level][slot];
+      head->prev = head;
+      head->next = head;
+    }
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  Verify333(pthread_mutex_destroy(&lock_) == 0);
+}
+
+void TimerWheel::Schedule(Timer* timer, uint32_t delay_ms) {
+  // Round up, so that a timer never goes off early.
+  int64_t delay_ns = static_cast<int64_t>(delay_ms) * 1000000;
+  uint64_t ticks = (delay_ns + tick_ns_ - 1) / tick_ns_;
+
+  uint64_t now = NowTick();
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  if (timer->prev != nullptr) {
+    Unlink(timer);
+  }
+  // Nobody calls Advance() while the wheel is empty, so catch up first;
+  // with every slot empty, there's nothing to cascade.
+  if (count_ == 0 && current_ < now)
+    current_ = now;
+  timer->expires = now + ticks;
+  Insert(timer);
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+}
+
+void TimerWheel::Cancel(Timer* timer) {
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  if (timer->prev != nullptr) {
+    Unlink(timer);
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+}
+
+void TimerWheel::Advance(ExpireFn expire) {
+  uint64_t now = NowTick();
+  Verify333(pthread_mutex_lock(&lock_) == 0);
+  while (current_ <= now) {
+    int slot = current_ & (kSlots - 1);
+    if (slot == 0) {
+      Cascade(1);
+    }
+
+    Timer* head = &slots_[0][slot];
+    while (head->next != head) {
+      Timer* timer = head->next;
+      Unlink(timer);
+      expire(timer->data);
+    }
+    current_++;
+  }
+  Verify333(pthread_mutex_unlock(&lock_) == 0);
+}
+
+uint64_t TimerWheel::NowTick() const {
+  return (NowNs() - start_ns_) / tick_ns_;
+}
+
+void TimerWheel::Insert(Timer* timer) {
+  // A timer that's already due goes in the next slot we'll process,
+  // and one beyond the wheel's reach waits at its far end.
+  if (timer->expires < current_)
+    timer->expires = current_;
+  uint64_t delta = timer->expires - current_;
+  uint64_t reach = static_cast<uint64_t>(1) << (kLevelBits * kLevels);
+  if (delta >= reach) {
+    timer->expires = current_ + reach - 1;
+    delta = reach - 1;
+  }
+
+  int level = 0;
+  while (level < kLevels - 1 &&
+         delta >= (static_cast<uint64_t>(1) << (kLevelBits * (level + 1)))) {
+    level++;
+  }
+  int slot = (timer->expires >> (kLevelBits * level)) & (kSlots - 1);
+
+  Timer* head = &slots_[level][slot];
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+  count_++;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = nullptr;
+  timer->next = nullptr;
+  count_--;
+}
+
+void TimerWheel::Cascade(int level) {
+  int slot = (current_ >> (kLevelBits * level)) & (kSlots - 1);
+
+  // Take the whole list before re-inserting anything, since a timer
+  // could land back in this very slot.
+  Timer* head = &slots_[level][slot];
+  Timer* timer = head->next;
+  head->prev->next = nullptr;
+  head->prev = head;
+  head->next = head;
+  while (timer != nullptr && timer != head) {
+    Timer* next = timer->next;
+    count_--;
+    Insert(timer);
+    timer = next;
+  }
+
+  if (slot == 0 && level + 1 < kLevels)
+    Cascade(level + 1);
+}
+
+}  // namespace hw4
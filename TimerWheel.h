@@ -0,0 +1,120 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#ifndef HW4_TIMERWHEEL_H_
+#define HW4_TIMERWHEEL_H_
+
+extern "C" {
+#include <pthread.h>  // for the pthread mutex functions
+}
+
+#include <stdint.h>  // for uint32_t, etc.
+
+namespace hw4 {
+
+// A TimerWheel keeps track of a large number of timers, most of which
+// are expected to be cancelled or rescheduled before they go off (like
+// the idle timeout of a keep-alive connection), in constant time per
+// operation.
+//
+// Time is divided into ticks of a fixed length.  The wheel has several
+// levels of 64 slots each: the first level has a slot per tick for the
+// next 64 ticks, the second a slot per 64 ticks for the next 64 * 64
+// ticks, and so on.  A timer sits in the slot for its expiry on the
+// finest level that reaches that far; whenever the first level wraps
+// around, the next slot of the level above is "cascaded" down into the
+// finer levels.  Timers are intrusive doubly-linked list nodes, so
+// scheduling and cancelling are O(1), and a timer goes off within a
+// tick of its deadline.
+//
+// A TimerWheel is thread-safe.
+class TimerWheel {
+ public:
+  // A timer.  Customers embed one in whatever they want to time, and
+  // set "data" so that Advance() can tell them which one went off.
+  struct Timer {
+    Timer() : prev(nullptr), next(nullptr), expires(0), data(nullptr) { }
+
+    // The neighbors in the slot's list; prev is null while the timer
+    // isn't scheduled.
+    Timer* prev;
+    Timer* next;
+
+    // The tick the timer goes off at.
+    uint64_t expires;
+
+    void* data;
+  };
+
+  // The callback Advance() runs for each timer that goes off.
+  typedef void (*ExpireFn)(void* data);
+
+  // Creates an empty wheel whose ticks are "tick_ms" milliseconds long.
+  explicit TimerWheel(uint32_t tick_ms);
+  virtual ~TimerWheel();
+
+  // Schedules "timer" to go off "delay_ms" milliseconds from now.  If
+  // it was already scheduled, it is moved.
+  void Schedule(Timer* timer, uint32_t delay_ms);
+
+  // Cancels "timer" if it is scheduled.
+  void Cancel(Timer* timer);
+
+  // Runs "expire" on the data of every timer whose deadline has passed,
+  // unscheduling them.  "expire" runs with the wheel locked, so that a
+  // timer's owner can't be cancelling it and destroying it at the same
+  // time; it mustn't call back into the wheel.
+  void Advance(ExpireFn expire);
+
+  // Returns the length of a tick in milliseconds.  Calling Advance()
+  // at least this often keeps timers going off on time.
+  uint32_t tick_ms() const { return tick_ns_ / 1000000; }
+
+ private:
+  static const int kLevelBits = 6;
+  static const int kSlots = 1 << kLevelBits;
+  static const int kLevels = 4;
+
+  // Returns the current tick.
+  uint64_t NowTick() const;
+
+  // Puts "timer" in the right slot for its expiry; the caller must hold
+  // lock_.
+  void Insert(Timer* timer);
+
+  // Unlinks "timer" from its slot; the caller must hold lock_.
+  void Unlink(Timer* timer);
+
+  // Moves the timers in the current slot of "level" down to the finer
+  // levels, then cascades the level above if this one wrapped around;
+  // the caller must hold lock_.  That order is safe: Insert() never
+  // puts a timer brought down from a higher level back into the slot
+  // of this level that was just emptied.
+  void Cascade(int level);
+
+  int64_t start_ns_;
+  int64_t tick_ns_;
+
+  pthread_mutex_t lock_;
+
+  // The next tick to process.
+  uint64_t current_;
+
+  // The number of scheduled timers.
+  uint64_t count_;
+
+  // Each slot is a circular list, with a sentinel Timer as its head.
+  Timer slots_[kLevels][kSlots];
+};
+
+}  // namespace hw4
+
+#endif  // HW4_TIMERWHEEL_H_
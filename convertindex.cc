@@ -0,0 +1,47 @@
+/*
+ * Copyright ©2022 Hal Perkins.  All rights reserved.  Permission is
+ * hereby granted to students registered for University of Washington
+ * CSE 333 for use solely during Spring Quarter 2022 for purposes of
+ * the course.  No other use, copying, distribution, or modification
+ * is permitted without prior written consent. Copyrights for
+ * third-party components of this work must be honored.  Instructors
+ * interested in reusing these course materials should contact the
+ * author.
+ */
+
+#include <stdint.h>  // for int64_t
+#include <stdlib.h>  // for EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>  // for strcmp()
+#include <iostream>
+#include <string>
+
+#include "./IndexLayoutV2.h"
+#include "./IndexWriterV2.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+// convertindex rewrites an index file, of either format version, as a
+// version 2 index file (see IndexLayoutV2.h).  With --compress, the new
+// file's postings are compressed.
+int main(int argc, char** argv) {
+  uint64_t features = 0;
+  int arg = 1;
+  if (arg < argc && strcmp(argv[arg], "--compress") == 0) {
+    features |= hw4::kCompressedPostingsV2;
+    arg++;
+  }
+  if (argc - arg != 2) {
+    cerr << "Usage: " << argv[0] << " [--compress] in.idx out.idx" << endl;
+    return EXIT_FAILURE;
+  }
+
+  int64_t bytes = hw4::ConvertIndexToV2(argv[arg], argv[arg + 1], features);
+  if (bytes < 0) {
+    cerr << argv[0] << ": couldn't convert " << argv[arg] << endl;
+    return EXIT_FAILURE;
+  }
+  cout << "wrote " << argv[arg + 1] << ": " << bytes << " bytes" << endl;
+  return EXIT_SUCCESS;
+}
@@ -41,15 +41,19 @@ static void Usage(char* prog_name);
 // - port: output parameter returning the port number to listen on
 // - path: output parameter returning the directory with our static files
 // - indices: output parameter returning the list of index file names
+// - options: output parameter returning any server options given as
+//   "--" flags among the index file names
 //
 // Calls Usage() on failure. Possible errors include:
 // - path is not a readable directory
 // - index file names are readable
+// - an unrecognized "--" flag
 static void GetPortAndPath(int argc,
                     char** argv,
                     uint16_t* const port,
                     string* const path,
-                    list<string>* const indices);
+                    list<string>* const indices,
+                    hw4::HttpServerOptions* const options);
 
 int main(int argc, char** argv) {
   // Print out welcome message.
@@ -68,12 +72,13 @@ int main(int argc, char** argv) {
   uint16_t port_num;
   string static_dir;
   list<string> indices;
-  GetPortAndPath(argc, argv, &port_num, &static_dir, &indices);
+  hw4::HttpServerOptions options;
+  GetPortAndPath(argc, argv, &port_num, &static_dir, &indices, &options);
   cout << "    port: " << port_num << endl;
   cout << "    path: " << static_dir << endl;
 
   // Run the server.
-  hw4::HttpServer hs(port_num, static_dir, indices);
+  hw4::HttpServer hs(port_num, static_dir, indices, options);
   if (!hs.Run()) {
     cerr << "  server failed to run!?" << endl;
   }
@@ -84,8 +89,50 @@ int main(int argc, char** argv) {
 
 
 static void Usage(char* prog_name) {
-  cerr << "Usage: " << prog_name << " port staticfiles_directory indices+";
-  cerr << endl;
+  cerr << "Usage: " << prog_name << " port staticfiles_directory "
+       << "[options] indices+" << endl;
+  cerr << "Options:" << endl;
+  cerr << "  --io-uring           serve connections through io_uring" << endl;
+  cerr << "  --shards=N           "
+       << "run N SO_REUSEPORT shards (0: one per CPU)" << endl;
+  cerr << "  --no-dns             "
+       << "don't resolve client names for the log" << endl;
+  cerr << "  --work-stealing      "
+       << "schedule workers with work-stealing deques" << endl;
+  cerr << "  --bounded-queue[=N]  "
+       << "queue at most N ready connections per shard" << endl;
+  cerr << "  --min-threads=N      start with N worker threads" << endl;
+  cerr << "  --max-threads=N      grow to at most N worker threads" << endl;
+  cerr << "  --weights=S:Q        "
+       << "serve static files and queries in an S:Q ratio" << endl;
+  cerr << "  --static-cache=MB    "
+       << "cache up to MB megabytes of static files (0: off)" << endl;
+  cerr << "  --idle-timeout=MS    "
+       << "close keep-alive connections idle for MS ms (0: never)" << endl;
+  cerr << "  --header-timeout=MS  "
+       << "allow MS ms to send a request header (0: forever)" << endl;
+  cerr << "  --write-timeout=MS   "
+       << "give up on clients that stop reading for MS ms" << endl;
+  cerr << "  --max-header=BYTES   "
+       << "reject request headers longer than BYTES with a 431" << endl;
+  cerr << "  --max-requests=N     "
+       << "close connections after N requests (0: no limit)" << endl;
+  cerr << "  --shed-target=MS     "
+       << "shed requests once queueing delay stays above MS ms (0: off)"
+       << endl;
+  cerr << "  --max-queued=N       "
+       << "shed requests once N are waiting for a worker" << endl;
+  cerr << "  --query-deadline=MS  "
+       << "stop queries after MS ms, showing partial results (0: never)"
+       << endl;
+  cerr << "  --mmap-index         "
+       << "read the index files through a shared mmap()" << endl;
+  cerr << "  --pread-index        "
+       << "read the index files with pread() on shared descriptors" << endl;
+  cerr << "  --resident-index     "
+       << "decode the index files into memory at startup" << endl;
+  cerr << "  --stats-interval=S   "
+       << "print the server's counters every S seconds (0: never)" << endl;
   exit(EXIT_FAILURE);
 }
 
@@ -93,7 +140,8 @@ static void GetPortAndPath(int argc,
                     char** argv,
                     uint16_t* const port,
                     string* const path,
-                    list<string>* const indices) {
+                    list<string>* const indices,
+                    hw4::HttpServerOptions* const options) {
   // Here are some considerations when implementing this function:
   // - There is a reasonable number of command line arguments
   // - The port number is reasonable
@@ -130,6 +178,63 @@ static void GetPortAndPath(int argc,
   // index file
   for (int i = 3; i < argc; i++) {
     std::string fname(argv[i]);
+    if (fname.substr(0, 2) == "--") {
+      if (fname == "--io-uring") {
+        options->use_io_uring = true;
+      } else if (fname.substr(0, 9) == "--shards=") {
+        options->num_shards = atoi(fname.substr(9).c_str());
+      } else if (fname == "--no-dns") {
+        options->resolve_dns = false;
+      } else if (fname == "--work-stealing") {
+        options->scheduler = hw4::ThreadPool::kWorkStealing;
+      } else if (fname == "--bounded-queue") {
+        options->scheduler = hw4::ThreadPool::kBoundedQueue;
+      } else if (fname.substr(0, 16) == "--bounded-queue=") {
+        options->scheduler = hw4::ThreadPool::kBoundedQueue;
+        options->queue_capacity = atoi(fname.substr(16).c_str());
+      } else if (fname.substr(0, 14) == "--min-threads=") {
+        options->min_threads = atoi(fname.substr(14).c_str());
+      } else if (fname.substr(0, 14) == "--max-threads=") {
+        options->max_threads = atoi(fname.substr(14).c_str());
+      } else if (fname.substr(0, 15) == "--static-cache=") {
+        options->static_cache_bytes =
+          static_cast<size_t>(atoi(fname.substr(15).c_str())) << 20;
+      } else if (fname.substr(0, 15) == "--idle-timeout=") {
+        options->idle_timeout_ms = atoi(fname.substr(15).c_str());
+      } else if (fname.substr(0, 17) == "--header-timeout=") {
+        options->header_timeout_ms = atoi(fname.substr(17).c_str());
+      } else if (fname.substr(0, 16) == "--write-timeout=") {
+        options->write_timeout_ms = atoi(fname.substr(16).c_str());
+      } else if (fname.substr(0, 13) == "--max-header=") {
+        options->max_header_bytes = atoi(fname.substr(13).c_str());
+      } else if (fname.substr(0, 15) == "--max-requests=") {
+        options->max_requests_per_connection =
+          atoi(fname.substr(15).c_str());
+      } else if (fname.substr(0, 14) == "--shed-target=") {
+        options->admission_target_ms = atoi(fname.substr(14).c_str());
+      } else if (fname.substr(0, 13) == "--max-queued=") {
+        options->max_queued_requests = atoi(fname.substr(13).c_str());
+      } else if (fname.substr(0, 17) == "--query-deadline=") {
+        options->query_deadline_ms = atoi(fname.substr(17).c_str());
+      } else if (fname == "--mmap-index") {
+        options->index_mode = hw4::QueryProcessorPool::kMappedIndex;
+      } else if (fname == "--pread-index") {
+        options->index_mode = hw4::QueryProcessorPool::kPreadIndex;
+      } else if (fname == "--resident-index") {
+        options->index_mode = hw4::QueryProcessorPool::kResidentIndex;
+      } else if (fname.substr(0, 17) == "--stats-interval=") {
+        options->stats_interval_secs = atoi(fname.substr(17).c_str());
+      } else if (fname.substr(0, 10) == "--weights=") {
+        if (sscanf(fname.c_str() + 10, "%u:%u", &options->static_weight,
+                   &options->query_weight) != 2) {
+          Usage(argv[0]);
+        }
+      } else {
+        cerr << "Unrecognized option " << fname << "." << endl;
+        Usage(argv[0]);
+      }
+      continue;
+    }
     if (fname.length() >= 4 && fname.substr(fname.length() - 4) == ".idx") {
       struct stat fstat;
       if (stat(argv[i], &fstat) == -1) {